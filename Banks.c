@@ -0,0 +1,212 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include "Banks.h"
+
+BankWindow *bankWindowCreate(CPU *cpu, uint16_t address, uint32_t size, int count)
+{
+	BankWindow *window;
+	if (size == 0 || ((address | size) & (MEMORY_PAGE_SIZE - 1)) || address + size > 65536 || count <= 0){
+		return NULL;
+	}
+	window = calloc(1, sizeof(BankWindow));
+	if (window == NULL){
+		return NULL;
+	}
+	window->banks = calloc(count, sizeof(uint8_t *));
+	window->readOnly = calloc(count, sizeof(bool));
+	window->pages = calloc((size_t)count * (size >> MEMORY_PAGE_SHIFT), sizeof(MemoryPage));
+	window->saved = calloc(count, sizeof(bool));
+	if (window->banks == NULL || window->readOnly == NULL || window->pages == NULL || window->saved == NULL){
+		bankWindowFree(window);
+		return NULL;
+	}
+	window->cpu = cpu;
+	window->address = address;
+	window->size = size;
+	window->count = count;
+	window->selected = -1;
+	return window;
+}
+
+static MemoryPage *bankPages(BankWindow *window, int bank)
+{
+	return window->pages + (size_t)bank * (window->size >> MEMORY_PAGE_SHIFT);
+}
+
+/* Drops the entries put away for bank, if any */
+static void forget(BankWindow *window, int bank)
+{
+	if (window->saved[bank]){
+		cpuReleasePages(bankPages(window, bank), window->size >> MEMORY_PAGE_SHIFT);
+		window->saved[bank] = false;
+	}
+}
+
+void bankWindowFree(BankWindow *window)
+{
+	int i;
+	if (window == NULL){
+		return;
+	}
+	for (i = 0; window->saved != NULL && i < window->count; i++){
+		forget(window, i);
+	}
+	free(window->banks);
+	free(window->readOnly);
+	free(window->pages);
+	free(window->saved);
+	free(window);
+}
+
+bool bankSet(BankWindow *window, int bank, uint8_t *host, bool readOnly)
+{
+	if (bank < 0 || bank >= window->count || host == NULL){
+		return false;
+	}
+	forget(window, bank);
+	window->banks[bank] = host;
+	window->readOnly[bank] = readOnly;
+	if (bank == window->selected){
+		window->selected = -1;
+		return bankSelect(window, bank);
+	}
+	return true;
+}
+
+bool bankSelect(BankWindow *window, int bank)
+{
+	if (bank < 0 || bank >= window->count || window->banks[bank] == NULL){
+		return false;
+	}
+	if (bank == window->selected){
+		return true;
+	}
+	if (window->selected >= 0){
+		window->saved[window->selected] = cpuSavePages(window->cpu, window->address, window->size, bankPages(window, window->selected));
+	}
+	window->selected = bank;
+	if (window->saved[bank]){
+		bool mapped = cpuLoadPages(window->cpu, window->address, window->size, bankPages(window, bank));
+		forget(window, bank);
+		return mapped;
+	}
+	return cpuMapMemory(window->cpu, window->address, window->size, window->banks[bank], window->readOnly[bank]);
+}
+
+static void selectPortWrite(void *context, uint8_t port, uint8_t value)
+{
+	(void)port;
+	bankSelect(context, value);
+}
+
+void bankBindPort(BankWindow *window, PortBus *bus, uint8_t port)
+{
+	portBindWrite(bus, port, selectPortWrite, window);
+}
+
+/* One check for bankCheck() */
+static int expect(FILE *out, CPU *cpu, uint8_t value, const char *what)
+{
+	uint8_t read = cpuReadByte(cpu, 0x8000);
+	if (read != value){
+		fprintf(out, "%s: read %02x, expected %02x\n", what, read, value);
+		return 1;
+	}
+	return 0;
+}
+
+/* Stores to every page of more banks than the CPU has pages, with a
+	snapshot alive, then restores it */
+#define CHECK_BANKS 8
+static int manyBanks(FILE *out, CPU *cpu)
+{
+	static uint8_t banks[CHECK_BANKS][0x4000];
+	BankWindow *window = bankWindowCreate(cpu, 0x8000, 0x4000, CHECK_BANKS);
+	Snapshot *snapshot;
+	uint32_t address;
+	int failures = 0;
+	int i;
+	for (i = 0; window != NULL && i < CHECK_BANKS; i++){
+		bankSet(window, i, banks[i], false);
+	}
+	bankSelect(window, 0);
+	cpuWriteByte(cpu, 0x8000, 5);
+	snapshot = cpuSnapshot(cpu);
+	if (window == NULL || snapshot == NULL){
+		fprintf(out, "Couldn't set up the bank window\n");
+		snapshotFree(snapshot);
+		bankWindowFree(window);
+		return 1;
+	}
+	for (i = 0; i < CHECK_BANKS; i++){
+		bankSelect(window, i);
+		for (address = 0x8000; address < 0xC000; address += MEMORY_PAGE_SIZE){
+			cpuWriteByte(cpu, address, 0x80 + i);
+		}
+	}
+	for (i = 0; i < CHECK_BANKS; i++){
+		bankSelect(window, i);
+		if (cpuReadByte(cpu, 0xBF00) != 0x80 + i){
+			fprintf(out, "bank %d lost a store among %d banks\n", i, CHECK_BANKS);
+			failures++;
+		}
+	}
+	bankSelect(window, 0);
+	cpuRestore(cpu, snapshot);
+	failures += expect(out, cpu, 5, "snapshot after storing to every page of every bank");
+	snapshotFree(snapshot);
+	bankWindowFree(window);
+	return failures;
+}
+
+int bankCheck(FILE *out)
+{
+	static uint8_t memory[65536];
+	static uint8_t banks[2][0x4000];
+	CPU cpu;
+	BankWindow *window;
+	Snapshot *snapshot;
+	int failures = 0;
+	cpuInit(&cpu, memory);
+	window = bankWindowCreate(&cpu, 0x8000, 0x4000, 2);
+	if (window == NULL || !bankSet(window, 0, banks[0], false) || !bankSet(window, 1, banks[1], false)){
+		fprintf(out, "Couldn't set up the bank window\n");
+		bankWindowFree(window);
+		cpuFree(&cpu);
+		return 1;
+	}
+	bankSelect(window, 0);
+	cpuWriteByte(&cpu, 0x8000, 1);
+	snapshot = cpuSnapshot(&cpu);
+	if (snapshot == NULL){
+		fprintf(out, "Out of memory for the snapshot\n");
+		bankWindowFree(window);
+		cpuFree(&cpu);
+		return 1;
+	}
+	/* Selecting bank 0 again mustn't hand the snapshot's page back writable */
+	bankSelect(window, 1);
+	bankSelect(window, 0);
+	cpuWriteByte(&cpu, 0x8000, 2);
+	failures += expect(out, &cpu, 2, "store after selecting the bank again");
+	cpuRestore(&cpu, snapshot);
+	failures += expect(out, &cpu, 1, "snapshot after selecting the bank again");
+	/* Copies of a bank's pages follow it out and back */
+	cpuWriteByte(&cpu, 0x8000, 3);
+	bankSelect(window, 1);
+	cpuWriteByte(&cpu, 0x8000, 4);
+	bankSelect(window, 0);
+	failures += expect(out, &cpu, 3, "bank 0 after switching back");
+	bankSelect(window, 1);
+	failures += expect(out, &cpu, 4, "bank 1 after switching back");
+	snapshotFree(snapshot);
+	bankWindowFree(window);
+	failures += manyBanks(out, &cpu);
+	if (banks[0][0] != 1){
+		fprintf(out, "bank 0's host memory changed under the snapshot: %02x\n", banks[0][0]);
+		failures++;
+	}
+	cpuFree(&cpu);
+	return failures;
+}
@@ -0,0 +1,53 @@
+#ifndef BANKS_H
+#define BANKS_H
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "Core.h"
+#include "Ports.h"
+/* Bank switching for memory beyond the 64K address space.
+	A window is a page-aligned range of the address space that shows one
+	of several host banks of the same size at a time. Selecting a bank
+	re-points the window's page entries at it, so a switch stores a page
+	entry per page whatever the bank size and never copies memory. The
+	entries of the bank switched away from are kept with it, so pages the
+	CPU copied from it since a snapshot (see Core.h) come back with it.
+	Code decoded or translated from the old bank is dropped on the way,
+	only for pages that held any.
+	Banks are owned by the host; a window only keeps pointers to them.
+	Which bank is selected is device state, so restoring a snapshot taken
+	with another bank selected leaves the window out of step with it. */
+typedef struct BankWindow {
+	CPU *cpu;
+	uint16_t address;
+	uint32_t size;
+	int count;
+	int selected; /* -1 until a bank has been selected */
+	uint8_t **banks;
+	bool *readOnly;
+	/* Page entries of each bank put away, while saved[bank] */
+	MemoryPage *pages;
+	bool *saved;
+} BankWindow;
+
+/* size must be a multiple of MEMORY_PAGE_SIZE that fits at address.
+	Returns NULL for a bad range or if out of memory. Until a bank is
+	selected the window keeps whatever was mapped there before. */
+BankWindow *bankWindowCreate(CPU *cpu, uint16_t address, uint32_t size, int count);
+void bankWindowFree(BankWindow *window);
+/* Makes host, which holds the window's size in bytes, bank number bank.
+	Writes are dropped while a read-only bank is selected. Setting the
+	selected bank maps it right away. */
+bool bankSet(BankWindow *window, int bank, uint8_t *host, bool readOnly);
+/* Returns false, leaving the window alone, for a bank that doesn't
+	exist or hasn't been set */
+bool bankSelect(BankWindow *window, int bank);
+/* OUT port then selects the bank numbered by the value written. The
+	port is bound unbatched so the switch happens before the next
+	instruction runs. */
+void bankBindPort(BankWindow *window, PortBus *bus, uint8_t port);
+/* Switches banks around a snapshot in a scratch CPU, checking that the
+	snapshot keeps what it saw and that no bank loses a store. Writes what
+	went wrong to out and returns how many checks failed. */
+int bankCheck(FILE *out);
+#endif
@@ -0,0 +1,214 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include "Core.h"
+#include "Loader.h"
+#include "Batch.h"
+/* Batch runner: many guest programs, one CPU each, spread over a pool of
+	worker threads. Workers pull the next program index from a shared atomic
+	counter, so there is no queue lock and no per-program thread startup. */
+
+typedef struct BatchJob {
+	char *path;
+	long loaded;
+	CPU cpu;
+} BatchJob;
+
+typedef struct BatchPool {
+	BatchJob *jobs;
+	int count;
+	int64_t cycleLimit;
+	atomic_int next;
+} BatchPool;
+
+/* Returns -1 if out of memory */
+static int addJob(BatchPool *pool, int *capacity, const char *path)
+{
+	char *copy;
+	if (pool->count == *capacity){
+		int grownCapacity = *capacity ? *capacity * 2 : 64;
+		BatchJob *grown = realloc(pool->jobs, grownCapacity * sizeof(BatchJob));
+		if (grown == NULL){
+			return -1;
+		}
+		pool->jobs = grown;
+		*capacity = grownCapacity;
+	}
+	copy = strdup(path);
+	if (copy == NULL){
+		return -1;
+	}
+	pool->jobs[pool->count].path = copy;
+	pool->jobs[pool->count].loaded = -1;
+	pool->count++;
+	return 0;
+}
+
+static void freeJobs(BatchPool *pool)
+{
+	int i;
+	for (i = 0; i < pool->count; i++){
+		free(pool->jobs[i].path);
+	}
+	free(pool->jobs);
+	pool->jobs = NULL;
+	pool->count = 0;
+}
+
+static int compareJobs(const void *a, const void *b)
+{
+	return strcmp(((const BatchJob *)a)->path, ((const BatchJob *)b)->path);
+}
+
+static int collectDirectory(BatchPool *pool, const char *dirPath)
+{
+	DIR *dir;
+	struct dirent *entry;
+	struct stat info;
+	char path[4096];
+	int capacity = 0;
+	dir = opendir(dirPath);
+	if (dir == NULL){
+		return -1;
+	}
+	while ((entry = readdir(dir)) != NULL){
+		snprintf(path, sizeof(path), "%s/%s", dirPath, entry->d_name);
+		if (stat(path, &info) == 0 && S_ISREG(info.st_mode) && addJob(pool, &capacity, path) < 0){
+			closedir(dir);
+			return -1;
+		}
+	}
+	closedir(dir);
+	qsort(pool->jobs, pool->count, sizeof(BatchJob), compareJobs);
+	return 0;
+}
+
+static int collectManifest(BatchPool *pool, const char *manifestPath)
+{
+	FILE *manifest;
+	char line[4096];
+	int capacity = 0;
+	manifest = fopen(manifestPath, "r");
+	if (manifest == NULL){
+		return -1;
+	}
+	while (fgets(line, sizeof(line), manifest) != NULL){
+		line[strcspn(line, "\r\n")] = '\0';
+		if (line[0] == '\0' || line[0] == '#'){
+			continue;
+		}
+		if (addJob(pool, &capacity, line) < 0){
+			fclose(manifest);
+			return -1;
+		}
+	}
+	fclose(manifest);
+	return 0;
+}
+
+static void *batchWorker(void *arg)
+{
+	BatchPool *pool = arg;
+	uint8_t *memory = malloc(65536);
+	Image *image;
+	int index;
+	if (memory == NULL){
+		return NULL;
+	}
+	while ((index = atomic_fetch_add(&pool->next, 1)) < pool->count){
+		BatchJob *job = &pool->jobs[index];
+		memset(memory, 0, 65536);
+		cpuInit(&job->cpu, memory);
+		/* Mapped copy-on-write, jobs running the same program share its
+			pages until they store to them */
+		image = mapProgram(&job->cpu, job->path);
+		if (image == NULL){
+			continue;
+		}
+		job->loaded = image->size;
+		job->cpu.cycleLimit = pool->cycleLimit;
+		tick(&job->cpu);
+		cpuFree(&job->cpu);
+		imageClose(image);
+		job->cpu.memory = NULL;
+	}
+	free(memory);
+	return NULL;
+}
+
+static void printResult(const BatchJob *job)
+{
+	const CPU *cpu = &job->cpu;
+	uint8_t flags = cpuFlags(cpu);
+	if (job->loaded < 0){
+		printf("%s: exit=LOADFAIL\n", job->path);
+		return;
+	}
+	printf("%s: exit=%s cycles=%" PRId64 " PC=%04x SP=%04x A=%02x B=%02x C=%02x D=%02x E=%02x H=%02x L=%02x S=%d Z=%d AC=%d P=%d CY=%d\n",
+		job->path, exitReasonName(cpu->exitReason), cpu->cycleCount,
+		cpu->programCounter, cpu->stackPointer,
+		cpu->A, cpu->B, cpu->C, cpu->D, cpu->E, cpu->H, cpu->L,
+		(flags & FLAG_S) != 0, (flags & FLAG_Z) != 0, (flags & FLAG_AC) != 0,
+		(flags & FLAG_P) != 0, (flags & FLAG_C) != 0);
+}
+
+int runBatch(const char *source, int64_t cycleLimit, int jobs)
+{
+	BatchPool pool = {0};
+	pthread_t *threads;
+	struct stat info;
+	int failures = 0;
+	int started = 0;
+	int i;
+	if (stat(source, &info) == 0 && S_ISDIR(info.st_mode)){
+		i = collectDirectory(&pool, source);
+	}
+	else{
+		i = collectManifest(&pool, source);
+	}
+	if (i < 0){
+		perror(source);
+		freeJobs(&pool);
+		return -1;
+	}
+	if (jobs <= 0){
+		jobs = (int)sysconf(_SC_NPROCESSORS_ONLN);
+	}
+	if (jobs > pool.count){
+		jobs = pool.count;
+	}
+	if (jobs < 1){
+		jobs = 1;
+	}
+	pool.cycleLimit = cycleLimit;
+	atomic_init(&pool.next, 0);
+	threads = malloc(jobs * sizeof(pthread_t));
+	for (i = 0; threads != NULL && i < jobs; i++){
+		if (pthread_create(&threads[started], NULL, batchWorker, &pool) == 0){
+			started++;
+		}
+	}
+	if (started == 0){
+		/* No threads available, run on the calling thread instead */
+		batchWorker(&pool);
+	}
+	for (i = 0; i < started; i++){
+		pthread_join(threads[i], NULL);
+	}
+	free(threads);
+	for (i = 0; i < pool.count; i++){
+		printResult(&pool.jobs[i]);
+		if (pool.jobs[i].loaded < 0){
+			failures++;
+		}
+	}
+	freeJobs(&pool);
+	return failures;
+}
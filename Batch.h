@@ -0,0 +1,10 @@
+#ifndef BATCH_H
+#define BATCH_H
+/* Runs every program listed in a manifest file (one path per line, '#'
+	starts a comment) or found in a directory. Each program gets its own CPU
+	and runs to HLT or until cycleLimit cycles (0 for no limit) on a pool of
+	jobs worker threads (0 picks one per online core). One result line per
+	program is printed in manifest order. Returns the number of programs that
+	failed to load. */
+int runBatch(const char *source, int64_t cycleLimit, int jobs);
+#endif
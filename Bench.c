@@ -0,0 +1,344 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <inttypes.h>
+#include <time.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "Core.h"
+#include "Loader.h"
+/* Throughput benchmark for the core.
+	Runs a workload for a fixed number of cycles and reports emulated MHz,
+	host nanoseconds per guest instruction and guest instructions per
+	second, the best of several runs after a warm-up, with the median to
+	show how steady they were.
+	CP/M programs like cpudiag.bin get a BDOS stub (RET at 0x0005) and jump
+	back to 0x0000 when done, which NOP-slides into 0x100 and starts the
+	program again, so any cycle budget is a steady loop over the program.
+	Programs that end in HLT instead are restarted from a snapshot, which
+	costs a few page copies and counts towards their time.
+	--suite runs every program in programs/ (backups left out), program1
+	when progMaker.py has made it, and the synthetic kernels below. The
+	programs that end in HLT come last, under a heading of their own: they
+	run a few instructions between restores and register dumps, so their
+	figures say little about the core and would hide a regression in it.
+	What the guest prints (opcode 0x30 dumps the registers) goes to
+	/dev/null, only the results to standard output. */
+#define BENCH_PROGRAM_DIR "programs"
+#define BENCH_MAX_PROGRAMS 64
+/* Instructions are counted single-stepping up to this many cycles of the
+	workload and scaled up to the budget, all of them loop steadily */
+#define BENCH_COUNT_CYCLES 20000000
+
+/* Synthetic kernels, each an endless loop at 0x100 leaning on one part
+	of the core */
+static const uint8_t aluKernel[] = {
+	0x3E, 0x01, /* MVI A,1 */
+	0x06, 0x03, /* MVI B,3 */
+	0x0E, 0x05, /* MVI C,5 */
+	0x80, /* 0106 ADD B */
+	0x91, /* SUB C */
+	0xA1, /* ANA C */
+	0xB0, /* ORA B */
+	0xA8, /* XRA B */
+	0x88, /* ADC B */
+	0x99, /* SBB C */
+	0x04, /* INR B */
+	0x0D, /* DCR C */
+	0x27, /* DAA */
+	0x07, /* RLC */
+	0x1F, /* RAR */
+	0xB9, /* CMP C */
+	0xC6, 0x11, /* ADI 11 */
+	0xEE, 0x5A, /* XRI 5A */
+	0x29, /* DAD H */
+	0xC3, 0x06, 0x01 /* JMP 0106 */
+};
+static const uint8_t branchKernel[] = {
+	0x06, 0x00, /* MVI B,0 */
+	0x04, /* 0102 INR B */
+	0x78, /* MOV A,B */
+	0xE6, 0x01, /* ANI 01 */
+	0xCA, 0x0D, 0x01, /* JZ 010D */
+	0x0F, /* RRC */
+	0xC3, 0x0E, 0x01, /* JMP 010E */
+	0x07, /* 010D RLC */
+	0xE6, 0x06, /* 010E ANI 06 */
+	0xC2, 0x16, 0x01, /* JNZ 0116 */
+	0xC3, 0x02, 0x01, /* JMP 0102 */
+	0xFE, 0x04, /* 0116 CPI 04 */
+	0xDA, 0x02, 0x01, /* JC 0102 */
+	0xF2, 0x02, 0x01, /* JP 0102 */
+	0xC3, 0x02, 0x01 /* JMP 0102 */
+};
+static const uint8_t memoryKernel[] = {
+	0x21, 0x00, 0x20, /* LXI H,2000 */
+	0x11, 0x00, 0x30, /* LXI D,3000 */
+	0x0E, 0x00, /* MVI C,0 */
+	0x7E, /* 0108 MOV A,M */
+	0x12, /* STAX D */
+	0x3C, /* INR A */
+	0x77, /* MOV M,A */
+	0x34, /* INR M */
+	0x1A, /* LDAX D */
+	0x32, 0x00, 0x40, /* STA 4000 */
+	0x3A, 0x01, 0x40, /* LDA 4001 */
+	0x23, /* INX H */
+	0x13, /* INX D */
+	0x0D, /* DCR C */
+	0xC2, 0x08, 0x01, /* JNZ 0108, 256 times round */
+	0x22, 0x02, 0x40, /* SHLD 4002 */
+	0x2A, 0x02, 0x40, /* LHLD 4002 */
+	0x26, 0x20, /* MVI H,20 */
+	0x16, 0x30, /* MVI D,30 */
+	0xC3, 0x08, 0x01 /* JMP 0108 */
+};
+static const uint8_t callKernel[] = {
+	0x31, 0x00, 0xF0, /* LXI SP,F000 */
+	0xCD, 0x11, 0x01, /* 0103 CALL 0111 */
+	0xCD, 0x15, 0x01, /* CALL 0115 */
+	0xCF, /* RST 1, RET at 0008 */
+	0xC3, 0x03, 0x01, /* JMP 0103 */
+	0x00, 0x00, 0x00, 0x00,
+	0xC5, /* 0111 PUSH B */
+	0xC1, /* POP B */
+	0xC9, /* RET */
+	0x00,
+	0xCD, 0x11, 0x01, /* 0115 CALL 0111 */
+	0xAF, /* XRA A */
+	0xC8, /* RZ */
+	0xC9 /* RET */
+};
+static const struct {
+	const char *name;
+	const uint8_t *code;
+	size_t size;
+} kernels[] = {
+	{ "kernel-alu", aluKernel, sizeof(aluKernel) },
+	{ "kernel-branch", branchKernel, sizeof(branchKernel) },
+	{ "kernel-memory", memoryKernel, sizeof(memoryKernel) },
+	{ "kernel-call", callKernel, sizeof(callKernel) }
+};
+
+static FILE *results;
+
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Runs the CPU for cycles cycles from start, restarting it whenever it
+	halts. With step it goes one instruction per cpuRunCycles() call and
+	returns how many it ran. Returns -1 for an unimplemented opcode, -2 if
+	the core ran out of memory. */
+static long long runProgram(CPU *cpu, const Snapshot *start, int64_t cycles, bool step)
+{
+	long long instructions = 0;
+	while (cpu->cycleCount < cycles){
+		ExitReason reason = cpuRunCycles(cpu, step ? 1 : cycles - cpu->cycleCount);
+		instructions++;
+		if (reason == EXIT_HALT){
+			int64_t cycleCount = cpu->cycleCount;
+			cpuRestore(cpu, start);
+			cpu->cycleCount = cycleCount;
+		}
+		else if (reason == EXIT_UNIMPLEMENTED){
+			return -1;
+		}
+		else if (reason == EXIT_NO_MEMORY){
+			return -2;
+		}
+	}
+	return instructions;
+}
+
+/* Returns the seconds taken, or the instruction count with step; -1 for
+	an unimplemented opcode, -2 for out of memory */
+static double runOnce(const uint8_t *image, uint8_t *memory, int64_t cycles, bool step)
+{
+	CPU cpu;
+	Snapshot *start;
+	double elapsed;
+	long long instructions;
+	memcpy(memory, image, 65536);
+	cpuInit(&cpu, memory);
+	start = cpuSnapshot(&cpu);
+	if (start == NULL){
+		cpuFree(&cpu);
+		return -2;
+	}
+	elapsed = now();
+	instructions = runProgram(&cpu, start, cycles, step);
+	elapsed = now() - elapsed;
+	snapshotFree(start);
+	cpuFree(&cpu);
+	if (instructions < 0){
+		return instructions;
+	}
+	return step ? instructions : elapsed;
+}
+
+static int compareTimes(const void *a, const void *b)
+{
+	double x = *(const double *)a;
+	double y = *(const double *)b;
+	return (x > y) - (x < y);
+}
+
+static void bench(const char *label, const char *name, const uint8_t *image, int64_t cycles, int repeats)
+{
+	static uint8_t memory[65536];
+	double times[repeats];
+	int64_t countCycles = cycles < BENCH_COUNT_CYCLES ? cycles : BENCH_COUNT_CYCLES;
+	double instructions = runOnce(image, memory, countCycles, true);
+	double best;
+	int i;
+	if (instructions < 0){
+		fprintf(results, "%-8s %-24s %s, skipped\n", label, name, instructions == -1 ? "unimplemented opcode" : "out of memory");
+		return;
+	}
+	instructions *= (double)cycles / countCycles;
+	/* Warm up caches and branch predictors first */
+	runOnce(image, memory, cycles / 10, false);
+	for (i = 0; i < repeats; i++){
+		times[i] = runOnce(image, memory, cycles, false);
+	}
+	qsort(times, repeats, sizeof(double), compareTimes);
+	best = times[0];
+	fprintf(results, "%-8s %-24s %11" PRId64 " cycles %8.4f s %9.2f MHz %7.3f ns/instr %9.2f Minstr/s  median %8.4f s\n",
+		label, name, cycles, best, cycles / best / 1e6, best / instructions * 1e9,
+		instructions / best / 1e6, times[repeats / 2]);
+	fflush(results);
+}
+
+static bool loadImage(uint8_t *image, const char *path)
+{
+	memset(image, 0, 65536);
+	if (loadProgram(image, path) < 0){
+		perror(path);
+		return false;
+	}
+	image[5] = 0xC9;
+	return true;
+}
+
+/* Whether the program stops at a HLT within the cycles */
+static bool halts(const uint8_t *image, uint8_t *memory, int64_t cycles)
+{
+	CPU cpu;
+	ExitReason reason;
+	memcpy(memory, image, 65536);
+	cpuInit(&cpu, memory);
+	reason = cpuRunCycles(&cpu, cycles);
+	cpuFree(&cpu);
+	return reason == EXIT_HALT;
+}
+
+static int compareNames(const void *a, const void *b)
+{
+	return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+static void benchSuite(const char *label, int64_t cycles, int repeats)
+{
+	static uint8_t image[65536];
+	static uint8_t memory[65536];
+	char *names[BENCH_MAX_PROGRAMS + 1];
+	int count = 0;
+	int i;
+	int pass;
+	struct stat info;
+	DIR *dir = opendir(BENCH_PROGRAM_DIR);
+	struct dirent *entry;
+	if (dir == NULL){
+		perror(BENCH_PROGRAM_DIR);
+	}
+	while (dir != NULL && (entry = readdir(dir)) != NULL && count < BENCH_MAX_PROGRAMS){
+		size_t length = strlen(entry->d_name);
+		if (entry->d_name[0] == '.' || (length > 4 && strcmp(entry->d_name + length - 4, ".bak") == 0)){
+			continue;
+		}
+		names[count] = malloc(sizeof(BENCH_PROGRAM_DIR) + length + 1);
+		if (names[count] == NULL){
+			perror(entry->d_name);
+			break;
+		}
+		sprintf(names[count], "%s/%s", BENCH_PROGRAM_DIR, entry->d_name);
+		if (stat(names[count], &info) == 0 && S_ISREG(info.st_mode)){
+			count++;
+		}
+		else{
+			free(names[count]);
+		}
+	}
+	if (dir != NULL){
+		closedir(dir);
+	}
+	qsort(names, count, sizeof(char *), compareNames);
+	if (stat("program1", &info) == 0 && (names[count] = strdup("program1")) != NULL){
+		count++;
+	}
+	/* the steady loops first, then the kernels, then what halts */
+	for (pass = 0; pass < 2; pass++){
+		if (pass == 1){
+			for (i = 0; i < (int)(sizeof(kernels) / sizeof(kernels[0])); i++){
+				memset(image, 0, 65536);
+				memcpy(image + PROGRAM_ADDRESS, kernels[i].code, kernels[i].size);
+				image[8] = 0xC9;
+				bench(label, kernels[i].name, image, cycles, repeats);
+			}
+			fprintf(results, "%-8s ending in HLT, restored from a snapshot each time:\n", label);
+		}
+		for (i = 0; i < count; i++){
+			if (loadImage(image, names[i]) && halts(image, memory, BENCH_COUNT_CYCLES) == (pass == 1)){
+				bench(label, names[i], image, cycles, repeats);
+			}
+		}
+	}
+	for (i = 0; i < count; i++){
+		free(names[i]);
+	}
+}
+
+int main(int argc, char **argv)
+{
+	static uint8_t image[65536];
+	const char *label = "core";
+	int64_t cycles = 100000000;
+	int repeats = 5;
+	if (argc < 2){
+		fprintf(stderr, "usage: %s <program>|--suite [cycles] [repeats] [label]\n", argv[0]);
+		return -1;
+	}
+	if (argc > 2){
+		cycles = strtoll(argv[2], NULL, 0);
+	}
+	if (argc > 3){
+		repeats = atoi(argv[3]);
+	}
+	if (argc > 4){
+		label = argv[4];
+	}
+	if (cycles <= 0 || repeats <= 0){
+		fprintf(stderr, "cycles and repeats have to be positive\n");
+		return -1;
+	}
+	results = fdopen(dup(STDOUT_FILENO), "w");
+	if (results == NULL || freopen("/dev/null", "w", stdout) == NULL){
+		perror("stdout");
+		return -1;
+	}
+	if (strcmp(argv[1], "--suite") == 0){
+		benchSuite(label, cycles, repeats);
+		return 0;
+	}
+	if (!loadImage(image, argv[1])){
+		return -1;
+	}
+	bench(label, argv[1], image, cycles, repeats);
+	return 0;
+}
@@ -0,0 +1,257 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include "Breakpoints.h"
+
+/* Works the core's tables out from the list again and has the CPU pick
+	them up */
+static void rebuild(Breakpoints *breakpoints)
+{
+	uint8_t oldBits[sizeof(breakpoints->executeBits)];
+	uint32_t i;
+	uint32_t j;
+	memcpy(oldBits, breakpoints->executeBits, sizeof(oldBits));
+	memset(breakpoints->executeBits, 0, sizeof(breakpoints->executeBits));
+	memset(breakpoints->executePages, 0, sizeof(breakpoints->executePages));
+	memset(breakpoints->watchPages, 0, sizeof(breakpoints->watchPages));
+	memset(breakpoints->watchPorts, 0, sizeof(breakpoints->watchPorts));
+	breakpoints->conditionCount = 0;
+	breakpoints->watchCount = 0;
+	for (i = 0; i < MAX_BREAKPOINTS; i++){
+		const Breakpoint *breakpoint = &breakpoints->list[i];
+		if (!breakpoint->used){
+			continue;
+		}
+		switch (breakpoint->kind)
+		{
+		case BREAK_EXECUTE:
+			breakpoints->executeBits[breakpoint->address >> 3] |= 1 << (breakpoint->address & 7);
+			breakpoints->executePages[breakpoint->address >> MEMORY_PAGE_SHIFT] = 1;
+			break;
+		case BREAK_CONDITION:
+			breakpoints->conditionCount++;
+			break;
+		case BREAK_MEMORY:
+			for (j = 0; j < breakpoint->length; j += MEMORY_PAGE_SIZE){
+				breakpoints->watchPages[(uint16_t)(breakpoint->address + j) >> MEMORY_PAGE_SHIFT] |= breakpoint->access;
+			}
+			/* the range may end part way into one more page */
+			breakpoints->watchPages[(uint16_t)(breakpoint->address + breakpoint->length - 1) >> MEMORY_PAGE_SHIFT] |= breakpoint->access;
+			breakpoints->watchCount++;
+			break;
+		case BREAK_PORT:
+			breakpoints->watchPorts[breakpoint->address] |= breakpoint->access;
+			break;
+		}
+	}
+	/* Code decoded or translated where a breakpoint came or went has the
+		wrong opcode in it */
+	for (i = 0; i < sizeof(oldBits); i++){
+		uint8_t changed = oldBits[i] ^ breakpoints->executeBits[i];
+		for (j = 0; changed != 0; j++, changed >>= 1){
+			if (changed & 1){
+				cpuInvalidateCode(breakpoints->cpu, i * 8 + j, 1);
+			}
+		}
+	}
+	cpuBreakpointsChanged(breakpoints->cpu);
+}
+
+Breakpoints *breakpointsCreate(CPU *cpu)
+{
+	Breakpoints *breakpoints;
+	if (cpu->breakpoints != NULL){
+		return NULL;
+	}
+	breakpoints = calloc(1, sizeof(Breakpoints));
+	if (breakpoints == NULL){
+		return NULL;
+	}
+	breakpoints->cpu = cpu;
+	breakpoints->hit.id = -1;
+	cpu->breakpoints = breakpoints;
+	cpuBreakpointsChanged(cpu);
+	return breakpoints;
+}
+
+void breakpointsFree(Breakpoints *breakpoints)
+{
+	CPU *cpu;
+	if (breakpoints == NULL){
+		return;
+	}
+	cpu = breakpoints->cpu;
+	memset(breakpoints->list, 0, sizeof(breakpoints->list));
+	rebuild(breakpoints);
+	cpu->breakpoints = NULL;
+	cpuBreakpointsChanged(cpu);
+	free(breakpoints);
+}
+
+static int add(Breakpoints *breakpoints, const Breakpoint *breakpoint)
+{
+	int i;
+	for (i = 0; i < MAX_BREAKPOINTS; i++){
+		if (!breakpoints->list[i].used){
+			breakpoints->list[i] = *breakpoint;
+			breakpoints->list[i].used = true;
+			rebuild(breakpoints);
+			return i;
+		}
+	}
+	return -1;
+}
+
+int breakAt(Breakpoints *breakpoints, uint16_t address, const BreakCondition *condition)
+{
+	Breakpoint breakpoint = { .kind = BREAK_EXECUTE, .address = address };
+	if (condition != NULL){
+		breakpoint.conditional = true;
+		breakpoint.condition = *condition;
+	}
+	return add(breakpoints, &breakpoint);
+}
+
+int breakWhen(Breakpoints *breakpoints, const BreakCondition *condition)
+{
+	Breakpoint breakpoint = { .kind = BREAK_CONDITION, .conditional = true, .condition = *condition };
+	return add(breakpoints, &breakpoint);
+}
+
+int watchMemory(Breakpoints *breakpoints, uint16_t address, uint32_t length, uint8_t access)
+{
+	Breakpoint breakpoint = { .kind = BREAK_MEMORY, .address = address, .length = length, .access = access };
+	if (length == 0 || length > 65536){
+		return -1;
+	}
+	return add(breakpoints, &breakpoint);
+}
+
+int watchPort(Breakpoints *breakpoints, uint8_t port, uint8_t access)
+{
+	Breakpoint breakpoint = { .kind = BREAK_PORT, .address = port, .access = access };
+	return add(breakpoints, &breakpoint);
+}
+
+bool breakpointRemove(Breakpoints *breakpoints, int id)
+{
+	if (id < 0 || id >= MAX_BREAKPOINTS || !breakpoints->list[id].used){
+		return false;
+	}
+	breakpoints->list[id].used = false;
+	rebuild(breakpoints);
+	return true;
+}
+
+void breakpointsSkip(Breakpoints *breakpoints)
+{
+	breakpoints->stopped = true;
+	breakpoints->stopCycle = breakpoints->cpu->cycleCount;
+	breakpoints->stopAddress = breakpoints->cpu->programCounter;
+}
+
+static uint16_t registerValue(const CPU *cpu, BreakRegister reg)
+{
+	switch (reg)
+	{
+	case BREAK_A: return cpu->A;
+	case BREAK_B: return cpu->B;
+	case BREAK_C: return cpu->C;
+	case BREAK_D: return cpu->D;
+	case BREAK_E: return cpu->E;
+	case BREAK_H: return cpu->H;
+	case BREAK_L: return cpu->L;
+	case BREAK_BC: return cpu->B << 8 | cpu->C;
+	case BREAK_DE: return cpu->D << 8 | cpu->E;
+	case BREAK_HL: return cpu->H << 8 | cpu->L;
+	case BREAK_SP: return cpu->stackPointer;
+	case BREAK_PC: return cpu->programCounter;
+	case BREAK_FLAGS: return cpuFlags(cpu);
+	}
+	return 0;
+}
+
+static bool holds(const BreakCondition *condition, const CPU *cpu)
+{
+	uint16_t value = registerValue(cpu, condition->reg) & condition->mask;
+	switch (condition->compare)
+	{
+	case BREAK_EQUAL: return value == condition->value;
+	case BREAK_NOT_EQUAL: return value != condition->value;
+	case BREAK_LESS: return value < condition->value;
+	case BREAK_GREATER: return value > condition->value;
+	}
+	return false;
+}
+
+/* Stopping at the boundary the run last stopped at means carrying on */
+static bool resuming(const Breakpoints *breakpoints, const CPU *cpu)
+{
+	return breakpoints->stopped && breakpoints->stopCycle == cpu->cycleCount
+		&& breakpoints->stopAddress == cpu->programCounter;
+}
+
+static void stopAt(Breakpoints *breakpoints, const CPU *cpu, int id)
+{
+	breakpoints->hit.id = id;
+	breakpoints->hit.access = 0;
+	breakpoints->hit.address = cpu->programCounter;
+	breakpoints->hit.value = 0;
+	breakpoints->stopped = true;
+	breakpoints->stopCycle = cpu->cycleCount;
+	breakpoints->stopAddress = cpu->programCounter;
+}
+
+bool breakpointsExecute(Breakpoints *breakpoints, const CPU *cpu)
+{
+	int i;
+	/* a HLT waiting for an interrupt comes round again without running */
+	if (cpu->halted || resuming(breakpoints, cpu)){
+		return false;
+	}
+	for (i = 0; i < MAX_BREAKPOINTS; i++){
+		const Breakpoint *breakpoint = &breakpoints->list[i];
+		if (breakpoint->used && breakpoint->kind == BREAK_EXECUTE && breakpoint->address == cpu->programCounter
+			&& (!breakpoint->conditional || holds(&breakpoint->condition, cpu))){
+			stopAt(breakpoints, cpu, i);
+			return true;
+		}
+	}
+	return false;
+}
+
+bool breakpointsCondition(Breakpoints *breakpoints, const CPU *cpu)
+{
+	int i;
+	if (resuming(breakpoints, cpu)){
+		return false;
+	}
+	for (i = 0; i < MAX_BREAKPOINTS; i++){
+		const Breakpoint *breakpoint = &breakpoints->list[i];
+		if (breakpoint->used && breakpoint->kind == BREAK_CONDITION && holds(&breakpoint->condition, cpu)){
+			stopAt(breakpoints, cpu, i);
+			return true;
+		}
+	}
+	return false;
+}
+
+bool breakpointsAccess(Breakpoints *breakpoints, uint16_t address, uint8_t value, uint8_t access, bool port)
+{
+	int i;
+	for (i = 0; i < MAX_BREAKPOINTS; i++){
+		const Breakpoint *breakpoint = &breakpoints->list[i];
+		if (!breakpoint->used || !(breakpoint->access & access)){
+			continue;
+		}
+		if (port ? breakpoint->kind == BREAK_PORT && breakpoint->address == address
+			: breakpoint->kind == BREAK_MEMORY && (uint16_t)(address - breakpoint->address) < breakpoint->length){
+			breakpoints->hit.id = i;
+			breakpoints->hit.access = access;
+			breakpoints->hit.address = address;
+			breakpoints->hit.value = value;
+			return true;
+		}
+	}
+	return false;
+}
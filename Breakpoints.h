@@ -0,0 +1,114 @@
+#ifndef BREAKPOINTS_H
+#define BREAKPOINTS_H
+#include <stdint.h>
+#include <stdbool.h>
+#include "Core.h"
+/* Guest breakpoints and watchpoints.
+	A CPU without a Breakpoints attached pays nothing for any of this, and
+	one with them attached pays only where they are:
+		Execution breakpoints work like a debugger's INT3. Fetching or
+		decoding the instruction at one gives BREAK_OPCODE, one of the two
+		opcodes the 8080 leaves unused, whose handler decides whether to
+		stop in front of the instruction or run it. Decoded instructions
+		and translated blocks keep it, so code away from breakpoints runs
+		exactly as fast as before, compiled blocks included.
+		Memory watchpoints take the page's direct read or write pointer
+		away (see readPages in Core.h), so only accesses to watched pages
+		take the slow path that compares them against the ranges.
+		Port watchpoints cost IN and OUT a test of cpu->breakpoints.
+		Conditions are checked at every instruction boundary while any is
+		armed, and so are watchpoints in -DBLOCK_CACHE builds, where a
+		block can't stop part way through.
+	An execution breakpoint or condition stops the run in front of the
+	instruction, a watchpoint right after the access's instruction; both
+	with EXIT_BREAKPOINT and the details in hit. Running on from a stop
+	at a breakpoint or condition runs the instruction it stopped at. */
+#define MAX_BREAKPOINTS 64
+#define BREAK_OPCODE 0x08
+#define WATCH_READ 1 /* loads and IN */
+#define WATCH_WRITE 2 /* stores and OUT */
+
+typedef enum BreakKind {
+	BREAK_EXECUTE, /* address, with an optional condition */
+	BREAK_CONDITION, /* condition, at any instruction boundary */
+	BREAK_MEMORY, /* length bytes from address */
+	BREAK_PORT /* port address */
+} BreakKind;
+typedef enum BreakRegister {
+	BREAK_A, BREAK_B, BREAK_C, BREAK_D, BREAK_E, BREAK_H, BREAK_L,
+	BREAK_BC, BREAK_DE, BREAK_HL, BREAK_SP, BREAK_PC,
+	BREAK_FLAGS /* PSW layout, see FLAG_* */
+} BreakRegister;
+typedef enum BreakCompare {
+	BREAK_EQUAL,
+	BREAK_NOT_EQUAL,
+	BREAK_LESS,
+	BREAK_GREATER
+} BreakCompare;
+/* Holds when (reg & mask) compare value, so a flag is tested with
+	BREAK_FLAGS, the flag as mask and value 0 or the flag */
+typedef struct BreakCondition {
+	BreakRegister reg;
+	uint16_t mask;
+	BreakCompare compare;
+	uint16_t value;
+} BreakCondition;
+typedef struct Breakpoint {
+	bool used;
+	BreakKind kind;
+	uint16_t address;
+	uint32_t length;
+	uint8_t access; /* WATCH_* for watchpoints */
+	bool conditional;
+	BreakCondition condition;
+} Breakpoint;
+/* What the last stop for a breakpoint was */
+typedef struct BreakHit {
+	int id; /* -1 for none */
+	uint8_t access; /* WATCH_READ or WATCH_WRITE for a watchpoint, 0 otherwise */
+	uint16_t address; /* of the instruction, memory access or port */
+	uint8_t value; /* loaded, stored or through the port */
+} BreakHit;
+
+typedef struct Breakpoints {
+	CPU *cpu;
+	Breakpoint list[MAX_BREAKPOINTS]; /* ids index it */
+	BreakHit hit;
+	/* Worked out from list for the core */
+	uint8_t executeBits[65536 / 8];
+	uint8_t executePages[MEMORY_PAGE_COUNT]; /* a breakpoint in the page */
+	uint8_t watchPages[MEMORY_PAGE_COUNT]; /* WATCH_* bits */
+	uint8_t watchPorts[256];
+	int conditionCount;
+	int watchCount;
+	/* The boundary of the last stop, run on from rather than stopped at again */
+	bool stopped;
+	int64_t stopCycle;
+	uint16_t stopAddress;
+} Breakpoints;
+
+/* Attaches a new, empty set to cpu. Returns NULL if out of memory or cpu
+	already has one. */
+Breakpoints *breakpointsCreate(CPU *cpu);
+/* Detaches from the CPU and frees them */
+void breakpointsFree(Breakpoints *breakpoints);
+/* Each returns the new breakpoint's id, or -1 if the list is full.
+	condition may be NULL for an unconditional breakpoint. */
+int breakAt(Breakpoints *breakpoints, uint16_t address, const BreakCondition *condition);
+int breakWhen(Breakpoints *breakpoints, const BreakCondition *condition);
+int watchMemory(Breakpoints *breakpoints, uint16_t address, uint32_t length, uint8_t access);
+int watchPort(Breakpoints *breakpoints, uint8_t port, uint8_t access);
+/* Returns false if there is no breakpoint id */
+bool breakpointRemove(Breakpoints *breakpoints, int id);
+/* The instruction the CPU is at runs on the next run, without stopping
+	for a breakpoint or condition in front of it, like after a stop there */
+void breakpointsSkip(Breakpoints *breakpoints);
+
+/* For the core. Each returns true, and fills in hit, if the run should stop. */
+/* An instruction at an execution breakpoint is about to run */
+bool breakpointsExecute(Breakpoints *breakpoints, const CPU *cpu);
+/* At an instruction boundary while conditions are armed */
+bool breakpointsCondition(Breakpoints *breakpoints, const CPU *cpu);
+/* A load or store on a watched page, or IN or OUT on a watched port */
+bool breakpointsAccess(Breakpoints *breakpoints, uint16_t address, uint8_t value, uint8_t access, bool port);
+#endif
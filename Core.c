@@ -2,6 +2,17 @@
 #include <stdio.h>
 #include <stdbool.h>
 #include <inttypes.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdatomic.h>
+#include "Core.h"
+#include "Trace.h"
+#include "Timing.h"
+#include "Profile.h"
+#include "Dynarec.h"
+#include "Ports.h"
+#include "Replay.h"
+#include "Breakpoints.h"
 //#define CPU_DIAG
 /* CPU Core Emulator for i8080 */
 /* Register Pairs:
@@ -16,1859 +27,1609 @@
 	Z : Zero Bit
 	P : Parity Bit
 */
-int cycleCount;
 #define CPU_DIAG
-uint8_t B;
-uint8_t C;
-uint8_t D;
-uint8_t E;
-uint8_t H;
-uint8_t L;
-uint8_t A;
+
+void cpuInit(CPU *cpu, uint8_t *memory)
+{
+	memset(cpu, 0, sizeof(*cpu));
+	cpu->memory = memory;
+	cpuMapMemory(cpu, 0, 65536, memory, false);
+	cpu->flags = FLAG_ALWAYS_ONE;
 #ifdef CPU_DIAG
-uint16_t programCounter = 0x100;
+	cpu->programCounter = 0x100;
 #else
-uint16_t programCounter = 0x000;
+	cpu->programCounter = 0x000;
+#endif
+}
+
+#ifdef BLOCK_CACHE
+static void freeBlocks(CPU *cpu);
+static void invalidateBlocks(CPU *cpu, uint16_t address);
+#endif
+static void updatePage(CPU *cpu, uint8_t page);
+static void releaseBuffer(struct PageBuffer *buffer);
+
+void cpuFree(CPU *cpu)
+{
+	uint32_t i;
+#ifdef BLOCK_CACHE
+	freeBlocks(cpu);
+#endif
+	free(cpu->decodeCache);
+	cpu->decodeCache = NULL;
+	memset(cpu->codePages, 0, sizeof(cpu->codePages));
+	for (i = 0; i < MEMORY_PAGE_COUNT; i++){
+		if (cpu->pages[i].buffer != NULL){
+			/* Pages copied from a snapshot go back to the CPU's own memory */
+			releaseBuffer(cpu->pages[i].buffer);
+			cpu->pages[i] = (MemoryPage){ .host = cpu->memory + i * MEMORY_PAGE_SIZE };
+		}
+		updatePage(cpu, i);
+	}
+	cpu->snapshotSerial = 0;
+}
+
+const char *exitReasonName(ExitReason reason)
+{
+	switch (reason)
+	{
+	case EXIT_HALT: return "HLT";
+	case EXIT_UNIMPLEMENTED: return "UNIMPLEMENTED";
+	case EXIT_BUDGET: return "BUDGET";
+	case EXIT_BREAKPOINT: return "BREAKPOINT";
+	case EXIT_DIVERGED: return "DIVERGED";
+	case EXIT_NO_MEMORY: return "NO_MEMORY";
+	default: return "NONE";
+	}
+}
+
+/* Flag tables.
+	szpTable holds the S, Z and P bits (plus the always set bit 1) for every
+	result byte. The aux carry tables are indexed by bit 3 of both operands
+	and the result, which is enough to tell whether bit 3 carried (or, for
+	subtraction, did not borrow). Carry comes straight from bit 8 of the
+	widened result. */
+static const uint8_t szpTable[256] = {
+	0x46, 0x02, 0x02, 0x06, 0x02, 0x06, 0x06, 0x02, 0x02, 0x06, 0x06, 0x02, 0x06, 0x02, 0x02, 0x06,
+	0x02, 0x06, 0x06, 0x02, 0x06, 0x02, 0x02, 0x06, 0x06, 0x02, 0x02, 0x06, 0x02, 0x06, 0x06, 0x02,
+	0x02, 0x06, 0x06, 0x02, 0x06, 0x02, 0x02, 0x06, 0x06, 0x02, 0x02, 0x06, 0x02, 0x06, 0x06, 0x02,
+	0x06, 0x02, 0x02, 0x06, 0x02, 0x06, 0x06, 0x02, 0x02, 0x06, 0x06, 0x02, 0x06, 0x02, 0x02, 0x06,
+	0x02, 0x06, 0x06, 0x02, 0x06, 0x02, 0x02, 0x06, 0x06, 0x02, 0x02, 0x06, 0x02, 0x06, 0x06, 0x02,
+	0x06, 0x02, 0x02, 0x06, 0x02, 0x06, 0x06, 0x02, 0x02, 0x06, 0x06, 0x02, 0x06, 0x02, 0x02, 0x06,
+	0x06, 0x02, 0x02, 0x06, 0x02, 0x06, 0x06, 0x02, 0x02, 0x06, 0x06, 0x02, 0x06, 0x02, 0x02, 0x06,
+	0x02, 0x06, 0x06, 0x02, 0x06, 0x02, 0x02, 0x06, 0x06, 0x02, 0x02, 0x06, 0x02, 0x06, 0x06, 0x02,
+	0x82, 0x86, 0x86, 0x82, 0x86, 0x82, 0x82, 0x86, 0x86, 0x82, 0x82, 0x86, 0x82, 0x86, 0x86, 0x82,
+	0x86, 0x82, 0x82, 0x86, 0x82, 0x86, 0x86, 0x82, 0x82, 0x86, 0x86, 0x82, 0x86, 0x82, 0x82, 0x86,
+	0x86, 0x82, 0x82, 0x86, 0x82, 0x86, 0x86, 0x82, 0x82, 0x86, 0x86, 0x82, 0x86, 0x82, 0x82, 0x86,
+	0x82, 0x86, 0x86, 0x82, 0x86, 0x82, 0x82, 0x86, 0x86, 0x82, 0x82, 0x86, 0x82, 0x86, 0x86, 0x82,
+	0x86, 0x82, 0x82, 0x86, 0x82, 0x86, 0x86, 0x82, 0x82, 0x86, 0x86, 0x82, 0x86, 0x82, 0x82, 0x86,
+	0x82, 0x86, 0x86, 0x82, 0x86, 0x82, 0x82, 0x86, 0x86, 0x82, 0x82, 0x86, 0x82, 0x86, 0x86, 0x82,
+	0x82, 0x86, 0x86, 0x82, 0x86, 0x82, 0x82, 0x86, 0x86, 0x82, 0x82, 0x86, 0x82, 0x86, 0x86, 0x82,
+	0x86, 0x82, 0x82, 0x86, 0x82, 0x86, 0x86, 0x82, 0x82, 0x86, 0x86, 0x82, 0x86, 0x82, 0x82, 0x86,
+};
+static const uint8_t acAddTable[8] = { 0, 0, FLAG_AC, 0, FLAG_AC, 0, FLAG_AC, FLAG_AC };
+static const uint8_t acSubTable[8] = { FLAG_AC, 0, 0, 0, FLAG_AC, FLAG_AC, FLAG_AC, 0 };
+#define AC_INDEX(a, b, result) ((((a) & 0x08) >> 1) | (((b) & 0x08) >> 2) | (((result) & 0x08) >> 3))
+
+static inline uint8_t addFlags(uint8_t a, uint8_t b, uint16_t result)
+{
+	return szpTable[result & 0xFF] | acAddTable[AC_INDEX(a, b, result)] | ((result >> 8) & FLAG_C);
+}
+/* result is a - b (- borrow) computed in 16 bits, so bit 8 is the borrow */
+static inline uint8_t subFlags(uint8_t a, uint8_t b, uint16_t result)
+{
+	return szpTable[result & 0xFF] | acSubTable[AC_INDEX(a, b, result)] | ((result >> 8) & FLAG_C);
+}
+
+/* Memory access.
+	Loads and stores index readPages/writePages by page and go straight to
+	host memory when the pointer is there. Everything else, handler pages,
+	read-only pages, stores to pages holding translated code and accesses
+	to watched pages, takes the slow path through pages[]. */
+static void updatePage(CPU *cpu, uint8_t page)
+{
+	const MemoryPage *entry = &cpu->pages[page];
+	uint8_t watch = cpu->breakpoints != NULL ? cpu->breakpoints->watchPages[page] : 0;
+	cpu->readPages[page] = watch & WATCH_READ ? NULL : entry->host;
+	cpu->writePages[page] = entry->readOnly || entry->copyOnWrite || cpu->codePages[page] || watch & WATCH_WRITE ? NULL : entry->host;
+	cpu->fetchPage = -1;
+}
+
+/* Stores to the page have to check for translated code from now on */
+static inline void markCodePage(CPU *cpu, uint8_t page)
+{
+	if (!cpu->codePages[page]){
+		cpu->codePages[page] = 1;
+		cpu->writePages[page] = NULL;
+	}
+}
+
+/* A load through pages[] that no watchpoint sees */
+static uint8_t peekByte(CPU *cpu, uint16_t address)
+{
+	const MemoryPage *page = &cpu->pages[address >> MEMORY_PAGE_SHIFT];
+	if (page->host != NULL){
+		return page->host[address & (MEMORY_PAGE_SIZE - 1)];
+	}
+	if (page->read == NULL){
+		return 0xFF;
+	}
+	return page->read(page->context, address);
+}
+
+static void watchAccess(CPU *cpu, uint16_t address, uint8_t value, uint8_t access);
+
+__attribute__((noinline, cold)) static uint8_t readSlow(CPU *cpu, uint16_t address)
+{
+	uint8_t value = peekByte(cpu, address);
+	if (cpu->breakpoints != NULL){
+		watchAccess(cpu, address, value, WATCH_READ);
+	}
+	return value;
+}
+
+__attribute__((always_inline)) static inline uint8_t readByte(CPU *cpu, uint16_t address)
+{
+	const uint8_t *host = cpu->readPages[address >> MEMORY_PAGE_SHIFT];
+	if (__builtin_expect(host != NULL, 1)){
+		return host[address & (MEMORY_PAGE_SIZE - 1)];
+	}
+	return readSlow(cpu, address);
+}
+
+/* Instruction bytes are loads too, but not ones a watchpoint is after */
+static inline uint8_t codeByte(CPU *cpu, uint16_t address)
+{
+	const uint8_t *host = cpu->readPages[address >> MEMORY_PAGE_SHIFT];
+	if (__builtin_expect(host != NULL, 1)){
+		return host[address & (MEMORY_PAGE_SIZE - 1)];
+	}
+	return peekByte(cpu, address);
+}
+
+/* An execution breakpoint at address, see Breakpoints.h */
+static inline bool breakpointAt(const CPU *cpu, uint16_t address)
+{
+	const Breakpoints *breakpoints = cpu->breakpoints;
+	return breakpoints != NULL && breakpoints->executeBits[address >> 3] & (1 << (address & 7));
+}
+
+#if !defined(DECODE_CACHE) && !defined(BLOCK_CACHE)
+/* Instruction fetch remembers the page it last read, so the usual case
+	is a compare and one load with no table lookup on the way to the
+	dispatch. Handler pages are never remembered, and neither are pages
+	with a breakpoint, so their opcode fetches can turn into BREAK_OPCODE. */
+__attribute__((noinline)) static uint8_t fetchSlow(CPU *cpu, uint16_t address)
+{
+	uint8_t page = address >> MEMORY_PAGE_SHIFT;
+	if (cpu->breakpoints != NULL && cpu->breakpoints->executePages[page]){
+		return address == cpu->programCounter && breakpointAt(cpu, address) ? BREAK_OPCODE : peekByte(cpu, address);
+	}
+	if (cpu->pages[page].host == NULL){
+		return peekByte(cpu, address);
+	}
+	cpu->fetchPage = page;
+	cpu->fetchHost = cpu->pages[page].host;
+	return cpu->fetchHost[address & (MEMORY_PAGE_SIZE - 1)];
+}
+
+__attribute__((always_inline)) static inline uint8_t fetchByte(CPU *cpu, uint16_t address)
+{
+	if (__builtin_expect(address >> MEMORY_PAGE_SHIFT == cpu->fetchPage, 1)){
+		return cpu->fetchHost[address & (MEMORY_PAGE_SIZE - 1)];
+	}
+	return fetchSlow(cpu, address);
+}
+#endif
+
+/* Decode cache.
+	With -DDECODE_CACHE each guest address gets a DecodedOp the first time
+	it is executed, holding the opcode, its length and its immediate operand
+	already assembled, so later visits skip the operand fetches. codePages
+	marks every page holding a decoded instruction and takes its direct
+	write pointer away, so only stores to those pages ever look for
+	decoded instructions to drop. */
+#if defined(DECODE_CACHE) || defined(BLOCK_CACHE)
+static const uint8_t instructionLength[256] = {
+	1, 3, 1, 1, 1, 1, 2, 1, 1, 1, 1, 1, 1, 1, 2, 1,
+	1, 3, 1, 1, 1, 1, 2, 1, 1, 1, 1, 1, 1, 1, 2, 1,
+	1, 3, 3, 1, 1, 1, 2, 1, 1, 1, 3, 1, 1, 1, 2, 1,
+	1, 3, 3, 1, 1, 1, 2, 1, 1, 1, 3, 1, 1, 1, 2, 1,
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+	1, 1, 3, 3, 3, 1, 2, 1, 1, 1, 3, 3, 3, 3, 2, 1,
+	1, 1, 3, 2, 3, 1, 2, 1, 1, 1, 3, 2, 3, 3, 2, 1,
+	1, 1, 3, 1, 3, 1, 2, 1, 1, 1, 3, 1, 3, 3, 2, 1,
+	1, 1, 3, 1, 3, 1, 2, 1, 1, 1, 3, 1, 3, 3, 2, 1
+};
+#endif
+
+#ifdef DECODE_CACHE
+static DecodedOp *decodeInstruction(CPU *cpu, uint16_t address)
+{
+	DecodedOp *op = &cpu->decodeCache[address];
+	op->opcode = codeByte(cpu, address);
+	op->length = instructionLength[op->opcode];
+	op->operand = codeByte(cpu, address + 1);
+	if (op->length == 3){
+		op->operand |= codeByte(cpu, address + 2) << 8;
+	}
+	if (breakpointAt(cpu, address)){
+		/* op_breakpoint finds the real opcode again if it runs it */
+		op->opcode = BREAK_OPCODE;
+	}
+	markCodePage(cpu, address >> 8);
+	markCodePage(cpu, (uint16_t)(address + op->length - 1) >> 8);
+	return op;
+}
+#endif
+
+/* Drops any decoded instruction that covers address */
+static void invalidateCode(CPU *cpu, uint16_t address)
+{
+	cpu->decodeCache[address].length = 0;
+	if (cpu->decodeCache[(uint16_t)(address - 1)].length > 1){
+		cpu->decodeCache[(uint16_t)(address - 1)].length = 0;
+	}
+	if (cpu->decodeCache[(uint16_t)(address - 2)].length > 2){
+		cpu->decodeCache[(uint16_t)(address - 2)].length = 0;
+	}
+}
+
+void cpuInvalidateCode(CPU *cpu, uint16_t address, uint32_t length)
+{
+	uint32_t i;
+#ifdef BLOCK_CACHE
+	if (cpu->blockCache != NULL){
+		for (i = 0; i < length; i++){
+			invalidateBlocks(cpu, address + i);
+		}
+	}
+#endif
+	if (cpu->decodeCache == NULL){
+		return;
+	}
+	for (i = 0; i < length; i++){
+		invalidateCode(cpu, address + i);
+	}
+}
+
+/* Copy-on-write pages.
+	A page shared with a snapshot has no direct write pointer, and the
+	first store to it copies it into a PageBuffer of the CPU's own.
+	Snapshots and every CPU restored from one share buffers, possibly
+	across threads, so they are reference counted. */
+typedef struct PageBuffer {
+	atomic_int refs;
+	uint8_t data[MEMORY_PAGE_SIZE];
+} PageBuffer;
+
+static void retainBuffer(PageBuffer *buffer)
+{
+	if (buffer != NULL){
+		atomic_fetch_add(&buffer->refs, 1);
+	}
+}
+
+static void releaseBuffer(PageBuffer *buffer)
+{
+	if (buffer != NULL && atomic_fetch_sub(&buffer->refs, 1) == 1){
+		free(buffer);
+	}
+}
+
+/* Returns false if out of memory */
+static bool copyPage(CPU *cpu, uint8_t page)
+{
+	MemoryPage *entry = &cpu->pages[page];
+	PageBuffer *buffer = malloc(sizeof(PageBuffer));
+	if (buffer == NULL){
+		return false;
+	}
+	atomic_init(&buffer->refs, 1);
+	memcpy(buffer->data, entry->host, MEMORY_PAGE_SIZE);
+	releaseBuffer(entry->buffer);
+	entry->host = buffer->data;
+	entry->buffer = buffer;
+	entry->copyOnWrite = false;
+	updatePage(cpu, page);
+	/* Past a full list, the next restore compares every page instead */
+	if (cpu->snapshotSerial != 0 && cpu->dirtyCount < MEMORY_PAGE_COUNT){
+		cpu->dirtyPages[cpu->dirtyCount++] = page;
+	}
+	else{
+		cpu->snapshotSerial = 0;
+	}
+	return true;
+}
+
+/* A store through pages[] that no watchpoint sees */
+static void pokeByte(CPU *cpu, uint16_t address, uint8_t value)
+{
+	uint8_t index = address >> MEMORY_PAGE_SHIFT;
+	const MemoryPage *page = &cpu->pages[index];
+	if (page->host == NULL){
+		if (page->write != NULL){
+			page->write(page->context, address, value);
+		}
+		return;
+	}
+	if (page->readOnly){
+		return;
+	}
+	if (page->copyOnWrite && !copyPage(cpu, index)){
+		cpu->isCPURunning = false;
+		cpu->exitReason = EXIT_NO_MEMORY;
+		return;
+	}
+	page->host[address & (MEMORY_PAGE_SIZE - 1)] = value;
+	if (cpu->codePages[index]){
+		/* A page holding translated code, drop whatever covers address */
+#ifdef DECODE_CACHE
+		invalidateCode(cpu, address);
+#elif defined(BLOCK_CACHE)
+		invalidateBlocks(cpu, address);
 #endif
-uint16_t stackPointer;
-bool isCPURunning;
-bool interruptsEnabled;
-bool carryFlag;
-bool auxCarryFlag;
-bool signFlag;
-bool zeroFlag;
-bool parityFlag;
+	}
+}
+
+static void writeSlow(CPU *cpu, uint16_t address, uint8_t value)
+{
+	if (cpu->breakpoints != NULL){
+		watchAccess(cpu, address, value, WATCH_WRITE);
+	}
+	pokeByte(cpu, address, value);
+}
+
+/* Every guest store goes through here so decoded code stays coherent */
+static inline void writeByte(CPU *cpu, uint16_t address, uint8_t value)
+{
+	uint8_t *host = cpu->writePages[address >> MEMORY_PAGE_SHIFT];
+	if (host != NULL){
+		host[address & (MEMORY_PAGE_SIZE - 1)] = value;
+		return;
+	}
+	writeSlow(cpu, address, value);
+}
+
+/* Points page at entry, taking a reference to its buffer if it has one */
+static void setPage(CPU *cpu, uint8_t page, const MemoryPage *entry)
+{
+	/* Anything translated from the old contents is stale. Only pages
+		that ever held code have any, which keeps bank switches cheap. */
+	if (cpu->codePages[page]){
+		cpuInvalidateCode(cpu, page << MEMORY_PAGE_SHIFT, MEMORY_PAGE_SIZE);
+		cpu->codePages[page] = 0;
+	}
+	retainBuffer(entry->buffer);
+	releaseBuffer(cpu->pages[page].buffer);
+	cpu->pages[page] = *entry;
+	updatePage(cpu, page);
+}
+
+/* Snapshots taken and not yet freed, by any CPU */
+static atomic_int liveSnapshots;
+
+/* Maps one page for mapPages(). Host memory a live snapshot may still
+	hold, such as a bank mapped again, is mapped copy-on-write, or stores
+	would go into the snapshot. Page copies are the CPU's own already. */
+static void mapPage(CPU *cpu, uint8_t page, MemoryPage entry)
+{
+	if (entry.host != NULL && entry.buffer == NULL && !entry.readOnly && atomic_load(&liveSnapshots) > 0){
+		entry.copyOnWrite = true;
+	}
+	setPage(cpu, page, &entry);
+}
+
+/* Maps the range onto entries, one per page, or onto entry for all of
+	them, stepping its host memory along */
+static bool mapPages(CPU *cpu, uint16_t address, uint32_t length, const MemoryPage *entry, const MemoryPage *entries)
+{
+	uint32_t first = address >> MEMORY_PAGE_SHIFT;
+	uint32_t count = length >> MEMORY_PAGE_SHIFT;
+	uint32_t i;
+	if (((address | length) & (MEMORY_PAGE_SIZE - 1)) || first + count > MEMORY_PAGE_COUNT){
+		return false;
+	}
+	for (i = 0; i < count; i++){
+		MemoryPage page = entries != NULL ? entries[i] : *entry;
+		if (entries == NULL && entry->host != NULL){
+			page.host = entry->host + i * MEMORY_PAGE_SIZE;
+		}
+		mapPage(cpu, first + i, page);
+	}
+	/* The pages no longer match a snapshot by their dirty list alone */
+	cpu->snapshotSerial = 0;
+	cpu->dirtyCount = 0;
+	return true;
+}
+
+bool cpuMapMemory(CPU *cpu, uint16_t address, uint32_t length, uint8_t *host, bool readOnly)
+{
+	MemoryPage entry = { .host = host, .readOnly = readOnly };
+	if (host == NULL){
+		return false;
+	}
+	return mapPages(cpu, address, length, &entry, NULL);
+}
 
-uint32_t temp32;
-uint16_t temp16;
-uint8_t temp8;
+bool cpuMapHandlers(CPU *cpu, uint16_t address, uint32_t length, MemoryReadHandler read, MemoryWriteHandler write, void *context)
+{
+	MemoryPage entry = { .read = read, .write = write, .context = context };
+	return mapPages(cpu, address, length, &entry, NULL);
+}
+
+bool cpuSavePages(CPU *cpu, uint16_t address, uint32_t length, MemoryPage *pages)
+{
+	uint32_t first = address >> MEMORY_PAGE_SHIFT;
+	uint32_t count = length >> MEMORY_PAGE_SHIFT;
+	uint32_t i;
+	if (((address | length) & (MEMORY_PAGE_SIZE - 1)) || first + count > MEMORY_PAGE_COUNT){
+		return false;
+	}
+	for (i = 0; i < count; i++){
+		retainBuffer(cpu->pages[first + i].buffer);
+		pages[i] = cpu->pages[first + i];
+	}
+	return true;
+}
+
+bool cpuLoadPages(CPU *cpu, uint16_t address, uint32_t length, const MemoryPage *pages)
+{
+	return mapPages(cpu, address, length, NULL, pages);
+}
+
+void cpuReleasePages(MemoryPage *pages, uint32_t count)
+{
+	uint32_t i;
+	for (i = 0; i < count; i++){
+		releaseBuffer(pages[i].buffer);
+		pages[i].buffer = NULL;
+	}
+}
+
+uint8_t cpuReadByte(CPU *cpu, uint16_t address)
+{
+	return peekByte(cpu, address);
+}
+
+void cpuWriteByte(CPU *cpu, uint16_t address, uint8_t value)
+{
+	pokeByte(cpu, address, value);
+}
+
+/* Snapshots, see Core.h */
+static atomic_uint_fast64_t lastSnapshotSerial;
+
+static bool samePage(const MemoryPage *a, const MemoryPage *b)
+{
+	return a->host == b->host && a->readOnly == b->readOnly && a->copyOnWrite == b->copyOnWrite
+		&& a->read == b->read && a->write == b->write && a->context == b->context && a->buffer == b->buffer;
+}
+
+Snapshot *cpuSnapshot(CPU *cpu)
+{
+	Snapshot *snapshot = malloc(sizeof(Snapshot));
+	uint32_t i;
+	if (snapshot == NULL){
+		return NULL;
+	}
+	snapshot->serial = atomic_fetch_add(&lastSnapshotSerial, 1) + 1;
+	atomic_fetch_add(&liveSnapshots, 1);
+	snapshot->memory = cpu->memory;
+#define SAVE_FIELD(name) snapshot->state.name = cpu->name;
+	CPU_STATE_FIELDS(SAVE_FIELD)
+#undef SAVE_FIELD
+	for (i = 0; i < MEMORY_PAGE_COUNT; i++){
+		MemoryPage *page = &cpu->pages[i];
+		if (page->host != NULL && !page->readOnly && !page->copyOnWrite){
+			page->copyOnWrite = true;
+			updatePage(cpu, i);
+		}
+		retainBuffer(page->buffer);
+		snapshot->pages[i] = *page;
+	}
+	cpu->snapshotSerial = snapshot->serial;
+	cpu->dirtyCount = 0;
+	return snapshot;
+}
+
+void cpuRestore(CPU *cpu, const Snapshot *snapshot)
+{
+	int i;
+	if (cpu->snapshotSerial == snapshot->serial){
+		for (i = 0; i < cpu->dirtyCount; i++){
+			setPage(cpu, cpu->dirtyPages[i], &snapshot->pages[cpu->dirtyPages[i]]);
+		}
+	}
+	else{
+		for (i = 0; i < MEMORY_PAGE_COUNT; i++){
+			/* A page still shared with the snapshot already holds its contents */
+			if (!samePage(&cpu->pages[i], &snapshot->pages[i])){
+				setPage(cpu, i, &snapshot->pages[i]);
+			}
+		}
+	}
+	cpu->snapshotSerial = snapshot->serial;
+	cpu->dirtyCount = 0;
+#define LOAD_FIELD(name) cpu->name = snapshot->state.name;
+	CPU_STATE_FIELDS(LOAD_FIELD)
+#undef LOAD_FIELD
+}
+
+void cpuFork(CPU *child, const Snapshot *snapshot)
+{
+	cpuInit(child, snapshot->memory);
+	cpuRestore(child, snapshot);
+}
+
+void snapshotFree(Snapshot *snapshot)
+{
+	uint32_t i;
+	if (snapshot == NULL){
+		return;
+	}
+	for (i = 0; i < MEMORY_PAGE_COUNT; i++){
+		releaseBuffer(snapshot->pages[i].buffer);
+	}
+	atomic_fetch_sub(&liveSnapshots, 1);
+	free(snapshot);
+}
+
+static inline uint8_t deviceIn(CPU *cpu, uint8_t port)
+{
+	PortBus *bus = cpu->ports;
+	if (bus == NULL || bus->in[port].handler == NULL){
+		return 0xFF;
+	}
+	if (bus->queued){
+		portBusFlush(bus);
+	}
+	return bus->in[port].handler(bus->in[port].context, port);
+}
 
+static void updateStop(CPU *cpu);
+
+/* A load or store on a watched page, or IN or OUT with breakpoints
+	attached. A hit stops the run after the current instruction. */
+__attribute__((noinline, cold)) static void watchAccess(CPU *cpu, uint16_t address, uint8_t value, uint8_t access)
+{
+	Breakpoints *breakpoints = cpu->breakpoints;
+	if (breakpoints->watchPages[address >> MEMORY_PAGE_SHIFT] & access
+		&& breakpointsAccess(breakpoints, address, value, access, false)){
+		cpuBreak(cpu);
+	}
+}
+
+__attribute__((noinline, cold)) static void watchPortAccess(CPU *cpu, uint8_t port, uint8_t value, uint8_t access)
+{
+	Breakpoints *breakpoints = cpu->breakpoints;
+	if (breakpoints->watchPorts[port] & access && breakpointsAccess(breakpoints, port, value, access, true)){
+		cpuBreak(cpu);
+	}
+}
+
+/* Ends the run after the current instruction */
+static void diverged(CPU *cpu)
+{
+	cpu->isCPURunning = false;
+	cpu->exitReason = EXIT_DIVERGED;
+}
+
+/* IN while recording or replaying, see Replay.h */
+__attribute__((noinline, cold)) static uint8_t loggedIn(CPU *cpu, uint8_t port)
+{
+	uint8_t value;
+	if (cpu->inputLog->mode == INPUT_RECORD){
+		value = deviceIn(cpu, port);
+		inputLogIn(cpu->inputLog, cpu->cycleCount, port, value);
+		return value;
+	}
+	if (!inputLogReplayIn(cpu->inputLog, cpu->cycleCount, port, &value)){
+		diverged(cpu);
+		return 0xFF;
+	}
+	/* the next event may be an interrupt to stop for */
+	updateStop(cpu);
+	return value;
+}
 
-uint8_t memory[65536];
+static inline uint8_t portIn(CPU *cpu, uint8_t port)
+{
+	uint8_t value;
+	if (__builtin_expect(cpu->inputLog != NULL, 0)){
+		value = loggedIn(cpu, port);
+	}
+	else{
+		value = deviceIn(cpu, port);
+	}
+	if (__builtin_expect(cpu->breakpoints != NULL, 0)){
+		watchPortAccess(cpu, port, value, WATCH_READ);
+	}
+	return value;
+}
 
-int parity(uint8_t byte)
+static inline void portOut(CPU *cpu, uint8_t port, uint8_t value)
 {
-	int y = byte ^ (byte >> 1);
-	y = y ^ (y >> 2);
-	y = y ^ (y >> 4);
-	y = y ^ (y >> 8);
-	return !(y & 1);
+	PortBus *bus = cpu->ports;
+	if (__builtin_expect(cpu->breakpoints != NULL, 0)){
+		watchPortAccess(cpu, port, value, WATCH_WRITE);
+	}
+	if (bus == NULL){
+		return;
+	}
+	if (bus->out[port].handler != NULL){
+		bus->out[port].handler(bus->out[port].context, port, value);
+	}
+	else if (bus->out[port].batch != NULL){
+		portQueueWrite(bus, port, value, cpu->cycleCount);
+	}
 }
 
-static inline void MOV(uint8_t *dest, uint8_t *src) {
+static inline void MOV(CPU *cpu, uint8_t *dest, uint8_t *src) {
 	*dest = *src;
-	programCounter++;
-	cycleCount += 7;
-}
-static inline void MVI(uint8_t *dest) {
-	*dest = memory[programCounter + 1];
-	programCounter += 2;
-	cycleCount += 7;
-}
-static inline void LXI(uint8_t *hiReg, uint8_t *lowReg) {
-	*lowReg = memory[programCounter + 1];
-	*hiReg = memory[programCounter + 2];
-	programCounter += 3;
-	cycleCount += 10;
-}
-static inline void ADD(uint8_t *src){
-	carryFlag = (A + *src) > 255;
-	A = A + *src;
-	zeroFlag = (A == 0);
-	parityFlag = parity(A);
-	signFlag = (A >> 7);
-	programCounter += 1;
-	cycleCount += 4;
-}
-static inline void ADC(uint8_t *src){
-	temp16 = A + *src + carryFlag;
-	carryFlag = (temp16 > 0xFF);
-	A = temp16 & 0xFF;
-	zeroFlag = (A==0);
-	parityFlag = parity(A);
-	signFlag = (A >> 7);
-	programCounter += 1;
-	cycleCount += 4;
-}
-static inline void SUB(uint8_t *src){
-	carryFlag = *src > A;
-	A = A - *src;
-	zeroFlag = (A==0);
-	parityFlag = parity(A);
-	signFlag = (A >> 7);
-	programCounter += 1;
-	cycleCount += 4;
-}
-static inline void SBB(uint8_t *src){
-	temp8 = A - (*src + carryFlag);
-	carryFlag = (*src + carryFlag) > A;
-	A = temp8;
-	zeroFlag = (A==0);
-	parityFlag = parity(A);
-	signFlag = (A >> 7);
-	programCounter += 1;
-	cycleCount += 4;
-}
-static inline void INR(uint8_t *src){
+	cpu->programCounter++;
+}
+static inline void MVI(CPU *cpu, uint8_t *dest, uint8_t value) {
+	*dest = value;
+	cpu->programCounter += 2;
+}
+static inline void LXI(CPU *cpu, uint8_t *hiReg, uint8_t *lowReg, uint16_t value) {
+	*lowReg = value & 0xFF;
+	*hiReg = value >> 8;
+	cpu->programCounter += 3;
+}
+/* Flag writers.
+	With LAZY_FLAGS the carry is still kept up to date in cpu->flags (it is
+	free to compute and RAL/RAR/ADC/SBB need it next), but S, Z, P and AC are
+	only derived from the recorded operation when something reads them. */
+static inline uint8_t lazyFlags(const CPU *cpu)
+{
+	uint8_t carry = cpu->flags & FLAG_C;
+	uint8_t result = cpu->lazyResult;
+	switch (cpu->lazyOp)
+	{
+	case LAZY_ADD:
+		return carry | szpTable[result] | acAddTable[AC_INDEX(cpu->lazyOperandA, cpu->lazyOperandB, result)];
+	case LAZY_SUB:
+		return carry | szpTable[result] | acSubTable[AC_INDEX(cpu->lazyOperandA, cpu->lazyOperandB, result)];
+	case LAZY_AND:
+		return carry | szpTable[result] | (((cpu->lazyOperandA | cpu->lazyOperandB) & 0x08) << 1);
+	case LAZY_LOGIC:
+		return carry | szpTable[result];
+	case LAZY_INR:
+		return carry | szpTable[result] | ((result & 0x0F) == 0 ? FLAG_AC : 0);
+	case LAZY_DCR:
+		return carry | szpTable[result] | ((result & 0x0F) == 0x0F ? 0 : FLAG_AC);
+	default:
+		return cpu->flags;
+	}
+}
+static inline uint8_t readFlags(CPU *cpu)
+{
+#ifdef LAZY_FLAGS
+	if (cpu->lazyOp != LAZY_NONE){
+		cpu->flags = lazyFlags(cpu);
+		cpu->lazyOp = LAZY_NONE;
+	}
+#endif
+	return cpu->flags;
+}
+uint8_t cpuFlags(const CPU *cpu)
+{
+	return lazyFlags(cpu);
+}
+static inline void setFlags(CPU *cpu, uint8_t flags)
+{
+	cpu->flags = flags;
+	cpu->lazyOp = LAZY_NONE;
+}
+#ifdef LAZY_FLAGS
+static inline void recordFlags(CPU *cpu, LazyOp op, uint8_t a, uint8_t b, uint8_t result)
+{
+	cpu->lazyOp = op;
+	cpu->lazyOperandA = a;
+	cpu->lazyOperandB = b;
+	cpu->lazyResult = result;
+}
+#endif
+static inline void flagsAdd(CPU *cpu, uint8_t a, uint8_t b, uint16_t result)
+{
+#ifdef LAZY_FLAGS
+	cpu->flags = ((result >> 8) & FLAG_C) | FLAG_ALWAYS_ONE;
+	recordFlags(cpu, LAZY_ADD, a, b, result);
+#else
+	cpu->flags = addFlags(a, b, result);
+#endif
+}
+static inline void flagsSub(CPU *cpu, uint8_t a, uint8_t b, uint16_t result)
+{
+#ifdef LAZY_FLAGS
+	cpu->flags = ((result >> 8) & FLAG_C) | FLAG_ALWAYS_ONE;
+	recordFlags(cpu, LAZY_SUB, a, b, result);
+#else
+	cpu->flags = subFlags(a, b, result);
+#endif
+}
+/* ANA/ANI, the only logic ops with an AC result */
+static inline void flagsAnd(CPU *cpu, uint8_t a, uint8_t b, uint8_t result)
+{
+#ifdef LAZY_FLAGS
+	cpu->flags = FLAG_ALWAYS_ONE;
+	recordFlags(cpu, LAZY_AND, a, b, result);
+#else
+	cpu->flags = szpTable[result] | (((a | b) & 0x08) << 1);
+#endif
+}
+static inline void flagsLogic(CPU *cpu, uint8_t result)
+{
+#ifdef LAZY_FLAGS
+	cpu->flags = FLAG_ALWAYS_ONE;
+	recordFlags(cpu, LAZY_LOGIC, 0, 0, result);
+#else
+	cpu->flags = szpTable[result];
+#endif
+}
+/* INR/DCR leave the carry alone */
+static inline void flagsInr(CPU *cpu, uint8_t result)
+{
+#ifdef LAZY_FLAGS
+	recordFlags(cpu, LAZY_INR, 0, 0, result);
+#else
+	cpu->flags = (cpu->flags & FLAG_C) | szpTable[result] | ((result & 0x0F) == 0 ? FLAG_AC : 0);
+#endif
+}
+static inline void flagsDcr(CPU *cpu, uint8_t result)
+{
+#ifdef LAZY_FLAGS
+	recordFlags(cpu, LAZY_DCR, 0, 0, result);
+#else
+	cpu->flags = (cpu->flags & FLAG_C) | szpTable[result] | ((result & 0x0F) == 0x0F ? 0 : FLAG_AC);
+#endif
+}
+
+static inline void ADD(CPU *cpu, uint8_t *src){
+	uint16_t temp16 = cpu->A + *src;
+	flagsAdd(cpu, cpu->A, *src, temp16);
+	cpu->A = temp16 & 0xFF;
+	cpu->programCounter += 1;
+}
+static inline void ADC(CPU *cpu, uint8_t *src){
+	uint16_t temp16 = cpu->A + *src + (cpu->flags & FLAG_C);
+	flagsAdd(cpu, cpu->A, *src, temp16);
+	cpu->A = temp16 & 0xFF;
+	cpu->programCounter += 1;
+}
+static inline void SUB(CPU *cpu, uint8_t *src){
+	uint16_t temp16 = cpu->A - *src;
+	flagsSub(cpu, cpu->A, *src, temp16);
+	cpu->A = temp16 & 0xFF;
+	cpu->programCounter += 1;
+}
+static inline void SBB(CPU *cpu, uint8_t *src){
+	uint16_t temp16 = cpu->A - *src - (cpu->flags & FLAG_C);
+	flagsSub(cpu, cpu->A, *src, temp16);
+	cpu->A = temp16 & 0xFF;
+	cpu->programCounter += 1;
+}
+static inline void ANA(CPU *cpu, uint8_t *src){
+	/*AC is the OR of bit 3 of both operands on the 8080*/
+	flagsAnd(cpu, cpu->A, *src, cpu->A & *src);
+	cpu->A = cpu->A & *src;
+	cpu->programCounter += 1;
+}
+static inline void XRA(CPU *cpu, uint8_t *src){
+	cpu->A = cpu->A ^ *src;
+	flagsLogic(cpu, cpu->A);
+	cpu->programCounter += 1;
+}
+static inline void ORA(CPU *cpu, uint8_t *src){
+	cpu->A = cpu->A | *src;
+	flagsLogic(cpu, cpu->A);
+	cpu->programCounter += 1;
+}
+static inline void INR(CPU *cpu, uint8_t *src){
 	*src += 1;
-	zeroFlag = (*src == 0);
-	signFlag = (*src >> 7);
-	parityFlag = parity(*src);
-	cycleCount += 5;
-	programCounter += 1;
+	flagsInr(cpu, *src);
+	cpu->programCounter += 1;
 }
-static inline void DCR(uint8_t *src){
+static inline void DCR(CPU *cpu, uint8_t *src){
 	*src -= 1;
-	zeroFlag = (*src == 0);
-	signFlag = (*src >> 7);
-	parityFlag = parity(*src);
-	cycleCount += 5;
-	programCounter += 1;
-}
-static void inline CMP(uint8_t *src){
-	carryFlag = (*src > A);
-	temp8 = *src - A;
-	zeroFlag = (temp8 == 0);
-	parityFlag = parity(temp8);
-	signFlag = temp8 >> 7;
-	cycleCount += 4;
-	programCounter += 1;
+	flagsDcr(cpu, *src);
+	cpu->programCounter += 1;
 }
-static inline uint16_t make16(uint8_t hiReg, uint8_t lowReg)
-{
-	return (hiReg << 8) | lowReg;
+static void inline CMP(CPU *cpu, uint8_t *src){
+	uint16_t temp16 = cpu->A - *src;
+	flagsSub(cpu, cpu->A, *src, temp16);
+	cpu->programCounter += 1;
 }
-void tick()
+/* Interrupts come in through here too, returning to the interrupted instruction */
+static inline void RST(CPU *cpu, uint16_t returnAddress, uint16_t vector){
+	writeByte(cpu, cpu->stackPointer - 1, returnAddress >> 8);
+	writeByte(cpu, cpu->stackPointer - 2, returnAddress & 255);
+	cpu->stackPointer = cpu->stackPointer - 2;
+	cpu->programCounter = vector;
+}
+/* Keeps trace output in order with the core's own printf output */
+static inline void flushTrace(CPU *cpu)
 {
-	uint8_t opcode;
-	isCPURunning = true;
-	while (isCPURunning)
+#ifdef TRACE
+	if (cpu->trace != NULL){
+		traceFlush(cpu->trace);
+	}
+#endif
+}
+static inline uint16_t make16(uint8_t hiReg, uint8_t lowReg)
+{
+	return (hiReg << 8) | lowReg;
+}
+/* Every opcode with a body in Opcodes.inc */
+#define IMPLEMENTED_OPCODES(X) \
+	X(0x00) X(0x01) X(0x02) X(0x03) X(0x04) X(0x05) X(0x06) X(0x07) \
+	X(0x09) X(0x0A) X(0x0B) X(0x0C) X(0x0D) X(0x0E) X(0x0F) X(0x10) \
+	X(0x11) X(0x12) X(0x13) X(0x14) X(0x15) X(0x16) X(0x17) X(0x19) \
+	X(0x1A) X(0x1B) X(0x1C) X(0x1D) X(0x1E) X(0x1F) X(0x20) X(0x21) \
+	X(0x22) X(0x23) X(0x24) X(0x25) X(0x26) X(0x27) X(0x28) X(0x29) \
+	X(0x2A) X(0x2B) X(0x2C) X(0x2D) X(0x2E) X(0x2F) X(0x30) X(0x31) \
+	X(0x32) X(0x33) X(0x34) X(0x35) X(0x36) X(0x37) X(0x38) X(0x39) \
+	X(0x3A) X(0x3B) X(0x3C) X(0x3D) X(0x3E) X(0x3F) X(0x40) X(0x41) \
+	X(0x42) X(0x43) X(0x44) X(0x45) X(0x46) X(0x47) X(0x48) X(0x49) \
+	X(0x4A) X(0x4B) X(0x4C) X(0x4D) X(0x4E) X(0x4F) X(0x50) X(0x51) \
+	X(0x52) X(0x53) X(0x54) X(0x55) X(0x56) X(0x57) X(0x58) X(0x59) \
+	X(0x5A) X(0x5B) X(0x5C) X(0x5D) X(0x5E) X(0x5F) X(0x60) X(0x61) \
+	X(0x62) X(0x63) X(0x64) X(0x65) X(0x66) X(0x67) X(0x68) X(0x69) \
+	X(0x6A) X(0x6B) X(0x6C) X(0x6D) X(0x6E) X(0x6F) X(0x70) X(0x71) \
+	X(0x72) X(0x73) X(0x74) X(0x75) X(0x76) X(0x77) X(0x78) X(0x79) \
+	X(0x7A) X(0x7B) X(0x7C) X(0x7D) X(0x7E) X(0x7F) X(0x80) X(0x81) \
+	X(0x82) X(0x83) X(0x84) X(0x85) X(0x86) X(0x87) X(0x88) X(0x89) \
+	X(0x8A) X(0x8B) X(0x8C) X(0x8D) X(0x8E) X(0x8F) X(0x90) X(0x91) \
+	X(0x92) X(0x93) X(0x94) X(0x95) X(0x96) X(0x97) X(0x98) X(0x99) \
+	X(0x9A) X(0x9B) X(0x9C) X(0x9D) X(0x9E) X(0x9F) X(0xA0) X(0xA1) \
+	X(0xA2) X(0xA3) X(0xA4) X(0xA5) X(0xA6) X(0xA7) X(0xA8) X(0xA9) \
+	X(0xAA) X(0xAB) X(0xAC) X(0xAD) X(0xAE) X(0xAF) X(0xB0) X(0xB1) \
+	X(0xB2) X(0xB3) X(0xB4) X(0xB5) X(0xB6) X(0xB7) X(0xB8) X(0xB9) \
+	X(0xBA) X(0xBB) X(0xBC) X(0xBD) X(0xBE) X(0xBF) X(0xC0) X(0xC1) \
+	X(0xC2) X(0xC3) X(0xC4) X(0xC5) X(0xC6) X(0xC7) X(0xC8) X(0xC9) \
+	X(0xCA) X(0xCB) X(0xCC) X(0xCD) X(0xCE) X(0xCF) X(0xD0) X(0xD1) \
+	X(0xD2) X(0xD3) X(0xD4) X(0xD5) X(0xD6) X(0xD7) X(0xD8) X(0xD9) \
+	X(0xDA) X(0xDB) X(0xDC) X(0xDD) X(0xDE) X(0xDF) X(0xE0) X(0xE1) \
+	X(0xE2) X(0xE3) X(0xE4) X(0xE5) X(0xE6) X(0xE7) X(0xE8) X(0xE9) \
+	X(0xEA) X(0xEB) X(0xEC) X(0xED) X(0xEE) X(0xEF) X(0xF0) X(0xF1) \
+	X(0xF2) X(0xF3) X(0xF4) X(0xF5) X(0xF6) X(0xF7) X(0xF8) X(0xF9) \
+	X(0xFA) X(0xFB) X(0xFC) X(0xFD) X(0xFE) X(0xFF)
+/* Block translation.
+	With -DBLOCK_CACHE the run loop runs guest code a basic block at a time. A
+	block starts wherever control lands and ends after the first jump,
+	call, return, RST, PCHL, IN, OUT, EI or HLT, or after BLOCK_MAX_OPS
+	instructions. It
+	is translated once into an array of micro-ops, each holding the address
+	of the handler label in run() and the operand already assembled, so a
+	whole block runs as a chain of indirect jumps with no fetch, decode or
+	budget check in between. Handlers still keep the program counter and
+	cycleCount exact as they go.
+	codeBits marks each byte covered by a live block. A store to one of
+	them retires every block overlapping it. Instructions that store are
+	followed by a check micro-op, so a block that overwrites itself stops
+	right there; retired blocks are only freed between blocks. */
+#ifdef BLOCK_CACHE
+#ifdef DECODE_CACHE
+#error "BLOCK_CACHE replaces DECODE_CACHE, build with only one of them"
+#endif
+#define BLOCK_MAX_OPS 32
+#define BLOCK_MAX_BYTES (BLOCK_MAX_OPS * 3)
+/* More than any block can take, used to stop on the exact instruction */
+#define BLOCK_MAX_CYCLES (BLOCK_MAX_OPS * 18)
+
+typedef struct BlockOp {
+	void *label;
+	uint16_t operand;
+	uint8_t opcode;
+} BlockOp;
+typedef struct Block {
+	struct Block *nextRetired;
+	bool valid;
+	bool nativeRejected; /* the dynarec can't compile it */
+	uint16_t length; /* guest bytes covered */
+	uint16_t hits; /* visits through run(), counts towards DYNAREC_HOT_BLOCK */
+	BlockOp ops[];
+} Block;
+typedef struct BlockCache {
+	Block *blocks[65536]; /* indexed by start address */
+	uint8_t codeBits[65536 / 8];
+	Block *retired;
+	struct Dynarec *dynarec; /* NULL unless built with -DDYNAREC */
+} BlockCache;
+
+static const bool implementedOpcodes[256] = {
+#define IMPLEMENTED_ENTRY(n) [n] = true,
+	IMPLEMENTED_OPCODES(IMPLEMENTED_ENTRY)
+#undef IMPLEMENTED_ENTRY
+};
+
+/* Instructions that can send the program counter anywhere but forward,
+	I/O, whose handlers may stop the run or change what the block sees, and
+	EI, which can make an interrupt due */
+static bool endsBlock(uint8_t opcode)
+{
+	if (opcode == 0x76){
+		return true; /*HLT*/
+	}
+	if (opcode < 0xC0){
+		return false;
+	}
+	switch (opcode & 0x07)
 	{
-		opcode = memory[programCounter];
-		printf("OPCODE:%x\n", opcode);
-		printf("Program Counter:%x\n", programCounter);
-		switch (opcode)
-		{
-		case 0x00:
-			/*NOP*/
-			cycleCount+=4;
-			programCounter++;
-			break;
-		case 0x01:
-			/*LXI B, D16*/
-			B = memory[programCounter + 2];
-			C = memory[programCounter + 1];
-			cycleCount += 10;
-			programCounter += 3;
-			break;
-		case 0x02:
-			/*STAX B*/
-			memory[make16(B, C)] = A;
-			programCounter += 1;
-			cycleCount += 7;
-			break;
-		case 0x03:
-			/*INX B*/
-			temp16 = (make16(B, C)) + 1;
-			B = temp16 >> 8;
-			C = temp16 & 0x00FF;
-			programCounter++;
-			cycleCount += 5;
-			break;
-		case 0x04:
-			/*INR B*/
-			INR(&B);
-			break;
-		case 0x05:
-			/*DCR B*/
-			DCR(&B);
-			break;
-		case 0x06:
-			/*MVI B,D8*/
-			MVI(&B);
-			break;
-		case 0x07:
-			/*RLC*/
-			/*FLAGS: C*/
-			carryFlag = A >> 7;
-			A = (A << 1) | carryFlag;
-			programCounter++;
-			cycleCount += 4;
-			break;
-		case 0x09:
-			/*DAD B*/
-			/*FLAGS: C*/
-			/*TODO*/
-			temp32 = (make16(B, C)) + (make16(H, L));
-			carryFlag = (temp32 > 65535);
-			temp32 = temp32 & 0xFFFF;
-			H = temp32 >> 8;
-			L = temp32 & 0x00FF;
-			programCounter++;
-			cycleCount += 10;
-			break;
-		case 0x0A:
-			/*LDAX B*/
-			A = memory[make16(B, C)];
-			programCounter += 1;
-			cycleCount += 7;
-			break;
-		case 0x0B:
-			/*DCX B*/
-			temp16 = (make16(B, C)) - 1;
-			B = (temp16 >> 8);
-			C = temp16 & 0xFF;
-			programCounter++;
-			cycleCount += 5;
-			break;
-		case 0x0C:
-			/*INR C*/
-			INR(&C);
-			break;
-		case 0x0D:
-			/*DCR C*/
-			DCR(&C);
-			break;
-		case 0x0E:
-			/*MVI C, D8*/
-			MVI(&C);
-			break;
-		case 0x0F:
-			/*RRC CY*/
-			/*FLAGS: C*/
-			carryFlag = A & 0x01;
-			A = (A >> 1) | (carryFlag << 7);
-			programCounter++;
-			cycleCount += 4;
-			break;
-		case 0x10:
-			/*NOP*/
-			cycleCount += 4;
-			break;
-		case 0x11:
-			/*LXI D, D16 - double check*/
-			E = memory[programCounter+1];
-			D = memory[programCounter+2];
-			programCounter += 3;
-			cycleCount += 10;
-			break;
-		case 0x12:
-			/*STAX D*/
-			memory[make16(D, E)] = A;
-			programCounter += 1;
-			cycleCount += 7;
-			break;
-		case 0x13:
-			/*INX D*/
-			temp16 = (make16(D, E)) + 1;
-			D = temp16 >> 8;
-			E = temp16 & 0x00FF;
-			programCounter++;
-			cycleCount += 5;
-			break;
-		case 0x14:
-			/*INR D*/
-			INR(&D);
-			break;
-		case 0x15:
-			/*DCR D*/
-			DCR(&D);
-			break;
-		case 0x16:
-			/*MVI D, D8*/
-			MVI(&D);
-			break;
-		case 0x17:
-			/*RAL*/
-			temp8 = A << 1;
-			temp8 = temp8 | carryFlag;
-			carryFlag = A >> 7;
-			A = temp8;
-			cycleCount += 4;
-			programCounter++;
-			break;
-		case 0x19:
-			/*DAD D*/
-			/*FLAGS: C*/
-			temp32 = (make16(D, E)) + (make16(H, L));
-			carryFlag = (temp32 > 0xFFFF);
-			temp32 = temp32 & 0xFFFF;
-			H = temp32 >> 8;
-			L = temp32 & 0x00FF;
-			cycleCount += 10;
-			programCounter++;
-			break;
-		case 0x1A:
-			/*LDAX D*/
-			A = memory[make16(D, E)];
-			cycleCount += 10;
-			programCounter += 1;
-			break;
-		case 0x1B:
-			/*DCX D*/
-			temp16 = make16(D, E) - 1;
-			D = (temp16 >> 8);
-			E = temp16 & 0xFF;
-			programCounter++;
-			cycleCount += 5;
-			break;
-		case 0x1C:
-			/*INR E*/
-			/*FLAGS: S Z AC P*/
-			INR(&E);
-			break;
-		case 0x1D:
-			/*DCR E*/
-			/*FLAGS: S Z AC P*/
-			DCR(&E);
-			break;
-		case 0x1E:
-			/*MVI, E, d8*/
-			MVI(&E);
-			break;
-		case 0x1F:
-			/*RAR*/
-			temp8 = A >> 1;
-			temp8 = temp8 | (carryFlag << 7);
-			carryFlag = A & 1;
-			A = temp8;
-			cycleCount += 4;
-			programCounter++;
-			break;
-		case 0x20:
-			/*NOP*/
-		case 0x21:
-			/*LXI H, d16*/
-			L = memory[programCounter+1];
-			H = memory[programCounter+2];
-			programCounter += 3;
-			cycleCount += 10;
-			break;
-		case 0x22:
-			/*SHLD a16*/
-			temp16 = (memory[programCounter+2] << 8) | memory[programCounter+1];
-			memory[temp16] = L;
-			memory[temp16 + 1] = H;
-			programCounter = programCounter + 3;
-			cycleCount += 16;
-			break;
-		case 0x23:
-			/*INX H*/
-			temp16 = (make16(H, L)) + 1;
-			H = temp16 >> 8;
-			L = temp16 &0x00FF;
-			programCounter++;
-			break;
-		case 0x24:
-			/*INR H*/
-			/*FLAGS: S Z AC P*/
-			INR(&H);
-			break;
-		case 0x25:
-			/*DCR H*/
-			/*FLAGS: S Z AC P*/
-			DCR(&H);
-			break;
-		case 0x26:
-			/*MVI, H, d8*/
-			MVI(&H);
-			break;
-		case 0x27:
-			/*DAA*/
-			/*FLAGS: S Z AC P C*/
-			//unfinished
-			break;
-			;
-		case 0x28:
-			/*NOP*/
-			break;
-			;
-		case 0x29:
-			/*DAD H*/
-			/*FLAGS: C*/
-			temp32 = (make16(H, L)) << 1;
-			carryFlag = (temp32 > 0xFFFF);
-			temp32 = temp32 & 0xFFFF;
-			H = temp32 >> 8;
-			L = temp32 & 0x00FF;
-			cycleCount += 10;
-			programCounter++;
-			break;
-		case 0x2A:
-			/*LHLD a16*/
-			temp16 = (memory[programCounter+2] << 8) | memory[programCounter+1];
-			H = memory[temp16+1];
-			L = memory[temp16];
-			programCounter = programCounter + 3;
-			cycleCount += 16;
-			break;
-		case 0x2B:
-			/*DCX H*/
-			temp16 = (make16(H, L)) - 1;
-			H = temp16 >> 8;
-			L = temp16 & 0x00FF;
-			programCounter++;
-			break;
-		case 0x2C:
-			/*INR L*/
-			/*FLAGS: S Z AC P*/
-			INR(&L);
-			break;
-		case 0x2D:
-			/*DCR L*/
-			/*FLAGS: S Z AC P*/
-			DCR(&L);
-			break;
-		case 0x2E:
-			/*MVI  L, d8*/
-			MVI(&L);
-			break;
-		case 0x2F:
-			/*CMA*/
-			A = ~A;
-			programCounter++;
-			cycleCount += 4;
-			break;
-		case 0x30:
-			/*dummy OP*/
-			/*dump processor state*/
-			printf("Accumulator Value: %x\n", A);
-			printf("B and C Values: %x %x\n", B, C);
-			printf("D and E Values: %x %x\n", D, E);
-			printf("H and L Values: %x %x\n", H, L);
-			printf("Carry:%d\nSign:%d\nZero:%d\nParity:%d\n", carryFlag, signFlag, zeroFlag, parityFlag);
-			cycleCount += 4;
-			programCounter += 1;
-			break;
-		case 0x31:
-			/*LXI SP, d16*/
-			stackPointer = (memory[programCounter + 2] << 8) | memory[programCounter+1];
-			programCounter = programCounter + 3;
-			cycleCount += 10;
-			break;
-		case 0x32:
-			/*STA a16*/
-			temp16 = (memory[programCounter+2] << 8) | memory[programCounter+1];
-			memory[temp16] = A;
-			programCounter = programCounter + 3;
-			cycleCount += 13;
-			break;
-		case 0x33:
-			/*INX SP*/
-			stackPointer++;
-			cycleCount += 5;
-			programCounter++;
-			break;
-		case 0x34:
-			/*INR M*/
-			/*FLAGS: S Z AC P*/
-			INR(&memory[make16(H,L)]);
-			cycleCount += 5;
-			break;
-		case 0x35:
-			/*DCR M*/
-			/*FLAGS: S Z AC P*/
-			DCR(&memory[make16(H,L)]);
-			cycleCount += 5;
-			break;
-		case 0x36:
-			/*MVI M, d8*/
-			temp16 = make16(H, L);
-			memory[temp16] = memory[programCounter + 1];
-			programCounter += 2;
-			cycleCount += 10;
-			break;
-		case 0x37:
-			/*STC*/
-			/*FLAGS: C*/
-			carryFlag = 1;
-			programCounter++;
-			cycleCount += 4;
-			break;
-		case 0x38:
-			/*NOP*/
-			cycleCount += 4;
-			programCounter += 1;
-			break;
-		case 0x39:
-			/*DAD SP*/
-			/*FLAGS: C*/
-			temp32 = make16(H,L) + stackPointer;
-			carryFlag = (temp32 > 0xFFFF);
-			temp32 = temp32 % 65536;
-			H = temp32 >> 8;
-			L = temp32 & 0x00FF;
-			cycleCount += 10;
-			programCounter++;
-			break;
-		case 0x3A:
-			/*LDA a16*/
-			temp16 = (memory[programCounter + 2] << 8) | memory[programCounter+1];
-			A = memory[temp16];
-			programCounter = programCounter + 3;
-			cycleCount += 13;
-			break;
-		case 0x3B:
-			/*DCX SP*/
-			stackPointer--;
-			cycleCount += 5;
-			programCounter++;
-			break;
-		case 0x3C:
-			/*INR A*/
-			/*FLAGS: S Z AC P*/
-			INR(&A);
-			break;
-		case 0x3D:
-			/*DCR A*/
-			/*FLAGS: S Z AC P*/
-			DCR(&A);
-			break;
-		case 0x3E:
-			/*MVI A, d8*/
-			MVI(&A);
-			break;
-		case 0x3F:
-			/*CMC*/
-			/*FLAGS: C*/
-			carryFlag = !carryFlag;
-			cycleCount += 4;
-			programCounter += 1;
-			break;
-		/*MOVE OPCODES*/
-		case 0x40:
-			MOV(&B, &B);
-			break;
-		case 0x41:
-			MOV(&B, &C);
-			break;
-		case 0x42:
-			MOV(&B, &D);
-			break;
-		case 0x43:
-			MOV(&B, &E);
-			break;
-		case 0x44:
-			MOV(&B, &H);
-			break;
-		case 0x45:
-			MOV(&B, &L);
-			break;
-		case 0x46:
-			/*MOV B, M*/
-			temp16 = make16(H, L);
-			B = memory[temp16];
-			programCounter += 1;
-			cycleCount += 7;
-			break;
-		case 0x47:
-			MOV(&B, &A);
-			break;
-		case 0x48:
-			MOV(&C, &B);
-			break;
-		case 0x49:
-			MOV(&C, &C);
-			break;
-		case 0x4A:
-			MOV(&C, &D);
-			break;
-		case 0x4B:
-			MOV(&C, &E);
-			break;
-		case 0x4C:
-			MOV(&C, &H);
-			break;
-		case 0x4D:
-			MOV(&C, &L);
-			break;
-		case 0x4E:
-			/*MOV C, M*/
-			temp16 = make16(H, L);
-			C = memory[temp16];
-			programCounter += 1;
-			cycleCount += 7;
-			break;
-		case 0x4F:
-			MOV(&C, &A);
-			break;
-		case 0x50:
-			MOV(&D, &B);
-			break;
-		case 0x51:
-			MOV(&D, &C);
-			break;
-		case 0x52:
-			MOV(&D, &D);
-			break;
-		case 0x53:
-			MOV(&D, &E);
-			break;
-		case 0x54:
-			MOV(&D, &H);
-			break;
-		case 0x55:
-			MOV(&D, &L);
-			break;
-		case 0x56:
-			/*MOV D, M*/
-			temp16 = make16(H, L);
-			D = memory[temp16];
-			programCounter += 1;
-			cycleCount += 7;
-			break;
-		case 0x57:
-			MOV(&D, &A);
-			break;
-		case 0x58:
-			MOV(&E, &B);
-			break;
-		case 0x59:
-			MOV(&E, &C);
-			break;
-		case 0x5A:
-			MOV(&E, &D);
-			break;
-		case 0x5B:
-			MOV(&E, &E);
-			break;
-		case 0x5C:
-			MOV(&E, &H);
-			break;
-		case 0x5D:
-			MOV(&E, &L);
-			break;
-		case 0x5E:
-			/*MOV E, M*/
-			temp16 = make16(H, L);
-			E = memory[temp16];
-			programCounter += 1;
-			cycleCount += 7;
-			break;
-		case 0x5F:
-			MOV(&E, &A);
-			break;
-		case 0x60:
-			MOV(&H, &B);
-			break;
-		case 0x61:
-			MOV(&H, &C);
-			break;
-		case 0x62:
-			MOV(&H, &D);
-			break;
-		case 0x63:
-			MOV(&H, &E);
-			break;
-		case 0x64:
-			MOV(&H, &H);
-			break;
-		case 0x65:
-			MOV(&H, &L);
-			break;
-		case 0x66:
-			/*MOV H, M*/
-			temp16 = make16(H, L);
-			H = memory[temp16];
-			programCounter += 1;
-			cycleCount += 7;
-			break;
-		case 0x67:
-			MOV(&H, &A);
-			break;
-		case 0x68:
-			MOV(&L, &B);
-			break;
-		case 0x69:
-			MOV(&L, &C);
-			break;
-		case 0x6A:
-			MOV(&L, &D);
-			break;
-		case 0x6B:
-			MOV(&L, &E);
-			break;
-		case 0x6C:
-			MOV(&L, &H);
-			break;
-		case 0x6D:
-			MOV(&L, &L);
-			break;
-		case 0x6E:
-			/*MOV L, M*/
-			temp16 = make16(H, L);
-			L = memory[temp16];
-			programCounter += 1;
-			cycleCount += 7;
-			break;
-		case 0x6F:
-			MOV(&L, &A);
-			break;
-		/*MEMORY MOVE OPCODES*/
-		case 0x70:
-			/*MOV M, B*/
-			temp16 = make16(H, L);
-			memory[temp16] = B;
-			programCounter += 1;
-			cycleCount += 7;
-			break;
-		case 0x71:
-			/*MOV M, C*/
-			temp16 = make16(H, L);
-			memory[temp16] = C;
-			programCounter++;
-			cycleCount += 7;
-			break;
-		case 0x72:
-			/*MOV M, D*/
-			temp16 = make16(H, L);
-			memory[temp16] = D;
-			programCounter += 1;
-			cycleCount += 7;
-			break;
-		case 0x73:
-			/*MOV M, E*/
-			temp16 = make16(H, L);
-			memory[temp16] = E;
-			programCounter += 1;
-			cycleCount += 7;
-			break;
-		case 0x74:
-			/*MOV M, H*/
-			temp16 = make16(H, L);
-			memory[temp16] = H;
-			programCounter += 1;
-			cycleCount += 7;
-			break;
-		case 0x75:
-			/*MOV M, L*/
-			temp16 = make16(H, L);
-			memory[temp16] = L;
-			programCounter += 1;
-			cycleCount += 7;
-			break;
-		case 0x76:
-			/*HLT*/
-			isCPURunning = false;
-			cycleCount += 7;
-			programCounter++;
-			break;
-		case 0x77:
-			/*MOV M, A*/
-			temp16 = make16(H, L);
-			memory[temp16] = A;
-			programCounter++;
-			cycleCount += 7;
-			break;
-		case 0x78:
-			MOV(&A, &B);
-			break;
-		case 0x79:
-			MOV(&A, &C);
-			break;
-		case 0x7A:
-			MOV(&A, &D);
-			break;
-		case 0x7B:
-			MOV(&A, &E);
-			break;
-		case 0x7C:
-			MOV(&A, &H);
-			break;
-		case 0x7D:
-			MOV(&A, &L);
-			break;
-		case 0x7E:
-			/*MOV A, M*/
-			temp16 = make16(H, L);
-			A = memory[temp16];
-			programCounter++;
-			cycleCount += 7;
-			break;
-		case 0x7F:
-			MOV(&A, &A);
-			break;
-		case 0x80:
-			/*ADD B*/
-			/*FLAGS: S Z AC P C*/
-			ADD(&B);
-			break;
-		case 0x81:
-			/*ADD C*/
-			/*FLAGS: S Z AC P C*/
-			ADD(&C);
-			break;
-		case 0x82:
-			/*ADD D*/
-			/*FLAGS: S Z AC P C*/
-			ADD(&D);
-			break;
-		case 0x83:
-			/*ADD E*/
-			/*FLAGS: S Z AC P C*/
-			ADD(&E);
-			break;
-		case 0x84:
-			/*ADD H*/
-			/*FLAGS: S Z AC P C*/
-			ADD(&H);
-			break;
-		case 0x85:
-			/*ADD L*/
-			/*FLAGS: S Z AC P C*/
-			ADD(&L);
-			break;
-		case 0x86:
-			/*ADD M*/
-			/*FLAGS: S Z AC P C*/
-			ADD(&memory[make16(H, L)]);
-			cycleCount += 3;
-			break;
-		case 0x87:
-			/*ADD A*/
-			/*FLAGS: S Z AC P C*/
-			ADD(&A);
-			break;
-		case 0x88:
-			/*ADC B*/
-			/*FLAGS: S Z AC P C*/
-			ADC(&B);
-			break;
-		case 0x89:
-			/*ADC C*/
-			/*FLAGS: S Z AC P C*/
-			ADC(&C);
-			break;
-		case 0x8A:
-			/*ADC D*/
-			/*FLAGS: S Z AC P C*/
-			ADC(&D);
-			break;
-		case 0x8B:
-			/*ADC E*/
-			/*FLAGS: S Z AC P C*/
-			ADC(&E);
-			break;
-		case 0x8C:
-			/*ADC H*/
-			/*FLAGS: S Z AC P C*/
-			ADC(&H);
-			break;
-		case 0x8D:
-			/*ADC L*/
-			/*FLAGS: S Z AC P C*/
-			ADC(&L);
-			break;
-		case 0x8E:
-			/*ADC M*/
-			/*FLAGS: S Z AC P C*/
-			ADC(&memory[make16(H, L)]);
-			cycleCount += 3;
-			break;
-		case 0x8F:
-			/*ADC A*/
-			/*FLAGS: S Z AC P C*/
-			ADC(&A);
-			break;
-		case 0x90:
-			/*SUB B*/
-			/*FLAGS: S Z AC P C*/
-			SUB(&B);
-			break;
-		case 0x91:
-			/*SUB C*/
-			/*FLAGS: S Z AC P C*/
-			SUB(&C);
-			break;
-		case 0x92:
-			/*SUB D*/
-			/*FLAGS: S Z AC P C*/
-			SUB(&D);
-			break;
-		case 0x93:
-			/*SUB E*/
-			/*FLAGS: S Z AC P C*/
-			SUB(&E);
-			break;
-		case 0x94:
-			/*SUB H*/
-			/*FLAGS: S Z AC P C*/
-			SUB(&H);
-			break;
-		case 0x95:
-			/*SUB L*/
-			/*FLAGS: S Z AC P C*/
-			SUB(&L);
-			break;
-		case 0x96:
-			/*SUB M*/
-			/*FLAGS: S Z AC P C*/
-			SUB(&memory[make16(H, L)]);
-			cycleCount += 3;
-			break;
-		case 0x97:
-			/*SUB A*/
-			/*FLAGS: S Z AC P C*/
-			SUB(&A);
-			break;
-		case 0x98:
-			/*SBB B*/
-			/*FLAGS: S Z AC P C*/
-			SBB(&B);
-			break;
-		case 0x99:
-			/*SBB C*/
-			/*FLAGS: S Z AC P C*/
-			SBB(&C);
-			break;
-		case 0x9A:
-			/*SBB D*/
-			/*FLAGS: S Z AC P C*/
-			SBB(&D);
-			break;
-		case 0x9B:
-			/*SBB E*/
-			/*FLAGS: S Z AC P C*/
-			SBB(&E);
-			break;
-		case 0x9C:
-			/*SBB H*/
-			/*FLAGS: S Z AC P C*/
-			SBB(&H);
-			break;
-		case 0x9D:
-			/*SBB L*/
-			/*FLAGS: S Z AC P C*/
-			SBB(&L);
-			break;
-		case 0x9E:
-			/*SBB M*/
-			/*FLAGS: S Z AC P C*/
-			SBB(&memory[make16(H,L)]);
-			cycleCount += 3;
-			break;
-		case 0x9F:
-			/*SBB A*/
-			/*FLAGS: S Z AC P C*/
-			SBB(&A);
-			break;
-		case 0xA0:
-			/*ANA B*/
-			/*FLAGS: S Z AC P C*/
-			A = A & B;
-			carryFlag = 0;
-			zeroFlag = (A == 0);
-			parityFlag = parity(A);
-			signFlag = (A >> 7);
-			programCounter++;
-			cycleCount += 4;
-			break;
-		case 0xA1:
-			/*ANA C*/
-			/*FLAGS: S Z AC P C*/
-			A = A & C;
-			carryFlag = 0;
-			zeroFlag = (A == 0);
-			parityFlag = parity(A);
-			signFlag = (A >> 7);
-			programCounter++;
-			cycleCount += 4;
-			break;
-		case 0xA2:
-			/*ANA D*/
-			/*FLAGS: S Z AC P C*/
-			A = A & D;
-			carryFlag = 0;
-			zeroFlag = (A == 0);
-			parityFlag = parity(A);
-			signFlag = (A >> 7);
-			programCounter++;
-			cycleCount += 4;
-			break;
-		case 0xA3:
-			/*ANA E*/
-			/*FLAGS: S Z AC P C*/
-			A = A & E;
-			carryFlag = 0;
-			zeroFlag = (A == 0);
-			parityFlag = parity(A);
-			signFlag = (A >> 7);
-			programCounter++;
-			cycleCount += 4;
-			break;
-		case 0xA4:
-			/*ANA H*/
-			/*FLAGS: S Z AC P C*/
-			A = A & H;
-			carryFlag = 0;
-			zeroFlag = (A == 0);
-			parityFlag = parity(A);
-			signFlag = (A >> 7);
-			programCounter++;
-			cycleCount += 4;
-			break;
-		case 0xA5:
-			/*ANA L*/
-			/*FLAGS: S Z AC P C*/
-			A = A & L;
-			carryFlag = 0;
-			zeroFlag = (A == 0);
-			parityFlag = parity(A);
-			signFlag = (A >> 7);
-			programCounter++;
-			cycleCount += 4;
-			break;
-		case 0xA6:
-			/*ANA M*/
-			/*FLAGS: S Z AC P C*/
-			A = A & memory[make16(H,L)];
-			carryFlag = 0;
-			zeroFlag = (A == 0);
-			parityFlag = parity(A);
-			signFlag = (A >> 7);
-			programCounter++;
-			cycleCount += 7;
-			break;
-		case 0xA7:
-			/*ANA A*/
-			/*FLAGS: S Z AC P C*/
-			A = A & A;
-			carryFlag = 0;
-			zeroFlag = (A == 0);
-			parityFlag = parity(A);
-			signFlag = (A >> 7);
-			programCounter++;
-			cycleCount += 4;
-			break;
-		case 0xA8:
-			/*XRA B*/
-			/*FLAGS: S Z AC P C*/
-			A = A ^ B;
-			carryFlag = 0;
-			zeroFlag = (A == 0);
-			parityFlag = parity(A);
-			signFlag = (A >> 7);
-			programCounter++;
-			cycleCount += 4;
-			break;
-		case 0xA9:
-			/*XRA C*/
-			/*FLAGS: S Z AC P C*/
-			A = A ^ C;
-			carryFlag = 0;
-			zeroFlag = (A == 0);
-			parityFlag = parity(A);
-			signFlag = (A >> 7);
-			programCounter++;
-			cycleCount += 4;
-			break;
-		case 0xAA:
-			/*XRA D*/
-			/*FLAGS: S Z AC P C*/
-			A = A ^ D;
-			carryFlag = 0;
-			zeroFlag = (A == 0);
-			parityFlag = parity(A);
-			signFlag = (A >> 7);
-			programCounter++;
-			cycleCount += 4;
-			break;
-		case 0xAB:
-			/*XRA E*/
-			/*FLAGS: S Z AC P C*/
-			A = A ^ E;
-			carryFlag = 0;
-			zeroFlag = (A == 0);
-			parityFlag = parity(A);
-			signFlag = (A >> 7);
-			programCounter++;
-			cycleCount += 4;
-			break;
-		case 0xAC:
-			/*XRA H*/
-			/*FLAGS: S Z AC P C*/
-			A = A ^ H;
-			carryFlag = 0;
-			zeroFlag = (A == 0);
-			parityFlag = parity(A);
-			signFlag = (A >> 7);
-			programCounter++;
-			cycleCount += 4;
-			break;
-		case 0xAD:
-			/*XRA l*/
-			/*FLAGS: S Z AC P C*/
-			A = A ^ L;
-			carryFlag = 0;
-			zeroFlag = (A == 0);
-			parityFlag = parity(A);
-			signFlag = (A >> 7);
-			programCounter++;
-			cycleCount += 4;
-			break;
-		case 0xAE:
-			/*XRA M*/
-			/*FLAGS: S Z AC P C*/
-			A = A ^ memory[make16(H,L)];
-			carryFlag = 0;
-			zeroFlag = (A == 0);
-			parityFlag = parity(A);
-			signFlag = (A >> 7);
-			programCounter++;
-			cycleCount += 7;
-			break;
-		case 0xAF:
-			/*XRA A*/
-			/*FLAGS: S Z AC P C*/
-			A = A ^ A;
-			carryFlag = 0;
-			zeroFlag = (A == 0);
-			parityFlag = parity(A);
-			signFlag = (A >> 7);
-			programCounter += 1;
-			cycleCount += 4;
-			break;
-		case 0xB0:
-			/*ORA B*/
-			/*FLAGS: S Z AC P C*/
-			A = B | A;
-			carryFlag = 0;
-			zeroFlag = (A == 0);
-			parityFlag = parity(A);
-			signFlag = (A >> 7);
-			programCounter += 1;
-			cycleCount += 4;
-			break;
-		case 0xB1:
-			/*ORA C*/
-			/*FLAGS: S Z AC P C*/
-			A = C | A;
-			carryFlag = 0;
-			zeroFlag = (A == 0);
-			parityFlag = parity(A);
-			signFlag = (A >> 7);
-			programCounter += 1;
-			cycleCount += 4;
-			break;
-		case 0xB2:
-			/*ORA D*/
-			/*FLAGS: S Z AC P C*/
-			A = D | A;
-			carryFlag = 0;
-			zeroFlag = (A == 0);
-			parityFlag = parity(A);
-			signFlag = (A >> 7);
-			programCounter += 1;
-			cycleCount += 4;
-			break;
-		case 0xB3:
-			/*ORA E*/
-			/*FLAGS: S Z AC P C*/
-			A = E | A;
-			carryFlag = 0;
-			zeroFlag = (A == 0);
-			parityFlag = parity(A);
-			signFlag = (A >> 7);
-			programCounter += 1;
-			cycleCount += 4;
-			break;
-		case 0xB4:
-			/*ORA H*/
-			/*FLAGS: S Z AC P C*/
-			A = H | A;
-			carryFlag = 0;
-			zeroFlag = (A == 0);
-			parityFlag = parity(A);
-			signFlag = (A >> 7);
-			programCounter += 1;
-			cycleCount += 4;
-			break;
-		case 0xB5:
-			/*ORA L*/
-			/*FLAGS: S Z AC P C*/
-			A = L | A;
-			carryFlag = 0;
-			zeroFlag = (A == 0);
-			parityFlag = parity(A);
-			signFlag = (A >> 7);
-			programCounter += 1;
-			cycleCount += 4;
-			break;
-		case 0xB6:
-			/*ORA M*/
-			/*FLAGS: S Z AC P C*/
-			A = A | memory[make16(H, L)];
-			carryFlag = 0;
-			zeroFlag = (A == 0);
-			parityFlag = parity(A);
-			signFlag = (A >> 7);
-			programCounter += 1;
-			cycleCount += 7;
-			break;
-		case 0xB7:
-			/*ORA A*/
-			/*FLAGS: S Z AC P C*/
-			A = A | A;
-			carryFlag = 0;
-			zeroFlag = (A == 0);
-			parityFlag = parity(A);
-			signFlag = (A >> 7);
-			programCounter += 1;
-			cycleCount += 4;
-			break;
-		case 0xB8:
-			/*CMP B*/
-			/*FLAGS: S Z AC P C*/
-			CMP(&B);
-			break;
-		case 0xB9:
-			/*CMP C*/
-			CMP(&C);
-			break;
-		case 0xBA:
-			/*CMP D*/
-			CMP(&D);
-			break;
-		case 0xBB:
-			/*CMP E*/
-			CMP(&E);
-			break;
-		case 0xBC:
-			/*CMP H*/
-			CMP(&H);
-			break;
-		case 0xBD:
-			/*CMP L*/
-			CMP(&L);
-			break;
-		case 0xBE:
-			/*CMP M*/
-			CMP(&memory[make16(H, L)]);
-			cycleCount += 3;
-			break;
-		case 0xBF:
-			/*CMP A*/
-			zeroFlag = 0;
-			carryFlag = 0;
-			signFlag = 0;
-			parityFlag = 0;
-			cycleCount = 4;
-			break;
-		case 0xC0:
-			/*RNZ*/
-			if (!zeroFlag){
-				programCounter = memory[stackPointer];
-				programCounter = programCounter | (memory[stackPointer+1] << 8);
-				stackPointer = stackPointer + 2;
-				cycleCount += 11;
-			}
-			else {
-				programCounter += 1;
-				cycleCount += 5;
-			}
-			break;
-		case 0xC1:
-			/*POP B*/
-			C = memory[stackPointer];
-			B = memory[stackPointer+1];
-			stackPointer += 2;
-			cycleCount += 10;
-			programCounter += 1;
-			break;
-		case 0xC2:
-			/*JNZ a16*/
-			if (!zeroFlag){
-				programCounter = make16(memory[programCounter+2], memory[programCounter+1]);
-			}
-			else{
-				programCounter += 3;
-			}
-			cycleCount += 10;
-			break;
-		case 0xC3:
-			/*JMP Unconditional*/
-			programCounter = make16(memory[programCounter+2], memory[programCounter+1]);
-			cycleCount += 10;
-			break;
-		case 0xC4:
-			/*CNZ a16*/
-			if (!zeroFlag){
-				memory[stackPointer - 1] = ((programCounter+3) >> 8);
-				memory[stackPointer - 2] = ((programCounter+3) & 255);
-				stackPointer = stackPointer - 2;
-				programCounter = make16(memory[programCounter + 2], memory[programCounter + 1]);
-				cycleCount += 17;
-			}
-			else{
-				programCounter += 3;
-				cycleCount += 11;
-			}
-			break;
-		case 0xC5:
-			/*PUSH B*/
-			memory[stackPointer - 1] = B;
-			memory[stackPointer - 2] = C;
-			stackPointer = stackPointer - 2;
-			programCounter += 1;
-			cycleCount += 11;
-			break;
-		case 0xC6:
-			/*ADI*/
-			/*FLAGS: S Z AC P C*/
-			temp16 = A + memory[programCounter + 1];
-			A = temp16 & 0xFF;
-			signFlag = A >> 7;
-			zeroFlag = (A == 0);
-			parityFlag = parity(A);
-			carryFlag = temp16 > 255;
-			programCounter += 2;
-			cycleCount += 7;
-			break;
-		case 0xC7:
-			/*RST 0*/
-			memory[stackPointer - 1] = (programCounter+1) >> 8;
-			memory[stackPointer - 2] = (programCounter+1) & 255;
-			stackPointer = stackPointer - 2;
-			programCounter = 0;
-			cycleCount += 11;
-			break;
-		case 0xC8:
-			/*RZ*/
-			if (zeroFlag){
-				programCounter = make16(memory[stackPointer + 1], memory[stackPointer]);
-				stackPointer = stackPointer + 2;
-				cycleCount += 11;
-			}
-			else {
-				programCounter += 1;
-				cycleCount += 5;
-			}
-			break;
-		case 0xC9:
-			/*RET*/
-			programCounter = make16(memory[stackPointer + 1], memory[stackPointer]);
-			stackPointer = stackPointer + 2;
-			cycleCount += 10;
-			break;
-		case 0xCA:
-			/*JZ a16*/
-			if (zeroFlag){
-				programCounter = make16(memory[programCounter + 2], memory[programCounter + 1]);
-			}
-			else{
-				programCounter += 3;
-			}
-			cycleCount += 10;
-			break;
-		case 0xCB:
-			/* *JMP a16*/
-			programCounter = make16(memory[programCounter+2], memory[programCounter+1]);
-			cycleCount += 10;
-			break;
-		case 0xCC:
-			/*CZ a16*/
-			if (zeroFlag){
-				memory[stackPointer - 1] = (programCounter+3) >> 8;
-				memory[stackPointer - 2] = (programCounter+3) & 255;
-				stackPointer = stackPointer - 2;
-				programCounter = make16(memory[programCounter+2], memory[programCounter+1]);
-				cycleCount += 17;
-			}
-			else{
-				programCounter += 3;
-				cycleCount += 11;
-			}
-			break;
-		case 0xCD:
-			/*CALL a16*/
-			memory[stackPointer - 1] = (programCounter+3) >> 8;
-			memory[stackPointer - 2] = (programCounter+3) & 255;
-			stackPointer = stackPointer - 2;
-			programCounter = make16(memory[programCounter+2], memory[programCounter+1]);
-			cycleCount += 17;
-			break;
-		case 0xCE:
-			/*ACI d8*/
-			temp16 = A + memory[programCounter+1] + carryFlag;
-			A = temp16 & 0xFF;
-			zeroFlag = (A == 0);
-			signFlag = A >> 7;
-			parityFlag = parity(A);
-			carryFlag = temp16 > 255;
-			programCounter += 2;
-			cycleCount += 7;
-			break;
-		case 0xCF:
-			/*RST 1*/
-			memory[stackPointer - 1] = (programCounter+1) >> 8;
-			memory[stackPointer - 2] = (programCounter+1) & 255;
-			stackPointer = stackPointer - 2;
-			programCounter = 8;
-			cycleCount += 11;
-			break;
-		case 0xD0:
-			/*RNC*/
-			if (!carryFlag){
-				programCounter = memory[stackPointer];
-				programCounter = programCounter | (memory[stackPointer+1] << 8);
-				stackPointer = stackPointer + 2;
-				cycleCount += 11;
-			}
-			else {
-				programCounter += 1;
-				cycleCount += 5;
-			}
-			break;
-		case 0xD1:
-			/*POP D*/
-			E = memory[stackPointer];
-			D = memory[stackPointer + 1];
-			stackPointer += 2;
-			cycleCount += 10;
-			programCounter += 1;
-			break;
-		case 0xD2:
-			/*JNC a16*/
-			if (!carryFlag){
-				programCounter = make16(memory[programCounter+2], memory[programCounter+1]);
-			}
-			else{
-				programCounter += 3;
-			}
-			cycleCount += 10;
-			break;
-		case 0xD3:
-			/*OUT d8* TODO*/
-			programCounter += 2;
-			cycleCount += 10;
-			break;
-		case 0xD4:
-			/*CNC a16*/
-			if (!carryFlag){
-				memory[stackPointer - 1] = (programCounter+3) >> 8;
-				memory[stackPointer - 2] = (programCounter+3) & 255;
-				stackPointer = stackPointer - 2;
-				programCounter = make16(memory[programCounter+2], memory[programCounter+1]);
-				cycleCount += 17;
-			}
-			else {
-				programCounter += 3;
-				cycleCount += 11;
-			}
-			break;
-		case 0xD5:
-			/*PUSH D*/
-			memory[stackPointer - 1] = D;
-			memory[stackPointer - 2] = E;
-			stackPointer = stackPointer - 2;
-			cycleCount += 11;
-			programCounter += 1;
-			break;
-		case 0xD6:
-			/*SUI d8*/
-			/*FLAGS: S Z AC P C*/
-			temp8 = memory[programCounter + 1];
-			carryFlag = (temp8 > A);
-			A = A - temp8;
-			signFlag = (A >> 7);
-			zeroFlag = (A == 0);
-			parityFlag = parity(A);
-			programCounter += 2;
-			cycleCount += 7;
-			break;
-		case 0xD7:
-			/*RST 2*/
-			memory[stackPointer - 1] = (programCounter+1) >> 8;
-			memory[stackPointer - 2] = (programCounter+1) & 255;
-			stackPointer = stackPointer - 2;
-			programCounter = 16;
-			cycleCount += 11;
-			break;
-		case 0xD8:
-			/*RC*/
-			if (carryFlag){
-				programCounter = make16(memory[stackPointer + 1], memory[stackPointer]);
-				stackPointer = stackPointer + 2;
-				cycleCount += 11;
-			}
-			else {
-				programCounter += 1;
-				cycleCount += 5;
-			}
-			break;
-		case 0xD9:
-			/* *RET */
-			programCounter = make16(memory[stackPointer + 1], memory[stackPointer]);
-			stackPointer = stackPointer + 2;
-			cycleCount += 10;
-			break;
-		case 0xDA:
-			/*JC a16*/
-			if (carryFlag){
-				programCounter = make16(memory[programCounter+2], memory[programCounter+1]);
-			}
-			else{
-				programCounter += 3;
-			}
-			cycleCount += 10;
-			break;
-		case 0xDB:
-			/*IN d8 TODO*/
-			cycleCount += 10;
-			programCounter += 2;
-			break;
-		case 0xDC:
-			/*CC a16*/
-			if (carryFlag){
-				memory[stackPointer - 1] = (programCounter+3) >> 8;
-				memory[stackPointer - 2] = (programCounter+3) & 255;
-				stackPointer = stackPointer - 2;
-				programCounter = make16(memory[programCounter+2], memory[programCounter+1]);
-				cycleCount += 17;
-			}
-			else{
-				programCounter += 3;
-				cycleCount += 11;
-			}
-			break;
-		case 0xDD:
-			/* *CALL*/
-			memory[stackPointer - 1] = programCounter >> 8;
-			memory[stackPointer - 2] = programCounter & 255;
-			stackPointer = stackPointer - 2;
-			programCounter = make16(memory[programCounter+2], memory[programCounter+1]);
-			cycleCount += 17;
-			break;
-		case 0xDE:
-			/*SBI d8 TODO*/
-			SBB(&memory[programCounter + 1]);
-			cycleCount += 3;
-			programCounter += 1;
-			break;
-		case 0xDF:
-			/*RST 3*/
-			memory[stackPointer - 1] = (programCounter+1) >> 8;
-			memory[stackPointer - 2] = (programCounter+1) & 255;
-			stackPointer = stackPointer - 2;
-			programCounter = 24;
-			cycleCount += 11;
-			break;
-		case 0xE0:
-			/*RPO*/
-			if (!parityFlag){
-				programCounter = make16(memory[stackPointer + 1], memory[stackPointer]);
-				stackPointer = stackPointer + 2;
-				cycleCount += 11;
-			}
-			else {
-				programCounter += 1;
-				cycleCount += 5;
-			}
-			break;
-		case 0xE1:
-			/*POP H*/
-			L = memory[stackPointer];
-			H = memory[stackPointer + 1];
-			stackPointer += 2;
-			cycleCount += 10;
-			programCounter += 1;
-			break;
-		case 0xE2:
-			/*JPO*/
-			if(!parityFlag){
-				programCounter = make16(memory[programCounter+2], memory[programCounter+1]);
-			}
-			else{
-				programCounter += 3;
-			}
-			cycleCount += 10;
-			break;
-		case 0xE3:
-			/*XTHL*/
-			temp8 = memory[stackPointer];
-			memory[stackPointer] = L;
-			L = temp8;
-			temp8 = memory[stackPointer+1];
-			memory[stackPointer+1] = H;
-			H = temp8;
-			cycleCount += 18;
-			programCounter += 1;
-			break;
-		case 0xE4:
-			/*CPO a16*/
-			if (!parityFlag){
-				memory[stackPointer - 1] = (programCounter+3) >> 8;
-				memory[stackPointer - 2] = (programCounter+3) & 255;
-				stackPointer = stackPointer - 2;
-				programCounter = make16(memory[programCounter+2], memory[programCounter+1]);
-				cycleCount += 17;
-			}
-			else{
-				programCounter += 3;
-				cycleCount += 11;
-			}
-			break;
-		case 0xE5:
-			/*PUSH H*/
-			memory[stackPointer - 1] = H;
-			memory[stackPointer - 2] = L;
-			stackPointer = stackPointer - 2;
-			cycleCount += 11;
-			programCounter += 1;
-			break;
-		case 0xE6:
-			/*ANI d8*/
-			A = A & memory[programCounter + 1];
-			zeroFlag = (A == 0);
-			signFlag = (A >> 7);
-			parityFlag = parity(A);
-			carryFlag = 0;
-			programCounter += 2;
-			cycleCount += 7;
-			break;
-		case 0xE7:
-			/*RST 4*/
-			memory[stackPointer - 1] = (programCounter+1) >> 8;
-			memory[stackPointer - 2] = (programCounter+1) & 255;
-			stackPointer = stackPointer - 2;
-			programCounter = 32;
-			cycleCount += 11;
-			break;
-		case 0xE8:
-			/*RPE*/
-			if (parityFlag){
-				programCounter = make16(memory[stackPointer + 1], memory[stackPointer]);
-				stackPointer = stackPointer + 2;
-				cycleCount += 11;
-			}
-			else {
-				programCounter += 1;
-				cycleCount += 5;
-			}
-			break;
-		case 0xE9:
-			/*PCHL*/
-			programCounter = (H << 8) | L;
-			cycleCount += 5;
-			break;
-		case 0xEA:
-			/*Its in the game*/
-			/*JPE a16*/
-			if (parityFlag){
-				programCounter = make16(memory[programCounter+2], memory[programCounter+1]);
-			}
-			else{
-				programCounter += 3;
-			}
-			cycleCount += 10;
-			break;
-		case 0xEB:
-			/*XCHG*/
-			temp8 = H;
-			H = D;
-			D = temp8;
-			temp8 = L;
-			L = E;
-			E = temp8;
-			cycleCount += 5;
-			programCounter += 1;
-			break;
-		case 0xEC:
-			/*CPE a16*/
-			if (parityFlag){
-				memory[stackPointer - 1] = (programCounter+3) >> 8;
-				memory[stackPointer - 2] = (programCounter+3) & 255;
-				stackPointer = stackPointer - 2;
-				programCounter = make16(memory[programCounter+2], memory[programCounter+1]);
-				cycleCount += 17;
-			}
-			else{
-				programCounter += 3;
-				cycleCount += 11;
-			}
-			break;
-		case 0xED:
-			/* *CALL */
-			memory[stackPointer - 1] = programCounter >> 8;
-			memory[stackPointer - 2] = programCounter & 255;
-			stackPointer = stackPointer - 2;
-			programCounter = make16(memory[programCounter+2], memory[programCounter+1]);
-			cycleCount += 17;
-			break;
-		case 0xEE:
-			/*XRI d8*/
-			A = A ^ memory[programCounter + 1];
-			carryFlag = 0;
-			zeroFlag = (A == 0);
-			signFlag = (A >> 7);
-			parityFlag = parity(A);
-			programCounter += 2;
-			cycleCount += 7;
-			break;
-		case 0xEF:
-			/*RST 5*/
-			memory[stackPointer - 1] = (programCounter+1) >> 8;
-			memory[stackPointer - 2] = (programCounter+1) & 255;
-			stackPointer = stackPointer - 2;
-			programCounter = 40;
-			cycleCount += 11;
-			break;
-		case 0xF0:
-			/*RP*/
-			if (!signFlag){
-				programCounter = make16(memory[stackPointer + 1], memory[stackPointer]);
-				stackPointer = stackPointer + 2;
-				cycleCount += 11;
-			}
-			else {
-				programCounter += 1;
-				cycleCount += 5;
-			}
-			break;
-		case 0xF1:
-			/*POP PSW TEST*/
-			A = memory[stackPointer + 1];
-			temp8 = memory[stackPointer];
-			carryFlag = temp8 & 1;
-			parityFlag = (temp8 & 0b100) >> 2;
-			auxCarryFlag = (temp8 & 0b10000) >> 4;
-			zeroFlag = (temp8 & 0b1000000) >> 6;
-			signFlag = (temp8 & 0b10000000) >> 7;
-			cycleCount += 10;
-			programCounter += 1;
-			stackPointer += 2;
-			break;
-		case 0xF2:
-			/*JP a16*/
-			if (!signFlag){
-				programCounter = make16(memory[programCounter+2], memory[programCounter+1]);
-			}
-			else{
-				programCounter += 3;
-			}
-			cycleCount += 10;
-			break;
-		case 0xF3:
-			/*DI*/
-			interruptsEnabled = false;
-			cycleCount += 4;
-			programCounter += 1;
-			break;
-		case 0xF4:
-			/*CP a16*/
-			if (!signFlag){
-				memory[stackPointer - 1] = (programCounter+3) >> 8;
-				memory[stackPointer - 2] = (programCounter+3) & 255;
-				stackPointer = stackPointer - 2;
-				programCounter = make16(memory[programCounter+2], memory[programCounter+1]);
-				cycleCount += 17;
-			}
-			else{
-				programCounter += 3;
-				cycleCount += 11;
-			}
-			break;
-		case 0xF5:
-			/*PUSH PSW TEST*/
-			memory[stackPointer - 1] = A;
-			temp8 = 0b00000010 | (carryFlag) | (parityFlag << 2) | (auxCarryFlag << 4) | (zeroFlag << 6) | (signFlag << 7);
-			memory[stackPointer - 2] = temp8;
-			stackPointer = stackPointer - 2;
-			cycleCount += 11;
-			programCounter += 1;
-			break;
-		case 0xF6:
-			/*ORI d8*/
-			A = A | memory[programCounter + 1];
-			carryFlag = 0;
-			zeroFlag = (A == 0);
-			parityFlag = parity(A);
-			signFlag = ( A >> 7);
-			programCounter += 2;
-			cycleCount += 7;
-			break;
-		case 0xF7:
-			/*RST 6*/
-			memory[stackPointer - 1] = (programCounter+1) >> 8;
-			memory[stackPointer - 2] = (programCounter+1) & 255;
-			stackPointer = stackPointer - 2;
-			programCounter = 48;
-			cycleCount += 11;
-			break;
-		case 0xF8:
-			/*RM*/
-			if (signFlag){
-				programCounter = make16(memory[stackPointer + 1], memory[stackPointer]);
-				stackPointer = stackPointer + 2;
-				cycleCount += 11;
+	case 0x00: /*Rcc*/
+	case 0x02: /*Jcc*/
+	case 0x04: /*Ccc*/
+	case 0x07: /*RST*/
+		return true;
+	}
+	switch (opcode)
+	{
+	case 0xC3: case 0xCB: /*JMP*/
+	case 0xC9: case 0xD9: /*RET*/
+	case 0xCD: case 0xDD: case 0xED: case 0xFD: /*CALL*/
+	case 0xE9: /*PCHL*/
+	case 0xD3: case 0xDB: /*OUT IN*/
+	case 0xFB: /*EI*/
+		return true;
+	default:
+		return false;
+	}
+}
+
+/* Instructions that store to memory without ending the block */
+static bool storesToMemory(uint8_t opcode)
+{
+	switch (opcode)
+	{
+	case 0x02: case 0x12: /*STAX*/
+	case 0x22: /*SHLD*/
+	case 0x32: /*STA*/
+	case 0x34: case 0x35: case 0x36: /*INR M, DCR M, MVI M*/
+	case 0x70: case 0x71: case 0x72: case 0x73: case 0x74: case 0x75: case 0x77: /*MOV M,r*/
+	case 0xC5: case 0xD5: case 0xE5: case 0xF5: /*PUSH*/
+	case 0xE3: /*XTHL*/
+		return true;
+	default:
+		return false;
+	}
+}
+
+/* Returns the instruction length, or 0 if the opcode has no handler.
+	At a breakpoint the op goes to op_breakpoint, which runs the real
+	opcode from op->opcode if it doesn't stop. */
+static uint8_t decodeBlockOp(CPU *cpu, uint16_t address, BlockOp *op, void *const *labels)
+{
+	uint8_t opcode = codeByte(cpu, address);
+	uint8_t length = instructionLength[opcode];
+	if (!implementedOpcodes[opcode]){
+		return 0;
+	}
+	op->label = labels[breakpointAt(cpu, address) ? BREAK_OPCODE : opcode];
+	op->opcode = opcode;
+	op->operand = 0;
+	if (length > 1){
+		op->operand = codeByte(cpu, address + 1);
+	}
+	if (length == 3){
+		op->operand |= codeByte(cpu, address + 2) << 8;
+	}
+	return length;
+}
+
+/* Returns NULL when the first instruction has no handler */
+static Block *translateBlock(CPU *cpu, uint16_t start, void *const *labels, void *checkLabel, void *endLabel)
+{
+	BlockCache *cache = cpu->blockCache;
+	BlockOp ops[BLOCK_MAX_OPS * 2 + 1];
+	uint32_t count = 0;
+	uint32_t instructions = 0;
+	uint32_t address = start;
+	uint32_t i;
+	uint8_t length;
+	bool breakpoint = false;
+	Block *block;
+	while (instructions < BLOCK_MAX_OPS && address < 0x10000){
+		/* a breakpoint gets a block of its own, which the dynarec leaves alone */
+		if (breakpointAt(cpu, address)){
+			if (instructions > 0){
+				break;
 			}
-			else {
-				programCounter += 1;
-				cycleCount += 5;
+			breakpoint = true;
+		}
+		length = decodeBlockOp(cpu, address, &ops[count], labels);
+		if (length == 0){
+			break;
+		}
+		instructions++;
+		address += length;
+		if (endsBlock(ops[count++].opcode) || breakpoint){
+			break;
+		}
+		if (storesToMemory(ops[count - 1].opcode)){
+			ops[count++].label = checkLabel;
+		}
+	}
+	if (instructions == 0){
+		return NULL;
+	}
+	ops[count++].label = endLabel;
+	block = malloc(sizeof(Block) + count * sizeof(BlockOp));
+	if (block == NULL){
+		return NULL;
+	}
+	block->nextRetired = NULL;
+	block->valid = true;
+	block->nativeRejected = breakpoint;
+	block->length = address - start;
+	block->hits = 0;
+	memcpy(block->ops, ops, count * sizeof(BlockOp));
+	cache->blocks[start] = block;
+	for (i = start; i < address; i++){
+		/* the last instruction may wrap past 0xFFFF */
+		cache->codeBits[(uint16_t)i >> 3] |= 1 << (i & 7);
+		markCodePage(cpu, (uint16_t)i >> 8);
+	}
+	return block;
+}
+
+static void invalidateBlocks(CPU *cpu, uint16_t address)
+{
+	BlockCache *cache = cpu->blockCache;
+	uint16_t distance;
+	if (!(cache->codeBits[address >> 3] & (1 << (address & 7)))){
+		return;
+	}
+	/* Every block covering address is dropped below */
+	cache->codeBits[address >> 3] &= ~(1 << (address & 7));
+	for (distance = 0; distance < BLOCK_MAX_BYTES; distance++){
+		uint16_t start = address - distance;
+		Block *block = cache->blocks[start];
+		if (block != NULL && distance < block->length){
+#ifdef DYNAREC
+			if (cache->dynarec != NULL){
+				dynarecInvalidate(cache->dynarec, start);
 			}
-			break;
-		case 0xF9:
-			/*SPHL*/
-			stackPointer = (H << 8) | L;
-			cycleCount += 5;
-			programCounter += 1;
-			break;
-		case 0xFA:
-			/*JM a16*/
-			if (signFlag){
-				programCounter = make16(memory[programCounter+2], memory[programCounter+1]);
+#endif
+			cache->blocks[start] = NULL;
+			block->valid = false;
+			block->nextRetired = cache->retired;
+			cache->retired = block;
+		}
+	}
+}
+
+static void freeRetiredBlocks(BlockCache *cache)
+{
+	while (cache->retired != NULL){
+		Block *block = cache->retired;
+		cache->retired = block->nextRetired;
+		free(block);
+	}
+}
+
+static void freeBlocks(CPU *cpu)
+{
+	uint32_t i;
+	if (cpu->blockCache == NULL){
+		return;
+	}
+	freeRetiredBlocks(cpu->blockCache);
+	for (i = 0; i < 65536; i++){
+		free(cpu->blockCache->blocks[i]);
+	}
+#ifdef DYNAREC
+	dynarecFree(cpu->blockCache->dynarec);
+#endif
+	free(cpu->blockCache);
+	cpu->blockCache = NULL;
+}
+#ifdef DYNAREC
+/* Hands a block's instructions to the dynarec, NULL if it can't take them */
+static void *compileBlock(CPU *cpu, Block *block, uint16_t start)
+{
+	DecodedOp ops[BLOCK_MAX_OPS];
+	uint32_t address = start;
+	int count = 0;
+	void *native;
+	while (address < (uint32_t)start + block->length){
+		ops[count].opcode = codeByte(cpu, address);
+		ops[count].length = instructionLength[ops[count].opcode];
+		ops[count].operand = codeByte(cpu, address + 1);
+		if (ops[count].length == 3){
+			ops[count].operand |= codeByte(cpu, address + 2) << 8;
+		}
+		address += ops[count++].length;
+	}
+	native = dynarecCompile(cpu->blockCache->dynarec, start, ops, count);
+	if (native == NULL){
+		block->nativeRejected = true;
+	}
+	return native;
+}
+#endif
+#endif
+
+bool cpuDynarecStats(const CPU *cpu, struct DynarecStats *stats)
+{
+#ifdef DYNAREC
+	if (cpu->blockCache != NULL && cpu->blockCache->dynarec != NULL){
+		dynarecGetStats(cpu->blockCache->dynarec, stats);
+		return true;
+	}
+#endif
+	(void)cpu;
+	(void)stats;
+	return false;
+}
+
+/* Dispatch.
+	The instruction bodies live in Opcodes.inc, written against OPCODE(n) and
+	NEXT, so one source builds both engines. The default is a switch inside
+	the run loop. With -DTHREADED_DISPATCH (GCC/Clang computed goto) every
+	handler ends by fetching the next opcode and jumping straight to its
+	handler through a table of label addresses, which gives each handler
+	its own indirect branch for the predictor to learn. -DBLOCK_CACHE uses
+	the same labels as micro-ops, see Block translation above. */
+/* A breakpoint's instruction is traced and profiled by op_breakpoint,
+	once it runs */
+#ifdef TRACE
+#define TRACE_INSTRUCTION() \
+	if (cpu->trace != NULL && opcode != BREAK_OPCODE){ \
+		traceInstruction(cpu->trace, cpu, opcode); \
+	}
+#else
+#define TRACE_INSTRUCTION()
+#endif
+#ifdef PROFILE
+#define PROFILE_INSTRUCTION() \
+	if (cpu->profile != NULL && opcode != BREAK_OPCODE){ \
+		profileInstruction(cpu->profile, cpu, opcode); \
+	}
+#else
+#define PROFILE_INSTRUCTION()
+#endif
+/* Immediate operands of the current instruction */
+#ifdef BLOCK_CACHE
+#define IMM8 ((uint8_t)op->operand)
+#define IMM16 (op->operand)
+#elif defined(DECODE_CACHE)
+#define FETCH_OPCODE() \
+	decoded = &cpu->decodeCache[cpu->programCounter]; \
+	if (decoded->length == 0){ \
+		decoded = decodeInstruction(cpu, cpu->programCounter); \
+	} \
+	opcode = decoded->opcode
+#define IMM8 ((uint8_t)decoded->operand)
+#define IMM16 (decoded->operand)
+#else
+#define FETCH_OPCODE() \
+	opcode = fetchByte(cpu, cpu->programCounter)
+#define IMM8 fetchByte(cpu, cpu->programCounter + 1)
+#define IMM16 make16(fetchByte(cpu, cpu->programCounter + 2), fetchByte(cpu, cpu->programCounter + 1))
+#endif
+#define FETCH() \
+	if (cpu->cycleCount >= cpu->cycleStop && !reachedStop(cpu)){ \
+		return; \
+	} \
+	FETCH_OPCODE(); \
+	TRACE_INSTRUCTION() \
+	PROFILE_INSTRUCTION()
+#ifdef BLOCK_CACHE
+#define OPCODE(n) op_##n:
+#define NEXT goto *(++op)->label
+#elif defined(THREADED_DISPATCH)
+#define OPCODE(n) op_##n:
+#define NEXT \
+	do { \
+		if (!cpu->isCPURunning){ \
+			return; \
+		} \
+		FETCH(); \
+		goto *dispatchTable[opcode]; \
+	} while (0)
+#else
+#define OPCODE(n) case n:
+#define NEXT break
+#endif
+/* Stops and interrupts.
+	The run loop compares cycleCount against cycleStop before every
+	instruction. Besides the end of the run, cycleStop is pulled down for
+	a break request, an interrupt that can be taken and the end of the EI
+	delay, so none of them costs the common path anything more. When it
+	trips, reachedStop() works out which it was. A replayed input log
+	pulls it down to its next event as well, and breakpoints that have to
+	be checked at every instruction boundary pull it down to the next one. */
+static inline bool interruptReady(const CPU *cpu)
+{
+	return cpu->interruptsEnabled && cpu->interruptsPending;
+}
+
+static inline bool checkEveryInstruction(const CPU *cpu)
+{
+	const Breakpoints *breakpoints = cpu->breakpoints;
+#ifdef BLOCK_CACHE
+	return breakpoints != NULL && (breakpoints->conditionCount > 0 || breakpoints->watchCount > 0);
+#else
+	return breakpoints != NULL && breakpoints->conditionCount > 0;
+#endif
+}
+
+static void updateStop(CPU *cpu)
+{
+	cpu->cycleStop = cpu->runStop;
+	if (cpu->breakRequested || interruptReady(cpu) || checkEveryInstruction(cpu)){
+		cpu->cycleStop = cpu->cycleCount;
+	}
+	else if (cpu->enablePending && cpu->enableCycle < cpu->cycleStop){
+		cpu->cycleStop = cpu->enableCycle;
+	}
+	if (cpu->inputLog != NULL && cpu->inputLog->nextStop < cpu->cycleStop){
+		cpu->cycleStop = cpu->inputLog->nextStop;
+	}
+}
+
+/* Returns false if a replay diverged instead */
+static bool takeInterrupt(CPU *cpu)
+{
+	uint8_t vector = __builtin_ctz(cpu->interruptsPending);
+	uint16_t returnAddress = cpu->programCounter;
+	InputLog *log = cpu->inputLog;
+	if (log != NULL){
+		if (log->mode == INPUT_RECORD){
+			inputLogInterrupt(log, cpu->cycleCount, vector);
+		}
+		else if (!inputLogReplayInterrupt(log, cpu->cycleCount, vector)){
+			diverged(cpu);
+			return false;
+		}
+	}
+	if (cpu->halted){
+		/* carry on after the HLT */
+		returnAddress++;
+		cpu->halted = false;
+	}
+#ifdef PROFILE
+	if (cpu->profile != NULL){
+		profileInterrupt(cpu->profile, cpu, vector);
+	}
+#endif
+	cpu->interruptsPending &= ~(1 << vector);
+	cpu->interruptsEnabled = false;
+	RST(cpu, returnAddress, vector << 3);
+	cpu->cycleCount += opcodeCycles[0xC7 | vector << 3];
+	return true;
+}
+
+/* A replay got to the cycle of the next logged event. An interrupt is
+	raised for takeInterrupt() to check against the log, an IN has to be
+	the instruction about to run. Returns false if the run diverged. */
+static bool replayEvent(CPU *cpu)
+{
+	InputLog *log = cpu->inputLog;
+	if (log->nextKind == INPUT_EVENT_IN){
+		if (cpu->cycleCount == log->nextStop){
+			return true;
+		}
+	}
+	else if (cpu->interruptsEnabled){
+		cpu->interruptsPending |= 1 << log->nextKind;
+		return true;
+	}
+	diverged(cpu);
+	return false;
+}
+
+/* Returns false if the run is over, with exitReason set */
+static bool reachedStop(CPU *cpu)
+{
+	if (cpu->breakRequested){
+		cpu->breakRequested = false;
+		cpu->exitReason = EXIT_BREAKPOINT;
+		return false;
+	}
+	if (cpu->enablePending && cpu->cycleCount >= cpu->enableCycle){
+		cpu->enablePending = false;
+		cpu->interruptsEnabled = true;
+	}
+	if (cpu->cycleCount >= cpu->runStop){
+		cpu->exitReason = EXIT_BUDGET;
+		return false;
+	}
+	if (cpu->inputLog != NULL && cpu->cycleCount >= cpu->inputLog->nextStop && !replayEvent(cpu)){
+		return false;
+	}
+	if (interruptReady(cpu) && !takeInterrupt(cpu)){
+		return false;
+	}
+	if (cpu->breakpoints != NULL && cpu->breakpoints->conditionCount > 0
+		&& breakpointsCondition(cpu->breakpoints, cpu)){
+		cpu->exitReason = EXIT_BREAKPOINT;
+		return false;
+	}
+	updateStop(cpu);
+	return true;
+}
+
+/* BREAK_OPCODE is about to run. Returns true if the run stops in front of
+	it for a breakpoint, false to run the instruction actually there. */
+__attribute__((noinline, cold)) static bool breakpointHit(CPU *cpu)
+{
+	if (cpu->breakpoints == NULL || !breakpointAt(cpu, cpu->programCounter)
+		|| !breakpointsExecute(cpu->breakpoints, cpu)){
+		return false;
+	}
+	cpu->exitReason = EXIT_BREAKPOINT;
+	return true;
+}
+
+/* With interrupts on HLT waits for one. The CPU stays on the HLT and time
+	skips to the next stop, where a pending interrupt is taken. In a run
+	without a budget nothing could ever raise one, so that run ends, unless
+	an input log being replayed has more to come. */
+static inline void HLT(CPU *cpu)
+{
+	InputLog *log = cpu->inputLog;
+	bool waiting = cpu->halted;
+	cpu->cycleCount += opcodeCycles[0x76];
+	if ((cpu->interruptsEnabled || cpu->enablePending)
+		&& (cpu->runStop != INT64_MAX || (log != NULL && log->nextStop != INT64_MAX))){
+		cpu->halted = true;
+		if (cpu->cycleCount < cpu->cycleStop){
+			cpu->cycleCount = cpu->cycleStop;
+		}
+		else if (waiting && log != NULL && log->nextKind != INPUT_EVENT_IN && cpu->cycleCount > log->nextStop){
+			/* wake where the recording did, however the runs are sliced */
+			cpu->cycleCount = log->nextStop;
+		}
+		return;
+	}
+	cpu->halted = false;
+	cpu->programCounter++;
+	cpu->isCPURunning = false;
+	cpu->exitReason = EXIT_HALT;
+}
+
+static void run(CPU *cpu)
+{
+	uint8_t opcode;
+	uint32_t temp32;
+	uint16_t temp16;
+	uint8_t temp8;
+#ifdef DECODE_CACHE
+	DecodedOp *decoded;
+#endif
+#ifdef BLOCK_CACHE
+	BlockCache *cache;
+	Block *block = NULL;
+	const BlockOp *op;
+	BlockOp step[2];
+#endif
+#ifdef DYNAREC
+	void *native;
+#endif
+#if defined(THREADED_DISPATCH) || defined(BLOCK_CACHE)
+	static void *const dispatchTable[256] = {
+		[0 ... 255] = &&op_unimplemented,
+#define DISPATCH_ENTRY(n) [n] = &&op_##n,
+		IMPLEMENTED_OPCODES(DISPATCH_ENTRY)
+#undef DISPATCH_ENTRY
+		[BREAK_OPCODE] = &&op_breakpoint,
+	};
+#endif
+#ifdef DECODE_CACHE
+	if (cpu->decodeCache == NULL){
+		cpu->decodeCache = calloc(65536, sizeof(DecodedOp));
+		if (cpu->decodeCache == NULL){
+			cpu->exitReason = EXIT_NO_MEMORY;
+			return;
+		}
+	}
+#endif
+#ifdef BLOCK_CACHE
+	if (cpu->blockCache == NULL){
+		cpu->blockCache = calloc(1, sizeof(BlockCache));
+		if (cpu->blockCache == NULL){
+			cpu->exitReason = EXIT_NO_MEMORY;
+			return;
+		}
+	}
+	cache = cpu->blockCache;
+#ifdef DYNAREC
+	if (cache->dynarec == NULL){
+		/* stays NULL if no executable memory, blocks are interpreted then */
+		cache->dynarec = dynarecCreate(szpTable, acAddTable, acSubTable);
+	}
+#endif
+#endif
+	cpu->isCPURunning = true;
+	cpu->exitReason = EXIT_NONE;
+#ifdef BLOCK_CACHE
+nextBlock:
+	if (!cpu->isCPURunning){
+		return;
+	}
+	if (cpu->cycleCount >= cpu->cycleStop && !reachedStop(cpu)){
+		return;
+	}
+	freeRetiredBlocks(cache);
+	/* Close to the stop, or when tracing or profiling, run one instruction
+		at a time */
+	if (cpu->cycleCount >= cpu->cycleStop - BLOCK_MAX_CYCLES
+#ifdef TRACE
+		|| cpu->trace != NULL
+#endif
+#ifdef PROFILE
+		|| cpu->profile != NULL
+#endif
+		){
+#ifdef DYNAREC
+stepInstruction:
+#endif
+		if (decodeBlockOp(cpu, cpu->programCounter, &step[0], dispatchTable) == 0){
+			goto op_unimplemented;
+		}
+		step[1].label = &&nextBlock;
+		opcode = step[0].label == dispatchTable[BREAK_OPCODE] ? BREAK_OPCODE : step[0].opcode;
+		TRACE_INSTRUCTION();
+		PROFILE_INSTRUCTION();
+		op = step;
+		goto *op->label;
+	}
+#ifdef DYNAREC
+	if (cache->dynarec != NULL){
+		native = dynarecEntry(cache->dynarec, cpu->programCounter);
+		if (native != NULL){
+			if (!dynarecRun(cache->dynarec, cpu, native, cpu->cycleStop - BLOCK_MAX_CYCLES)){
+				goto nextBlock;
 			}
-			else {
-				programCounter += 3;
+			/* stopped in front of a load from a handler page, which the
+				interpreter runs */
+			if (cpu->cycleCount >= cpu->cycleStop && !reachedStop(cpu)){
+				return;
 			}
-			cycleCount += 10;
-			break;
-		case 0xFB:
-			/*EI*/
-			interruptsEnabled = true;
-			programCounter += 1;
-			cycleCount += 4;
-			break;
-		case 0xFC:
-			/*CM a16*/
-			if (signFlag){
-				memory[stackPointer - 1] = (programCounter+3) >> 8;
-				memory[stackPointer - 2] = (programCounter+3) & 255;
-				stackPointer = stackPointer - 2;
-				programCounter = make16(memory[programCounter+2], memory[programCounter+1]);
-				cycleCount += 17;
+			goto stepInstruction;
+		}
+	}
+#endif
+	block = cache->blocks[cpu->programCounter];
+	if (block == NULL){
+		block = translateBlock(cpu, cpu->programCounter, dispatchTable, &&blockCheck, &&nextBlock);
+		if (block == NULL){
+			goto op_unimplemented;
+		}
+	}
+#ifdef DYNAREC
+	if (cache->dynarec != NULL && !block->nativeRejected && ++block->hits >= DYNAREC_HOT_BLOCK
+		&& compileBlock(cpu, block, cpu->programCounter) != NULL){
+		goto nextBlock;
+	}
+#endif
+	op = block->ops;
+	goto *op->label;
+blockCheck:
+	/* follows every store, the block may just have overwritten itself */
+	if (!block->valid){
+		goto nextBlock;
+	}
+	NEXT;
+#include "Opcodes.inc"
+op_breakpoint:
+	if (breakpointHit(cpu)){
+		return;
+	}
+	opcode = op->opcode;
+	TRACE_INSTRUCTION();
+	PROFILE_INSTRUCTION();
+	goto *dispatchTable[opcode];
+op_unimplemented:
+	flushTrace(cpu);
+	printf("Unimplemented OPCODE");
+	cpu->exitReason = EXIT_UNIMPLEMENTED;
+#elif defined(THREADED_DISPATCH)
+	NEXT;
+#include "Opcodes.inc"
+op_breakpoint:
+	if (breakpointHit(cpu)){
+		return;
+	}
+	/* the decode cache keeps the operand, only the opcode was replaced */
+	opcode = codeByte(cpu, cpu->programCounter);
+	if (opcode == BREAK_OPCODE){
+		goto op_unimplemented;
+	}
+	TRACE_INSTRUCTION();
+	PROFILE_INSTRUCTION();
+	goto *dispatchTable[opcode];
+op_unimplemented:
+	flushTrace(cpu);
+	printf("Unimplemented OPCODE");
+	cpu->exitReason = EXIT_UNIMPLEMENTED;
+#else
+	while (cpu->isCPURunning)
+	{
+		FETCH();
+dispatch:
+		switch (opcode)
+		{
+#include "Opcodes.inc"
+		case BREAK_OPCODE:
+			if (breakpointHit(cpu)){
+				return;
 			}
-			else{
-				programCounter += 3;
-				cycleCount += 11;
+			opcode = codeByte(cpu, cpu->programCounter);
+			if (opcode != BREAK_OPCODE){
+				TRACE_INSTRUCTION();
+				PROFILE_INSTRUCTION();
+				goto dispatch;
 			}
-			break;
-		case 0xFD:
-			/*CALL*/
-			memory[stackPointer - 1] = programCounter >> 8;
-			memory[stackPointer - 2] = programCounter & 255;
-			stackPointer = stackPointer - 2;
-			programCounter = make16(memory[programCounter+2], memory[programCounter+1]);
-			break;
-		case 0xFE:
-			/*CPI d8*/
-			temp8 = A - memory[programCounter + 1];
-			zeroFlag = (temp8 == 0);
-			signFlag = (temp8) >> 7;
-			carryFlag = (A < temp8);
-			parityFlag = parity(temp8);
-			programCounter += 2;
-			cycleCount += 7;
-			break;
-		case 0xFF:
-			/*RST 7*/
-			memory[stackPointer - 1] = (programCounter+1) >> 8;
-			memory[stackPointer - 2] = (programCounter+1) & 255;
-			stackPointer = stackPointer - 2;
-			programCounter = 56;
-			cycleCount += 11;
-			break;
-		default: printf("Unimplemented OPCODE"); return;
+			/* fall through */
+		default:
+			flushTrace(cpu);
+			printf("Unimplemented OPCODE");
+			cpu->exitReason = EXIT_UNIMPLEMENTED;
+			return;
+		}
 	}
-}	
-}
\ No newline at end of file
+#endif
+}
+
+ExitReason cpuRunCycles(CPU *cpu, int64_t cycles)
+{
+	if (cycles > INT64_MAX - cpu->cycleCount){
+		cpu->runStop = INT64_MAX;
+	}
+	else{
+		cpu->runStop = cpu->cycleCount + cycles;
+	}
+	updateStop(cpu);
+	run(cpu);
+	if (cpu->ports != NULL && cpu->ports->queued){
+		portBusFlush(cpu->ports);
+	}
+	if (cpu->inputLog != NULL && cpu->inputLog->used){
+		inputLogFlush(cpu->inputLog);
+	}
+	return cpu->exitReason;
+}
+
+void tick(CPU *cpu)
+{
+	cpuRunCycles(cpu, cpu->cycleLimit ? cpu->cycleLimit - cpu->cycleCount : INT64_MAX);
+}
+
+void cpuBreak(CPU *cpu)
+{
+	cpu->breakRequested = true;
+	updateStop(cpu);
+}
+
+void cpuBreakpointsChanged(CPU *cpu)
+{
+	uint32_t i;
+	for (i = 0; i < MEMORY_PAGE_COUNT; i++){
+		updatePage(cpu, i);
+	}
+	updateStop(cpu);
+}
+
+void cpuRaiseInterrupt(CPU *cpu, uint8_t vector)
+{
+	if (cpu->inputLog != NULL && cpu->inputLog->mode == INPUT_REPLAY){
+		return;
+	}
+	cpu->interruptsPending |= 1 << (vector & 7);
+	updateStop(cpu);
+}
+#undef OPCODE
+#undef NEXT
+#undef IMM8
+#undef IMM16
\ No newline at end of file
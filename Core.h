@@ -0,0 +1,206 @@
+#ifndef CORE_H
+#define CORE_H
+#include <stdint.h>
+#include <stdbool.h>
+/* Flag bits, laid out exactly as PUSH PSW stores them:
+	S Z 0 AC 0 P 1 C */
+#define FLAG_C 0x01
+#define FLAG_ALWAYS_ONE 0x02
+#define FLAG_P 0x04
+#define FLAG_AC 0x10
+#define FLAG_Z 0x40
+#define FLAG_S 0x80
+#define FLAG_MASK (FLAG_S | FLAG_Z | FLAG_AC | FLAG_P | FLAG_C)
+/* Last flag-setting operation, for builds with -DLAZY_FLAGS.
+	LAZY_NONE means flags is fully up to date. */
+typedef enum LazyOp {
+	LAZY_NONE,
+	LAZY_ADD,
+	LAZY_SUB,
+	LAZY_AND,
+	LAZY_LOGIC,
+	LAZY_INR,
+	LAZY_DCR
+} LazyOp;
+/* Why cpuRunCycles() or tick() returned */
+typedef enum ExitReason {
+	EXIT_NONE,
+	EXIT_HALT,
+	EXIT_UNIMPLEMENTED,
+	EXIT_BUDGET,
+	EXIT_BREAKPOINT,
+	EXIT_DIVERGED, /* a replayed run stopped matching its input log */
+	EXIT_NO_MEMORY /* the core couldn't allocate what the run needed */
+} ExitReason;
+/* Memory map.
+	The address space is split into 256 pages of 256 bytes. Each page is
+	backed either by host memory, read-write or read-only, or by a pair of
+	handlers for device registers. cpuInit() maps every page read-write
+	onto the memory it is given. */
+#define MEMORY_PAGE_SHIFT 8
+#define MEMORY_PAGE_SIZE (1 << MEMORY_PAGE_SHIFT)
+#define MEMORY_PAGE_COUNT (65536 >> MEMORY_PAGE_SHIFT)
+typedef uint8_t (*MemoryReadHandler)(void *context, uint16_t address);
+typedef void (*MemoryWriteHandler)(void *context, uint16_t address, uint8_t value);
+typedef struct MemoryPage {
+	uint8_t *host; /* MEMORY_PAGE_SIZE bytes, NULL for a handler page */
+	bool readOnly;
+	MemoryReadHandler read; /* NULL reads 0xFF */
+	MemoryWriteHandler write; /* NULL drops the write */
+	void *context;
+	bool copyOnWrite; /* shared with a snapshot, copied on the first store */
+	struct PageBuffer *buffer; /* owns host when not NULL, see cpuSnapshot() */
+} MemoryPage;
+/* One pre-decoded guest instruction, see -DDECODE_CACHE in Core.c.
+	length 0 marks an entry that has to be decoded again. */
+typedef struct DecodedOp {
+	uint8_t opcode;
+	uint8_t length;
+	uint16_t operand;
+} DecodedOp;
+/* Machine state for a single i8080.
+	Every helper in Core.c takes the CPU it operates on, so any number of
+	machines can live in one process. Memory is owned by the caller. */
+typedef struct CPU {
+	uint8_t B;
+	uint8_t C;
+	uint8_t D;
+	uint8_t E;
+	uint8_t H;
+	uint8_t L;
+	uint8_t A;
+	uint16_t programCounter;
+	uint16_t stackPointer;
+	bool isCPURunning;
+	bool interruptsEnabled;
+	bool enablePending; /* EI ran, interrupts come on at enableCycle */
+	bool halted; /* waiting in HLT for an interrupt */
+	uint8_t interruptsPending; /* bit n requests RST n */
+	uint8_t flags; /* packed in PSW layout, see FLAG_*; read it with cpuFlags() */
+	uint8_t lazyOp;
+	uint8_t lazyOperandA;
+	uint8_t lazyOperandB;
+	uint8_t lazyResult;
+	int64_t cycleCount;
+	int64_t cycleLimit; /* for tick(), 0 runs until HLT */
+	int64_t runStop; /* cycleCount the current run ends at */
+	int64_t cycleStop; /* where the run loop next stops to look, at most runStop */
+	int64_t enableCycle;
+	bool breakRequested;
+	ExitReason exitReason;
+	/* The page instructions were last fetched from, -1 for none */
+	int fetchPage;
+	const uint8_t *fetchHost;
+	struct TraceSink *trace; /* NULL when not tracing */
+	struct Profile *profile; /* NULL when not profiling, see Profile.h */
+	DecodedOp *decodeCache; /* 64K entries, allocated on first tick() */
+	struct BlockCache *blockCache; /* translated blocks, see -DBLOCK_CACHE */
+	struct PortBus *ports; /* devices behind IN/OUT, NULL for none (see Ports.h) */
+	struct InputLog *inputLog; /* recording or replaying input, NULL for neither (see Replay.h) */
+	struct Breakpoints *breakpoints; /* NULL for none, see Breakpoints.h */
+	uint8_t codePages[256];
+	uint8_t *memory;
+	/* Where loads and stores go without looking at pages[]: the page's
+		host memory, or NULL for handler pages and watched ones. writePages
+		is also NULL for read-only pages and pages holding translated code. */
+	uint8_t *readPages[MEMORY_PAGE_COUNT];
+	uint8_t *writePages[MEMORY_PAGE_COUNT];
+	MemoryPage pages[MEMORY_PAGE_COUNT];
+	/* Pages copied since the snapshot numbered snapshotSerial was taken or
+		restored, 0 when the pages may differ from any snapshot */
+	uint64_t snapshotSerial;
+	int dirtyCount;
+	uint8_t dirtyPages[MEMORY_PAGE_COUNT];
+} CPU;
+/* The CPU fields a program can observe: everything apart from memory,
+	run control and what the host attaches. Snapshots carry these. */
+#define CPU_STATE_FIELDS(X) \
+	X(B) X(C) X(D) X(E) X(H) X(L) X(A) \
+	X(programCounter) X(stackPointer) X(flags) \
+	X(lazyOp) X(lazyOperandA) X(lazyOperandB) X(lazyResult) \
+	X(interruptsEnabled) X(enablePending) X(enableCycle) X(halted) X(interruptsPending) \
+	X(cycleCount) X(cycleLimit)
+
+void cpuInit(CPU *cpu, uint8_t *memory);
+/* Runs until at least cycles more cycles have passed, or until HLT, an
+	unimplemented opcode or cpuBreak(). Returns (and stores in exitReason)
+	why it stopped; call it again to carry on from there. */
+ExitReason cpuRunCycles(CPU *cpu, int64_t cycles);
+/* Runs until HLT, or until cycleCount reaches cycleLimit if it is set */
+void tick(CPU *cpu);
+/* Makes the current run, or the next one, return EXIT_BREAKPOINT at the
+	next instruction boundary */
+void cpuBreak(CPU *cpu);
+/* Requests RST vector (0-7) from a device or the host. It stays pending
+	until interrupts are enabled, and is then taken at the next instruction
+	boundary, lowest vector first. A CPU waiting in HLT resumes after it.
+	Ignored while replaying an input log, which brings its own. */
+void cpuRaiseInterrupt(CPU *cpu, uint8_t vector);
+/* Releases anything the core allocated for this CPU */
+void cpuFree(CPU *cpu);
+/* Must be called after changing guest memory behind the core's back */
+void cpuInvalidateCode(CPU *cpu, uint16_t address, uint32_t length);
+/* Must be called after cpu->breakpoints, or the pages and stepping it
+	asks for, change; Breakpoints.c does */
+void cpuBreakpointsChanged(CPU *cpu);
+/* Maps length bytes of guest memory from address onto host, which must
+	hold length bytes. Writes to read-only pages are dropped. Both address
+	and length have to be multiples of MEMORY_PAGE_SIZE; returns false
+	otherwise. */
+bool cpuMapMemory(CPU *cpu, uint16_t address, uint32_t length, uint8_t *host, bool readOnly);
+/* Routes loads and stores in the range to handlers instead */
+bool cpuMapHandlers(CPU *cpu, uint16_t address, uint32_t length, MemoryReadHandler read, MemoryWriteHandler write, void *context);
+/* Copies the page entries for the range into pages, one per page, to be
+	mapped again later with cpuLoadPages(). Unlike mapping the host memory
+	again, that keeps the page copies made since a snapshot (see below),
+	so bank windows put away the banks they stop showing like this. The
+	entries hold references to the copies until cpuReleasePages(). Both
+	return false for a range cpuMapMemory() would refuse. */
+bool cpuSavePages(CPU *cpu, uint16_t address, uint32_t length, MemoryPage *pages);
+bool cpuLoadPages(CPU *cpu, uint16_t address, uint32_t length, const MemoryPage *pages);
+void cpuReleasePages(MemoryPage *pages, uint32_t count);
+/* Guest memory as the CPU sees it, handlers included, for hosts and
+	tools. Watchpoints don't see these. */
+uint8_t cpuReadByte(CPU *cpu, uint16_t address);
+void cpuWriteByte(CPU *cpu, uint16_t address, uint8_t value);
+/* Snapshots.
+	cpuSnapshot() records the CPU state and shares every writable page
+	with the snapshot instead of copying it: the page is only copied, 256
+	bytes at a time, when either side first stores to it. Restoring puts
+	back only the pages stored to since the CPU last took or restored the
+	same snapshot, and all pages otherwise. A snapshot can be restored into
+	any number of CPUs, on any thread, which is how machines are forked.
+	Take and restore them between runs, not from inside a handler.
+	Pages backed by the memory given to cpuInit() or by an image are shared
+	in place, so that memory has to outlive the snapshot and may only be
+	written through the CPU from then on. While any snapshot is alive,
+	host memory mapped writable is mapped copy-on-write too, in case a
+	snapshot holds it. Handler pages are shared as they
+	are; device state isn't part of a snapshot. */
+typedef struct CPUState {
+#define STATE_FIELD(name) __typeof__(((CPU *)0)->name) name;
+	CPU_STATE_FIELDS(STATE_FIELD)
+#undef STATE_FIELD
+} CPUState;
+/* Read-only once taken, so tools can read one on another thread while
+	the CPU runs on */
+typedef struct Snapshot {
+	uint64_t serial; /* unique within the process, never 0 */
+	uint8_t *memory;
+	CPUState state;
+	MemoryPage pages[MEMORY_PAGE_COUNT];
+} Snapshot;
+/* Returns NULL if out of memory */
+Snapshot *cpuSnapshot(CPU *cpu);
+void cpuRestore(CPU *cpu, const Snapshot *snapshot);
+/* cpuInit() and cpuRestore() in one, for a child machine. The child has
+	no ports or trace sink until the host attaches them. */
+void cpuFork(CPU *child, const Snapshot *snapshot);
+void snapshotFree(Snapshot *snapshot);
+/* Fills stats and returns true in -DDYNAREC builds once the CPU has run */
+struct DynarecStats;
+bool cpuDynarecStats(const CPU *cpu, struct DynarecStats *stats);
+/* Full PSW flag byte, including any lazily evaluated flags */
+uint8_t cpuFlags(const CPU *cpu);
+const char *exitReasonName(ExitReason reason);
+#endif
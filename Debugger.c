@@ -0,0 +1,284 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <inttypes.h>
+#include "Debugger.h"
+#include "TimeTravel.h"
+#include "Breakpoints.h"
+
+static void showCpu(FILE *out, const CPU *cpu, bool past)
+{
+	fprintf(out, "%scycle %" PRId64 " PC %04x SP %04x A %02x F %02x BC %02x%02x DE %02x%02x HL %02x%02x%s\n",
+		past ? "[past] " : "", cpu->cycleCount, cpu->programCounter, cpu->stackPointer, cpu->A, cpuFlags(cpu),
+		cpu->B, cpu->C, cpu->D, cpu->E, cpu->H, cpu->L, cpu->halted ? " halted" : "");
+}
+
+static void dumpMemory(FILE *out, CPU *cpu, uint16_t address, long count)
+{
+	long i;
+	for (i = 0; i < count; i++){
+		if (i % 16 == 0){
+			fprintf(out, "%s%04x:", i ? "\n" : "", (uint16_t)(address + i));
+		}
+		fprintf(out, " %02x", cpuReadByte(cpu, address + i));
+	}
+	fprintf(out, "\n");
+}
+
+static bool atAddress(const CPU *cpu, void *context)
+{
+	return cpu->programCounter == *(uint16_t *)context;
+}
+
+/* Registers and flags by the names bc takes */
+static const struct {
+	const char *name;
+	BreakRegister reg;
+	uint16_t mask;
+} registerNames[] = {
+	{ "a", BREAK_A, 0xFF }, { "b", BREAK_B, 0xFF }, { "c", BREAK_C, 0xFF }, { "d", BREAK_D, 0xFF },
+	{ "e", BREAK_E, 0xFF }, { "h", BREAK_H, 0xFF }, { "l", BREAK_L, 0xFF },
+	{ "bc", BREAK_BC, 0xFFFF }, { "de", BREAK_DE, 0xFFFF }, { "hl", BREAK_HL, 0xFFFF },
+	{ "sp", BREAK_SP, 0xFFFF }, { "pc", BREAK_PC, 0xFFFF }, { "f", BREAK_FLAGS, 0xFF },
+	{ "cy", BREAK_FLAGS, FLAG_C }, { "p", BREAK_FLAGS, FLAG_P }, { "ac", BREAK_FLAGS, FLAG_AC },
+	{ "z", BREAK_FLAGS, FLAG_Z }, { "s", BREAK_FLAGS, FLAG_S }
+};
+
+/* Single flags take and show their value as 0 or 1 */
+static bool isFlag(uint16_t mask)
+{
+	return mask != 0xFF && mask != 0xFFFF;
+}
+
+/* Parses "bc register value" */
+static int breakOnRegister(Breakpoints *breakpoints, const char *line)
+{
+	char name[8];
+	long value;
+	size_t i;
+	if (sscanf(line, "%*s %7s %li", name, &value) != 2){
+		return -1;
+	}
+	for (i = 0; i < sizeof(registerNames) / sizeof(registerNames[0]); i++){
+		if (strcmp(name, registerNames[i].name) == 0){
+			BreakCondition condition = { registerNames[i].reg, registerNames[i].mask, BREAK_EQUAL, value };
+			if (isFlag(registerNames[i].mask)){
+				condition.value = value ? registerNames[i].mask : 0;
+			}
+			return breakWhen(breakpoints, &condition);
+		}
+	}
+	return -1;
+}
+
+static const char *registerName(const BreakCondition *condition)
+{
+	size_t i;
+	for (i = 0; i < sizeof(registerNames) / sizeof(registerNames[0]); i++){
+		if (registerNames[i].reg == condition->reg && registerNames[i].mask == condition->mask){
+			return registerNames[i].name;
+		}
+	}
+	return "?";
+}
+
+static void showBreakpoints(FILE *out, const Breakpoints *breakpoints)
+{
+	int i;
+	for (i = 0; i < MAX_BREAKPOINTS; i++){
+		const Breakpoint *breakpoint = &breakpoints->list[i];
+		if (!breakpoint->used){
+			continue;
+		}
+		fprintf(out, "%d: ", i);
+		switch (breakpoint->kind)
+		{
+		case BREAK_EXECUTE:
+			fprintf(out, "at %04x\n", breakpoint->address);
+			break;
+		case BREAK_CONDITION:
+			fprintf(out, "when %s is %x\n", registerName(&breakpoint->condition), isFlag(breakpoint->condition.mask)
+				? breakpoint->condition.value != 0 : breakpoint->condition.value);
+			break;
+		case BREAK_MEMORY:
+			fprintf(out, "%s %04x, %u bytes\n", breakpoint->access == WATCH_READ ? "reads of" : "writes to",
+				breakpoint->address, breakpoint->length);
+			break;
+		case BREAK_PORT:
+			fprintf(out, "%s port %02x\n", breakpoint->access == WATCH_READ ? "IN from" : "OUT to", breakpoint->address);
+			break;
+		}
+	}
+}
+
+static void showNew(FILE *out, int id)
+{
+	if (id < 0){
+		fprintf(out, "Couldn't set the breakpoint\n");
+	}
+	else{
+		fprintf(out, "Breakpoint %d\n", id);
+	}
+}
+
+static void showHit(FILE *out, const Breakpoints *breakpoints)
+{
+	const BreakHit *hit = &breakpoints->hit;
+	if (hit->id < 0){
+		return;
+	}
+	if (hit->access == 0){
+		fprintf(out, "Breakpoint %d\n", hit->id);
+	}
+	else if (breakpoints->list[hit->id].kind == BREAK_PORT){
+		fprintf(out, "Breakpoint %d: %s %02x %s port %02x\n", hit->id, hit->access == WATCH_READ ? "IN" : "OUT",
+			hit->value, hit->access == WATCH_READ ? "from" : "to", hit->address);
+	}
+	else{
+		fprintf(out, "Breakpoint %d: %s %02x %s %04x\n", hit->id, hit->access == WATCH_READ ? "read" : "wrote",
+			hit->value, hit->access == WATCH_READ ? "from" : "to", hit->address);
+	}
+}
+
+/* Cycles left before the CPU's cycleLimit, like tick() */
+static int64_t cyclesLeft(const CPU *cpu)
+{
+	return cpu->cycleLimit ? cpu->cycleLimit - cpu->cycleCount : INT64_MAX - cpu->cycleCount;
+}
+
+bool debugRun(CPU *cpu, FILE *in, FILE *out)
+{
+	TimeTravel *travel = timeTravelCreate(cpu, DEBUG_CHECKPOINT_CYCLES, DEBUG_CHECKPOINTS);
+	Breakpoints *breakpoints = breakpointsCreate(cpu);
+	char line[256];
+	if (travel == NULL || breakpoints == NULL){
+		timeTravelFree(travel);
+		breakpointsFree(breakpoints);
+		return false;
+	}
+	showCpu(out, cpu, false);
+	for (;;){
+		char command[8];
+		long first = 1;
+		long second = 16;
+		int fields;
+		long i;
+		CPU *view = timeTravelView(travel);
+		CPU *moved = NULL;
+		ExitReason reason = EXIT_BUDGET;
+		fprintf(out, "(8080) ");
+		fflush(out);
+		if (fgets(line, sizeof(line), in) == NULL){
+			break;
+		}
+		fields = sscanf(line, "%7s %li %li", command, &first, &second);
+		if (fields < 1){
+			continue;
+		}
+		if (strcmp(command, "q") == 0){
+			break;
+		}
+		breakpoints->hit.id = -1;
+		if (strcmp(command, "s") == 0){
+			for (i = 0; i < first && reason == EXIT_BUDGET; i++){
+				if (view != NULL){
+					moved = timeTravelStep(travel);
+					if (moved == NULL){
+						fprintf(out, "At the present\n");
+						break;
+					}
+				}
+				else{
+					/* a step runs the instruction even at a breakpoint */
+					breakpointsSkip(breakpoints);
+					reason = timeTravelRun(travel, 1);
+				}
+			}
+		}
+		else if (strcmp(command, "bs") == 0){
+			for (i = 0; i < first; i++){
+				moved = timeTravelStepBack(travel);
+				if (moved == NULL){
+					fprintf(out, "No history before cycle %" PRId64 "\n", timeTravelOldest(travel));
+					break;
+				}
+			}
+		}
+		else if (strcmp(command, "rc") == 0 && fields > 1){
+			uint16_t address = first;
+			moved = timeTravelReverseContinue(travel, atAddress, &address);
+			if (moved == NULL){
+				fprintf(out, "PC wasn't %04x since cycle %" PRId64 "\n", address, timeTravelOldest(travel));
+			}
+		}
+		else if (strcmp(command, "g") == 0 && fields > 1){
+			moved = first >= 0 ? timeTravelSeek(travel, first) : NULL;
+			if (moved == NULL){
+				fprintf(out, "History goes from cycle %" PRId64 " to %" PRId64 "\n", timeTravelOldest(travel), cpu->cycleCount);
+			}
+		}
+		else if (strcmp(command, "c") == 0){
+			if (view != NULL){
+				if (fields == 1 || first >= cpu->cycleCount - view->cycleCount){
+					timeTravelLeave(travel);
+				}
+				else{
+					timeTravelSeek(travel, view->cycleCount + first);
+				}
+			}
+			else{
+				reason = timeTravelRun(travel, fields > 1 && first < cyclesLeft(cpu) ? first : cyclesLeft(cpu));
+			}
+		}
+		else if (strcmp(command, "p") == 0){
+			timeTravelLeave(travel);
+		}
+		else if (strcmp(command, "x") == 0 && fields > 1){
+			dumpMemory(out, view != NULL ? view : cpu, first, second);
+			continue;
+		}
+		else if (strcmp(command, "b") == 0 && fields > 1){
+			showNew(out, breakAt(breakpoints, first, NULL));
+			continue;
+		}
+		else if ((strcmp(command, "br") == 0 || strcmp(command, "bw") == 0) && fields > 1){
+			showNew(out, watchMemory(breakpoints, first, fields > 2 ? second : 1, command[1] == 'r' ? WATCH_READ : WATCH_WRITE));
+			continue;
+		}
+		else if ((strcmp(command, "bi") == 0 || strcmp(command, "bo") == 0) && fields > 1){
+			showNew(out, watchPort(breakpoints, first, command[1] == 'i' ? WATCH_READ : WATCH_WRITE));
+			continue;
+		}
+		else if (strcmp(command, "bc") == 0){
+			showNew(out, breakOnRegister(breakpoints, line));
+			continue;
+		}
+		else if (strcmp(command, "d") == 0 && fields > 1){
+			if (!breakpointRemove(breakpoints, first)){
+				fprintf(out, "No breakpoint %ld\n", first);
+			}
+			continue;
+		}
+		else if (strcmp(command, "i") == 0){
+			showBreakpoints(out, breakpoints);
+			continue;
+		}
+		else if (strcmp(command, "r") != 0){
+			fprintf(out, "Commands: s [n], bs [n], rc address, g cycle, c [cycles], p, r, x address [n],\n"
+				"b address, br|bw address [n], bi|bo port, bc register value, i, d id, q\n");
+			continue;
+		}
+		if (reason != EXIT_BUDGET){
+			fprintf(out, "Stopped: %s\n", exitReasonName(reason));
+		}
+		if (reason == EXIT_BREAKPOINT){
+			showHit(out, breakpoints);
+		}
+		view = timeTravelView(travel);
+		showCpu(out, view != NULL ? view : cpu, view != NULL);
+	}
+	breakpointsFree(breakpoints);
+	timeTravelFree(travel);
+	return true;
+}
@@ -0,0 +1,34 @@
+#ifndef DEBUGGER_H
+#define DEBUGGER_H
+#include <stdio.h>
+#include "Core.h"
+/* Guest level debugger.
+	Reads commands from in and runs cpu under a time traveller (see
+	TimeTravel.h), so it can go backwards as well as forwards:
+		s [n]          step n instructions
+		bs [n]         step n instructions back
+		rc address     reverse-continue to the last time PC was address
+		g cycle        go to the instruction boundary at or after cycle
+		c [cycles]     continue, up to the present when looking at the past
+		p              back to the present
+		r              registers
+		x address [n]  dump n bytes of memory
+		b address      break at address
+		br address [n] break after a load from n bytes at address
+		bw address [n] break after a store to them
+		bi port        break after IN from port
+		bo port        break after OUT to port
+		bc reg value   break when a register (a-l, bc, de, hl, sp, pc, f)
+		               or flag (cy, p, ac, z, s) has the value
+		i              list breakpoints
+		d id           delete a breakpoint
+		q              quit
+	Numbers are in C notation. The past is kept for DEBUG_CHECKPOINTS
+	checkpoints of DEBUG_CHECKPOINT_CYCLES each. Breakpoints stop the
+	present CPU as it runs on; s and c in the past only replay it. */
+#define DEBUG_CHECKPOINT_CYCLES 100000
+#define DEBUG_CHECKPOINTS 64
+
+/* Returns false if the time traveller couldn't be set up */
+bool debugRun(CPU *cpu, FILE *in, FILE *out);
+#endif
@@ -0,0 +1,883 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+#include "Core.h"
+#include "Dynarec.h"
+#include "Timing.h"
+#ifdef DYNAREC
+#include <sys/mman.h>
+/* Code generation.
+	Register use inside native code:
+	r8d..r14d : guest A B C D E H L, zero extended
+	ebx       : guest flag byte in PSW layout
+	rdi       : the CPU
+	rsi       : the CPU's readPages
+	r15       : szpTable
+	eax ecx edx ebp : scratch
+	[rsp]     : cycleCount at which to go back to run()
+	The entry stub loads the pinned registers and the exit stub stores
+	them back, blocks in between only ever jump to each other. Loads look
+	up the page on every access; a handler page bails out to the
+	interpreter before the instruction changes anything.
+	Cycles are charged from Timing.h, like the interpreter does. */
+enum {
+	RAX, RCX, RDX, RBX, RSP, RBP, RSI, RDI,
+	R8, R9, R10, R11, R12, R13, R14, R15
+};
+#define NO_INDEX -1
+#define HOST_A R8
+#define HOST_FLAGS RBX
+/* Indexed by the 8080 register field B C D E H L M A */
+static const int hostRegister[8] = { R9, R10, R11, R12, R13, R14, -1, R8 };
+static const size_t guestOffset[8] = {
+	offsetof(CPU, B), offsetof(CPU, C), offsetof(CPU, D), offsetof(CPU, E),
+	offsetof(CPU, H), offsetof(CPU, L), 0, offsetof(CPU, A)
+};
+/* 8080 condition field NZ Z NC C PO PE P M, taken on a set bit when odd */
+static const uint8_t conditionFlag[8] = { FLAG_Z, FLAG_Z, FLAG_C, FLAG_C, FLAG_P, FLAG_P, FLAG_S, FLAG_S };
+/* x86 opcodes and /digit extensions used below */
+enum {
+	X86_ADD = 0x01, X86_OR = 0x09, X86_AND = 0x21, X86_SUB = 0x29, X86_XOR = 0x31, X86_CMP = 0x39
+};
+enum {
+	DIGIT_ADD = 0, DIGIT_OR = 1, DIGIT_AND = 4, DIGIT_SUB = 5, DIGIT_XOR = 6, DIGIT_CMP = 7
+};
+enum {
+	SHIFT_SHL = 4, SHIFT_SHR = 5
+};
+enum {
+	CC_E = 0x4, CC_NE = 0x5, CC_GE = 0xD
+};
+
+struct Dynarec {
+	uint8_t *code;
+	size_t used;
+	size_t size;
+	size_t firstBlock; /* code before this is the entry and exit stubs */
+	uint8_t *exitStub;
+	void (*enter)(CPU *cpu, void *entry, int64_t stop);
+	const uint8_t *szpTable;
+	const uint8_t *acAddTable;
+	const uint8_t *acSubTable;
+	/* The instruction being emitted, for emitBail() */
+	uint16_t instructionPc;
+	uint32_t instructionCycles;
+	bool bailed; /* set by native code on the way out */
+	void *entries[65536];
+	uint8_t pageInvalidations[256];
+	DynarecStats stats;
+};
+
+static void emit8(Dynarec *dr, uint8_t byte)
+{
+	/* Running off the end is caught once the block is finished */
+	if (dr->used < dr->size){
+		dr->code[dr->used] = byte;
+	}
+	dr->used++;
+}
+static void emit16(Dynarec *dr, uint16_t value)
+{
+	emit8(dr, value & 0xFF);
+	emit8(dr, value >> 8);
+}
+static void emit32(Dynarec *dr, uint32_t value)
+{
+	emit16(dr, value & 0xFFFF);
+	emit16(dr, value >> 16);
+}
+static void emit64(Dynarec *dr, uint64_t value)
+{
+	emit32(dr, value & 0xFFFFFFFF);
+	emit32(dr, value >> 32);
+}
+static void emitOpcode(Dynarec *dr, uint16_t opcode)
+{
+	if (opcode > 0xFF){
+		emit8(dr, opcode >> 8);
+	}
+	emit8(dr, opcode & 0xFF);
+}
+/* byteRegister asks for a REX prefix so 4..7 mean spl..dil, not ah..bh */
+static void emitRex(Dynarec *dr, bool wide, int reg, int index, int base, bool byteRegister)
+{
+	uint8_t rex = 0x40;
+	if (wide){
+		rex |= 0x08;
+	}
+	rex |= (reg & 8) >> 1;
+	if (index != NO_INDEX){
+		rex |= (index & 8) >> 2;
+	}
+	rex |= (base & 8) >> 3;
+	if (rex != 0x40 || (byteRegister && reg >= RSP && reg <= RDI)){
+		emit8(dr, rex);
+	}
+}
+/* ModRM, SIB and displacement for [base + index * (1 << scale) + disp] */
+static void emitAddress(Dynarec *dr, int reg, int base, int index, int scale, int32_t disp)
+{
+	int mod = 2;
+	if (disp == 0 && (base & 7) != RBP){
+		mod = 0;
+	}
+	else if (disp >= -128 && disp <= 127){
+		mod = 1;
+	}
+	if (index == NO_INDEX && (base & 7) != RSP){
+		emit8(dr, (mod << 6) | ((reg & 7) << 3) | (base & 7));
+	}
+	else{
+		emit8(dr, (mod << 6) | ((reg & 7) << 3) | RSP);
+		emit8(dr, (scale << 6) | (((index == NO_INDEX ? RSP : index) & 7) << 3) | (base & 7));
+	}
+	if (mod == 1){
+		emit8(dr, (uint8_t)disp);
+	}
+	else if (mod == 2){
+		emit32(dr, (uint32_t)disp);
+	}
+}
+/* opcode reg, [base + index * (1 << scale) + disp], prefix 0 for none */
+static void emitMemOp(Dynarec *dr, uint8_t prefix, bool wide, uint16_t opcode, int reg, int base, int index, int scale, int32_t disp)
+{
+	if (prefix != 0){
+		emit8(dr, prefix);
+	}
+	emitRex(dr, wide, reg, index, base, opcode == 0x88);
+	emitOpcode(dr, opcode);
+	emitAddress(dr, reg, base, index, scale, disp);
+}
+/* Register to register form, reg goes in ModRM.reg and rm in ModRM.rm */
+static void emitRegOp(Dynarec *dr, bool wide, uint16_t opcode, int reg, int rm)
+{
+	emitRex(dr, wide, reg, NO_INDEX, rm, false);
+	emitOpcode(dr, opcode);
+	emit8(dr, 0xC0 | ((reg & 7) << 3) | (rm & 7));
+}
+static void emitMov(Dynarec *dr, int dst, int src)
+{
+	emitRegOp(dr, false, 0x89, src, dst);
+}
+static void emitAlu(Dynarec *dr, uint8_t opcode, int dst, int src)
+{
+	emitRegOp(dr, false, opcode, src, dst);
+}
+static void emitAluImm(Dynarec *dr, bool wide, int digit, int dst, uint32_t imm)
+{
+	emitRegOp(dr, wide, 0x81, digit, dst);
+	emit32(dr, imm);
+}
+static void emitShift(Dynarec *dr, int digit, int dst, uint8_t count)
+{
+	emitRegOp(dr, false, 0xC1, digit, dst);
+	emit8(dr, count);
+}
+static void emitMovImm(Dynarec *dr, int dst, uint32_t imm)
+{
+	emitRex(dr, false, 0, NO_INDEX, dst, false);
+	emit8(dr, 0xB8 | (dst & 7));
+	emit32(dr, imm);
+}
+static void emitMovImm64(Dynarec *dr, int dst, const void *pointer)
+{
+	emitRex(dr, true, 0, NO_INDEX, dst, false);
+	emit8(dr, 0xB8 | (dst & 7));
+	emit64(dr, (uint64_t)(uintptr_t)pointer);
+}
+/* dst = zero extended low byte of src, src being one of al cl dl bl or r8b+ */
+static void emitMovzxByte(Dynarec *dr, int dst, int src)
+{
+	emitRegOp(dr, false, 0x0FB6, dst, src);
+}
+static void emitLoadCPU8(Dynarec *dr, int dst, size_t offset)
+{
+	emitMemOp(dr, 0, false, 0x0FB6, dst, RDI, NO_INDEX, 0, offset);
+}
+static void emitStoreCPU8(Dynarec *dr, size_t offset, int src)
+{
+	emitMemOp(dr, 0, false, 0x88, src, RDI, NO_INDEX, 0, offset);
+}
+static void emitLoadCPU16(Dynarec *dr, int dst, size_t offset)
+{
+	emitMemOp(dr, 0, false, 0x0FB7, dst, RDI, NO_INDEX, 0, offset);
+}
+static void emitStoreCPU16(Dynarec *dr, size_t offset, int src)
+{
+	emitMemOp(dr, 0x66, false, 0x89, src, RDI, NO_INDEX, 0, offset);
+}
+static void emitStoreCPU16Imm(Dynarec *dr, size_t offset, uint16_t imm)
+{
+	emitMemOp(dr, 0x66, false, 0xC7, 0, RDI, NO_INDEX, 0, offset);
+	emit16(dr, imm);
+}
+static void emitAddCPU16Imm(Dynarec *dr, size_t offset, uint16_t imm)
+{
+	emitMemOp(dr, 0x66, false, 0x81, DIGIT_ADD, RDI, NO_INDEX, 0, offset);
+	emit16(dr, imm);
+}
+static void emitTestImm(Dynarec *dr, int reg, uint32_t imm)
+{
+	emitRegOp(dr, false, 0xF7, 0, reg);
+	emit32(dr, imm);
+}
+static void emitSetcc(Dynarec *dr, int cc, int dst)
+{
+	emitRegOp(dr, false, 0x0F90 | cc, 0, dst);
+}
+/* Returns where the rel32 goes, for patchJump() */
+static size_t emitJcc(Dynarec *dr, int cc)
+{
+	emitOpcode(dr, 0x0F80 | cc);
+	emit32(dr, 0);
+	return dr->used - 4;
+}
+static void patchJump(Dynarec *dr, size_t at)
+{
+	uint32_t rel = (uint32_t)(dr->used - (at + 4));
+	if (at + 4 <= dr->size){
+		memcpy(dr->code + at, &rel, 4);
+	}
+}
+static void emitJccTo(Dynarec *dr, int cc, const uint8_t *target)
+{
+	emitOpcode(dr, 0x0F80 | cc);
+	emit32(dr, (uint32_t)(target - (dr->code + dr->used + 4)));
+}
+static void emitJmpTo(Dynarec *dr, const uint8_t *target)
+{
+	emit8(dr, 0xE9);
+	emit32(dr, (uint32_t)(target - (dr->code + dr->used + 4)));
+}
+/* Leaves native code in front of the current instruction and has the
+	interpreter run it, for loads from handler pages */
+static void emitBail(Dynarec *dr)
+{
+	emitStoreCPU16Imm(dr, offsetof(CPU, programCounter), dr->instructionPc);
+	emitMemOp(dr, 0, true, 0x81, DIGIT_ADD, RDI, NO_INDEX, 0, offsetof(CPU, cycleCount));
+	emit32(dr, dr->instructionCycles);
+	emitMovImm64(dr, RDX, &dr->bailed);
+	emitMemOp(dr, 0, false, 0xC6, 0, RDX, NO_INDEX, 0, 0);
+	emit8(dr, 1);
+	emitJmpTo(dr, dr->exitStub);
+}
+/* rbp = host page behind the guest page at [rsi + disp], bails if NULL */
+static void emitPageCheck(Dynarec *dr, int index, int32_t disp)
+{
+	size_t direct;
+	emitMemOp(dr, 0, true, 0x8B, RBP, RSI, index, 3, disp);
+	emitRegOp(dr, true, 0x85, RBP, RBP);
+	direct = emitJcc(dr, CC_NE);
+	emitBail(dr);
+	patchJump(dr, direct);
+}
+/* dst = guest memory[address register], address being eax.
+	Pages are 256 bytes, so the offset into one is the low byte. */
+static void emitLoadGuest(Dynarec *dr, int dst, int address)
+{
+	emitMov(dr, RBP, address);
+	emitShift(dr, SHIFT_SHR, RBP, MEMORY_PAGE_SHIFT);
+	emitPageCheck(dr, RBP, 0);
+	emitMovzxByte(dr, dst, address);
+	emitMemOp(dr, 0, false, 0x0FB6, dst, RBP, dst, 0, 0);
+}
+/* dst = guest memory[address] for an address known at compile time */
+static void emitLoadGuestAt(Dynarec *dr, int dst, uint16_t address)
+{
+	emitPageCheck(dr, NO_INDEX, (address >> MEMORY_PAGE_SHIFT) * 8);
+	emitMemOp(dr, 0, false, 0x0FB6, dst, RBP, NO_INDEX, 0, address & (MEMORY_PAGE_SIZE - 1));
+}
+static void emitPush(Dynarec *dr, int reg)
+{
+	emitRex(dr, false, 0, NO_INDEX, reg, false);
+	emit8(dr, 0x50 | (reg & 7));
+}
+static void emitPop(Dynarec *dr, int reg)
+{
+	emitRex(dr, false, 0, NO_INDEX, reg, false);
+	emit8(dr, 0x58 | (reg & 7));
+}
+
+/* dst = register pair B, D, H or SP by the 8080 pair field */
+static void emitLoadPair(Dynarec *dr, int pair, int dst)
+{
+	if (pair == 3){
+		emitLoadCPU16(dr, dst, offsetof(CPU, stackPointer));
+		return;
+	}
+	emitMov(dr, dst, hostRegister[pair * 2]);
+	emitShift(dr, SHIFT_SHL, dst, 8);
+	emitAlu(dr, X86_OR, dst, hostRegister[pair * 2 + 1]);
+}
+/* Splits the low 16 bits of src into a pair, src is clobbered */
+static void emitStorePair(Dynarec *dr, int pair, int src)
+{
+	int hi = hostRegister[pair * 2];
+	int lo = hostRegister[pair * 2 + 1];
+	if (pair == 3){
+		emitStoreCPU16(dr, offsetof(CPU, stackPointer), src);
+		return;
+	}
+	emitMov(dr, lo, src);
+	emitAluImm(dr, false, DIGIT_AND, lo, 0xFF);
+	emitShift(dr, SHIFT_SHR, src, 8);
+	emitAluImm(dr, false, DIGIT_AND, src, 0xFF);
+	emitMov(dr, hi, src);
+}
+/* ecx = low byte from the stack, edx = high byte, SP += 2 */
+static void emitPopBytes(Dynarec *dr)
+{
+	emitLoadCPU16(dr, RAX, offsetof(CPU, stackPointer));
+	emitLoadGuest(dr, RCX, RAX);
+	emitAluImm(dr, false, DIGIT_ADD, RAX, 1);
+	emitAluImm(dr, false, DIGIT_AND, RAX, 0xFFFF);
+	emitLoadGuest(dr, RDX, RAX);
+	emitAddCPU16Imm(dr, offsetof(CPU, stackPointer), 2);
+}
+/* ecx = ALU operand by the 8080 register field */
+static void emitOperand(Dynarec *dr, int source)
+{
+	if (source == 6){
+		emitLoadPair(dr, 2, RAX);
+		emitLoadGuest(dr, RCX, RAX);
+	}
+	else{
+		emitMov(dr, RCX, hostRegister[source]);
+	}
+}
+/* ADD ADC SUB SBB ANA XRA ORA CMP on A and ecx, by the 8080 ALU field */
+static void emitArith(Dynarec *dr, int operation)
+{
+	bool subtract = operation == 2 || operation == 3 || operation == 7;
+	switch (operation)
+	{
+	case 4:
+		/*ANA, AC is the OR of bit 3 of both operands*/
+		emitMov(dr, RDX, HOST_A);
+		emitAlu(dr, X86_OR, RDX, RCX);
+		emitAluImm(dr, false, DIGIT_AND, RDX, 0x08);
+		emitShift(dr, SHIFT_SHL, RDX, 1);
+		emitAlu(dr, X86_AND, HOST_A, RCX);
+		emitMemOp(dr, 0, false, 0x0FB6, HOST_FLAGS, R15, HOST_A, 0, 0);
+		emitAlu(dr, X86_OR, HOST_FLAGS, RDX);
+		return;
+	case 5:
+	case 6:
+		emitAlu(dr, operation == 5 ? X86_XOR : X86_OR, HOST_A, RCX);
+		emitMemOp(dr, 0, false, 0x0FB6, HOST_FLAGS, R15, HOST_A, 0, 0);
+		return;
+	}
+	/* eax = A +/- operand (+/- carry), bit 8 ends up as the carry */
+	emitMov(dr, RAX, HOST_A);
+	emitAlu(dr, subtract ? X86_SUB : X86_ADD, RAX, RCX);
+	if (operation == 1 || operation == 3){
+		emitMov(dr, RDX, HOST_FLAGS);
+		emitAluImm(dr, false, DIGIT_AND, RDX, FLAG_C);
+		emitAlu(dr, operation == 1 ? X86_ADD : X86_SUB, RAX, RDX);
+	}
+	/* AC table index from bit 3 of A, the operand and the result */
+	emitMov(dr, RDX, HOST_A);
+	emitShift(dr, SHIFT_SHR, RDX, 1);
+	emitAluImm(dr, false, DIGIT_AND, RDX, 0x04);
+	emitMov(dr, RBP, RCX);
+	emitShift(dr, SHIFT_SHR, RBP, 2);
+	emitAluImm(dr, false, DIGIT_AND, RBP, 0x02);
+	emitAlu(dr, X86_OR, RDX, RBP);
+	emitMov(dr, RBP, RAX);
+	emitShift(dr, SHIFT_SHR, RBP, 3);
+	emitAluImm(dr, false, DIGIT_AND, RBP, 0x01);
+	emitAlu(dr, X86_OR, RDX, RBP);
+	emitMovImm64(dr, RBP, subtract ? dr->acSubTable : dr->acAddTable);
+	emitMemOp(dr, 0, false, 0x0FB6, HOST_FLAGS, RBP, RDX, 0, 0);
+	emitMovzxByte(dr, RDX, RAX);
+	emitMemOp(dr, 0, false, 0x0FB6, RDX, R15, RDX, 0, 0);
+	emitAlu(dr, X86_OR, HOST_FLAGS, RDX);
+	emitMov(dr, RDX, RAX);
+	emitShift(dr, SHIFT_SHR, RDX, 8);
+	emitAluImm(dr, false, DIGIT_AND, RDX, FLAG_C);
+	emitAlu(dr, X86_OR, HOST_FLAGS, RDX);
+	if (operation != 7){
+		emitMovzxByte(dr, HOST_A, RAX);
+	}
+}
+/* INR/DCR on a register, the carry is left alone */
+static void emitIncDec(Dynarec *dr, int reg, bool increment)
+{
+	emitAluImm(dr, false, increment ? DIGIT_ADD : DIGIT_SUB, reg, 1);
+	emitAluImm(dr, false, DIGIT_AND, reg, 0xFF);
+	emitAluImm(dr, false, DIGIT_AND, HOST_FLAGS, FLAG_C);
+	emitMemOp(dr, 0, false, 0x0FB6, RDX, R15, reg, 0, 0);
+	emitAlu(dr, X86_OR, HOST_FLAGS, RDX);
+	/* AC when the low nibble wrapped */
+	emitMov(dr, RDX, reg);
+	emitAluImm(dr, false, DIGIT_AND, RDX, 0x0F);
+	emitAluImm(dr, false, DIGIT_CMP, RDX, increment ? 0x00 : 0x0F);
+	emitSetcc(dr, increment ? CC_E : CC_NE, RDX);
+	emitMovzxByte(dr, RDX, RDX);
+	emitShift(dr, SHIFT_SHL, RDX, 4);
+	emitAlu(dr, X86_OR, HOST_FLAGS, RDX);
+}
+/* Replaces the carry flag with bit 0 of src */
+static void emitSetCarry(Dynarec *dr, int src)
+{
+	emitAluImm(dr, false, DIGIT_AND, HOST_FLAGS, (uint8_t)~FLAG_C);
+	emitAlu(dr, X86_OR, HOST_FLAGS, src);
+}
+/* Leaves the block for target, or for the address in eax when target is
+	negative. Goes straight on to the next native block if there is one
+	and the budget allows, back to run() otherwise. */
+static void emitExit(Dynarec *dr, int32_t target, uint32_t cycles)
+{
+	if (target >= 0){
+		emitMovImm(dr, RAX, target);
+	}
+	emitStoreCPU16(dr, offsetof(CPU, programCounter), RAX);
+	emitMemOp(dr, 0, true, 0x81, DIGIT_ADD, RDI, NO_INDEX, 0, offsetof(CPU, cycleCount));
+	emit32(dr, cycles);
+	emitMemOp(dr, 0, true, 0x8B, RDX, RDI, NO_INDEX, 0, offsetof(CPU, cycleCount));
+	emitMemOp(dr, 0, true, 0x3B, RDX, RSP, NO_INDEX, 0, 0);
+	emitJccTo(dr, CC_GE, dr->exitStub);
+	emitMovImm64(dr, RDX, dr->entries);
+	emitMemOp(dr, 0, true, 0x8B, RDX, RDX, RAX, 3, 0);
+	emitRegOp(dr, true, 0x85, RDX, RDX);
+	emitJccTo(dr, CC_E, dr->exitStub);
+	/* jmp rdx */
+	emitRegOp(dr, false, 0xFF, 4, RDX);
+}
+
+/* Instructions the compiler handles: everything that neither stores to
+	memory, does I/O, touches interrupts nor halts */
+static bool compilable(uint8_t opcode)
+{
+	if (opcode >= 0x40 && opcode <= 0x7F){
+		return opcode < 0x70 || opcode > 0x77;
+	}
+	if (opcode >= 0x80 && opcode <= 0xBF){
+		return true;
+	}
+	switch (opcode)
+	{
+	case 0x02: case 0x12: case 0x22: case 0x32: /*STAX SHLD STA*/
+	case 0x27: case 0x30: /*DAA, the dump opcode*/
+	case 0x34: case 0x35: case 0x36: /*INR M DCR M MVI M*/
+	case 0x08: case 0x18:
+	case 0xD3: case 0xDB: case 0xE3: case 0xF3: case 0xFB: /*OUT IN XTHL DI EI*/
+	case 0xCD: case 0xDD: case 0xED: case 0xFD: /*CALL*/
+		return false;
+	}
+	if (opcode >= 0xC0){
+		switch (opcode & 0x07)
+		{
+		case 0x04: /*Ccc*/
+		case 0x05: /*PUSH*/
+		case 0x07: /*RST*/
+			return false;
+		}
+	}
+	return true;
+}
+
+/* Returns true when op ended the block */
+static bool emitInstruction(Dynarec *dr, const DecodedOp *op, uint16_t pc, uint32_t *cycles)
+{
+	uint8_t opcode = op->opcode;
+	int dst = (opcode >> 3) & 7;
+	int src = opcode & 7;
+	int pair = (opcode >> 4) & 3;
+	uint16_t next = pc + op->length;
+	size_t skip;
+	dr->instructionPc = pc;
+	dr->instructionCycles = *cycles;
+	if (opcode >= 0x40 && opcode <= 0x7F){
+		/*MOV*/
+		if (src == 6){
+			emitLoadPair(dr, 2, RAX);
+			emitLoadGuest(dr, hostRegister[dst], RAX);
+		}
+		else if (dst != src){
+			emitMov(dr, hostRegister[dst], hostRegister[src]);
+		}
+		*cycles += opcodeCycles[opcode];
+		return false;
+	}
+	if (opcode >= 0x80 && opcode <= 0xBF){
+		emitOperand(dr, src);
+		emitArith(dr, dst);
+		*cycles += opcodeCycles[opcode];
+		return false;
+	}
+	switch (opcode)
+	{
+	case 0x00: case 0x10: case 0x20: case 0x28: case 0x38:
+		/*NOP*/
+		*cycles += opcodeCycles[opcode];
+		return false;
+	case 0x01: case 0x11: case 0x21: case 0x31:
+		/*LXI*/
+		if (pair == 3){
+			emitStoreCPU16Imm(dr, offsetof(CPU, stackPointer), op->operand);
+		}
+		else{
+			emitMovImm(dr, hostRegister[pair * 2], op->operand >> 8);
+			emitMovImm(dr, hostRegister[pair * 2 + 1], op->operand & 0xFF);
+		}
+		*cycles += opcodeCycles[opcode];
+		return false;
+	case 0x03: case 0x13: case 0x23: case 0x33:
+	case 0x0B: case 0x1B: case 0x2B: case 0x3B:
+		/*INX DCX*/
+		if (pair == 3){
+			emitAddCPU16Imm(dr, offsetof(CPU, stackPointer), (opcode & 0x08) ? 0xFFFF : 1);
+		}
+		else{
+			emitLoadPair(dr, pair, RAX);
+			emitAluImm(dr, false, (opcode & 0x08) ? DIGIT_SUB : DIGIT_ADD, RAX, 1);
+			emitStorePair(dr, pair, RAX);
+		}
+		*cycles += opcodeCycles[opcode];
+		return false;
+	case 0x04: case 0x0C: case 0x14: case 0x1C: case 0x24: case 0x2C: case 0x3C:
+	case 0x05: case 0x0D: case 0x15: case 0x1D: case 0x25: case 0x2D: case 0x3D:
+		/*INR DCR*/
+		emitIncDec(dr, hostRegister[dst], src == 4);
+		*cycles += opcodeCycles[opcode];
+		return false;
+	case 0x06: case 0x0E: case 0x16: case 0x1E: case 0x26: case 0x2E: case 0x3E:
+		/*MVI*/
+		emitMovImm(dr, hostRegister[dst], op->operand & 0xFF);
+		*cycles += opcodeCycles[opcode];
+		return false;
+	case 0x07:
+		/*RLC*/
+		emitMov(dr, RDX, HOST_A);
+		emitShift(dr, SHIFT_SHR, RDX, 7);
+		emitSetCarry(dr, RDX);
+		emitShift(dr, SHIFT_SHL, HOST_A, 1);
+		emitAlu(dr, X86_OR, HOST_A, RDX);
+		emitAluImm(dr, false, DIGIT_AND, HOST_A, 0xFF);
+		*cycles += opcodeCycles[opcode];
+		return false;
+	case 0x0F:
+		/*RRC*/
+		emitMov(dr, RDX, HOST_A);
+		emitAluImm(dr, false, DIGIT_AND, RDX, 0x01);
+		emitSetCarry(dr, RDX);
+		emitShift(dr, SHIFT_SHR, HOST_A, 1);
+		emitShift(dr, SHIFT_SHL, RDX, 7);
+		emitAlu(dr, X86_OR, HOST_A, RDX);
+		*cycles += opcodeCycles[opcode];
+		return false;
+	case 0x17:
+		/*RAL*/
+		emitMov(dr, RDX, HOST_FLAGS);
+		emitAluImm(dr, false, DIGIT_AND, RDX, FLAG_C);
+		emitMov(dr, RCX, HOST_A);
+		emitShift(dr, SHIFT_SHR, RCX, 7);
+		emitSetCarry(dr, RCX);
+		emitShift(dr, SHIFT_SHL, HOST_A, 1);
+		emitAlu(dr, X86_OR, HOST_A, RDX);
+		emitAluImm(dr, false, DIGIT_AND, HOST_A, 0xFF);
+		*cycles += opcodeCycles[opcode];
+		return false;
+	case 0x1F:
+		/*RAR*/
+		emitMov(dr, RDX, HOST_FLAGS);
+		emitAluImm(dr, false, DIGIT_AND, RDX, FLAG_C);
+		emitShift(dr, SHIFT_SHL, RDX, 7);
+		emitMov(dr, RCX, HOST_A);
+		emitAluImm(dr, false, DIGIT_AND, RCX, 0x01);
+		emitSetCarry(dr, RCX);
+		emitShift(dr, SHIFT_SHR, HOST_A, 1);
+		emitAlu(dr, X86_OR, HOST_A, RDX);
+		*cycles += opcodeCycles[opcode];
+		return false;
+	case 0x09: case 0x19: case 0x29: case 0x39:
+		/*DAD*/
+		emitLoadPair(dr, 2, RAX);
+		emitLoadPair(dr, pair, RCX);
+		emitAlu(dr, X86_ADD, RAX, RCX);
+		emitMov(dr, RDX, RAX);
+		emitShift(dr, SHIFT_SHR, RDX, 16);
+		emitSetCarry(dr, RDX);
+		emitStorePair(dr, 2, RAX);
+		*cycles += opcodeCycles[opcode];
+		return false;
+	case 0x0A: case 0x1A:
+		/*LDAX*/
+		emitLoadPair(dr, pair, RAX);
+		emitLoadGuest(dr, HOST_A, RAX);
+		*cycles += opcodeCycles[opcode];
+		return false;
+	case 0x2A:
+		/*LHLD, both loads before either register changes*/
+		emitLoadGuestAt(dr, RCX, op->operand);
+		emitLoadGuestAt(dr, RDX, op->operand + 1);
+		emitMov(dr, hostRegister[5], RCX);
+		emitMov(dr, hostRegister[4], RDX);
+		*cycles += opcodeCycles[opcode];
+		return false;
+	case 0x3A:
+		/*LDA*/
+		emitLoadGuestAt(dr, HOST_A, op->operand);
+		*cycles += opcodeCycles[opcode];
+		return false;
+	case 0x2F:
+		/*CMA*/
+		emitAluImm(dr, false, DIGIT_XOR, HOST_A, 0xFF);
+		*cycles += opcodeCycles[opcode];
+		return false;
+	case 0x37:
+		/*STC*/
+		emitAluImm(dr, false, DIGIT_OR, HOST_FLAGS, FLAG_C);
+		*cycles += opcodeCycles[opcode];
+		return false;
+	case 0x3F:
+		/*CMC*/
+		emitAluImm(dr, false, DIGIT_XOR, HOST_FLAGS, FLAG_C);
+		*cycles += opcodeCycles[opcode];
+		return false;
+	case 0xC6: case 0xCE: case 0xD6: case 0xDE: case 0xE6: case 0xEE: case 0xF6: case 0xFE:
+		/*ALU immediate*/
+		emitMovImm(dr, RCX, op->operand & 0xFF);
+		emitArith(dr, dst);
+		*cycles += opcodeCycles[opcode];
+		return false;
+	case 0xC1: case 0xD1: case 0xE1: case 0xF1:
+		/*POP*/
+		emitPopBytes(dr);
+		if (pair == 3){
+			emitMov(dr, HOST_FLAGS, RCX);
+			emitAluImm(dr, false, DIGIT_AND, HOST_FLAGS, FLAG_MASK);
+			emitAluImm(dr, false, DIGIT_OR, HOST_FLAGS, FLAG_ALWAYS_ONE);
+			emitMov(dr, HOST_A, RDX);
+		}
+		else{
+			emitMov(dr, hostRegister[pair * 2 + 1], RCX);
+			emitMov(dr, hostRegister[pair * 2], RDX);
+		}
+		*cycles += opcodeCycles[opcode];
+		return false;
+	case 0xEB:
+		/*XCHG*/
+		emitMov(dr, RAX, hostRegister[2]);
+		emitMov(dr, hostRegister[2], hostRegister[4]);
+		emitMov(dr, hostRegister[4], RAX);
+		emitMov(dr, RAX, hostRegister[3]);
+		emitMov(dr, hostRegister[3], hostRegister[5]);
+		emitMov(dr, hostRegister[5], RAX);
+		*cycles += opcodeCycles[opcode];
+		return false;
+	case 0xF9:
+		/*SPHL*/
+		emitLoadPair(dr, 2, RAX);
+		emitStoreCPU16(dr, offsetof(CPU, stackPointer), RAX);
+		*cycles += opcodeCycles[opcode];
+		return false;
+	case 0xC3: case 0xCB:
+		/*JMP*/
+		emitExit(dr, op->operand, *cycles + opcodeCycles[opcode]);
+		return true;
+	case 0xC9: case 0xD9:
+		/*RET*/
+		emitPopBytes(dr);
+		emitShift(dr, SHIFT_SHL, RDX, 8);
+		emitAlu(dr, X86_OR, RCX, RDX);
+		emitMov(dr, RAX, RCX);
+		emitExit(dr, -1, *cycles + opcodeCycles[opcode]);
+		return true;
+	case 0xE9:
+		/*PCHL*/
+		emitLoadPair(dr, 2, RAX);
+		emitExit(dr, -1, *cycles + opcodeCycles[opcode]);
+		return true;
+	}
+	emitTestImm(dr, HOST_FLAGS, conditionFlag[dst]);
+	/* skip the taken path when the condition fails */
+	skip = emitJcc(dr, (dst & 1) ? CC_E : CC_NE);
+	if (src == 2){
+		/*Jcc*/
+		emitExit(dr, op->operand, *cycles + opcodeCycles[opcode]);
+		patchJump(dr, skip);
+		emitExit(dr, next, *cycles + opcodeCycles[opcode]);
+	}
+	else{
+		/*Rcc*/
+		emitPopBytes(dr);
+		emitShift(dr, SHIFT_SHL, RDX, 8);
+		emitAlu(dr, X86_OR, RCX, RDX);
+		emitMov(dr, RAX, RCX);
+		emitExit(dr, -1, *cycles + opcodeCycles[opcode] + RETURN_TAKEN_CYCLES);
+		patchJump(dr, skip);
+		emitExit(dr, next, *cycles + opcodeCycles[opcode]);
+	}
+	return true;
+}
+
+/* Returns NULL if the code cache ran out */
+static void *emitBlock(Dynarec *dr, uint16_t start, const DecodedOp *ops, int count)
+{
+	size_t begin = dr->used;
+	uint32_t cycles = 0;
+	uint16_t pc = start;
+	bool ended = false;
+	int i;
+	for (i = 0; i < count && !ended; i++){
+		ended = emitInstruction(dr, &ops[i], pc, &cycles);
+		pc += ops[i].length;
+	}
+	if (!ended){
+		emitExit(dr, pc, cycles);
+	}
+	if (dr->used > dr->size){
+		dr->used = begin;
+		return NULL;
+	}
+	return dr->code + begin;
+}
+
+static void emitStubs(Dynarec *dr)
+{
+	static const int saved[6] = { RBX, RBP, R12, R13, R14, R15 };
+	int i;
+	/* enter(cpu, entry, stop) */
+	for (i = 0; i < 6; i++){
+		emitPush(dr, saved[i]);
+	}
+	emitAluImm(dr, true, DIGIT_SUB, RSP, 8);
+	emitMemOp(dr, 0, true, 0x89, RDX, RSP, NO_INDEX, 0, 0);
+	emitRegOp(dr, true, 0x89, RSI, RAX);
+	emitMemOp(dr, 0, true, 0x8D, RSI, RDI, NO_INDEX, 0, offsetof(CPU, readPages));
+	emitMovImm64(dr, R15, dr->szpTable);
+	for (i = 0; i < 8; i++){
+		if (i != 6){
+			emitLoadCPU8(dr, hostRegister[i], guestOffset[i]);
+		}
+	}
+	emitLoadCPU8(dr, HOST_FLAGS, offsetof(CPU, flags));
+	/* jmp rax */
+	emitRegOp(dr, false, 0xFF, 4, RAX);
+	dr->exitStub = dr->code + dr->used;
+	for (i = 0; i < 8; i++){
+		if (i != 6){
+			emitStoreCPU8(dr, guestOffset[i], hostRegister[i]);
+		}
+	}
+	emitStoreCPU8(dr, offsetof(CPU, flags), HOST_FLAGS);
+	emitAluImm(dr, true, DIGIT_ADD, RSP, 8);
+	for (i = 5; i >= 0; i--){
+		emitPop(dr, saved[i]);
+	}
+	emit8(dr, 0xC3);
+	dr->firstBlock = dr->used;
+}
+
+/* The cache is only writable while a block is being emitted */
+static void setWritable(Dynarec *dr, bool writable)
+{
+	mprotect(dr->code, dr->size, writable ? PROT_READ | PROT_WRITE : PROT_READ | PROT_EXEC);
+}
+
+static void flushCache(Dynarec *dr)
+{
+	dr->used = dr->firstBlock;
+	memset(dr->entries, 0, sizeof(dr->entries));
+	dr->stats.flushes++;
+}
+
+Dynarec *dynarecCreate(const uint8_t *szpTable, const uint8_t *acAddTable, const uint8_t *acSubTable)
+{
+	Dynarec *dr = calloc(1, sizeof(Dynarec));
+	if (dr == NULL){
+		return NULL;
+	}
+	dr->size = DYNAREC_CACHE_SIZE;
+	dr->code = mmap(NULL, dr->size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (dr->code == MAP_FAILED){
+		free(dr);
+		return NULL;
+	}
+	dr->szpTable = szpTable;
+	dr->acAddTable = acAddTable;
+	dr->acSubTable = acSubTable;
+	emitStubs(dr);
+	dr->enter = (void (*)(CPU *, void *, int64_t))(void *)dr->code;
+	setWritable(dr, false);
+	return dr;
+}
+
+void dynarecFree(Dynarec *dynarec)
+{
+	if (dynarec == NULL){
+		return;
+	}
+	munmap(dynarec->code, dynarec->size);
+	free(dynarec);
+}
+
+void *dynarecEntry(const Dynarec *dynarec, uint16_t address)
+{
+	return dynarec->entries[address];
+}
+
+void *dynarecCompile(Dynarec *dynarec, uint16_t start, const DecodedOp *ops, int count)
+{
+	void *entry;
+	int i;
+	if (dynarec->pageInvalidations[start >> 8] >= DYNAREC_SMC_LIMIT){
+		dynarec->stats.smcRejected++;
+		return NULL;
+	}
+	for (i = 0; i < count; i++){
+		if (!compilable(ops[i].opcode)){
+			dynarec->stats.blocksRejected++;
+			return NULL;
+		}
+	}
+	setWritable(dynarec, true);
+	entry = emitBlock(dynarec, start, ops, count);
+	if (entry == NULL){
+		flushCache(dynarec);
+		entry = emitBlock(dynarec, start, ops, count);
+	}
+	setWritable(dynarec, false);
+	if (entry != NULL){
+		dynarec->entries[start] = entry;
+		dynarec->stats.blocksCompiled++;
+	}
+	return entry;
+}
+
+void dynarecInvalidate(Dynarec *dynarec, uint16_t address)
+{
+	if (dynarec->entries[address] == NULL){
+		return;
+	}
+	dynarec->entries[address] = NULL;
+	dynarec->stats.invalidations++;
+	if (dynarec->pageInvalidations[address >> 8] < DYNAREC_SMC_LIMIT){
+		dynarec->pageInvalidations[address >> 8]++;
+	}
+}
+
+bool dynarecRun(Dynarec *dynarec, CPU *cpu, void *entry, int64_t stop)
+{
+	dynarec->stats.nativeRuns++;
+	dynarec->enter(cpu, entry, stop);
+	if (dynarec->bailed){
+		dynarec->bailed = false;
+		dynarec->stats.bails++;
+		return true;
+	}
+	return false;
+}
+
+void dynarecGetStats(const Dynarec *dynarec, DynarecStats *stats)
+{
+	*stats = dynarec->stats;
+	stats->codeBytes = dynarec->used;
+	stats->cacheSize = dynarec->size;
+}
+#endif
@@ -0,0 +1,64 @@
+#ifndef DYNAREC_H
+#define DYNAREC_H
+#include <stdint.h>
+#include <stddef.h>
+#include "Core.h"
+/* x86-64 dynamic recompiler.
+	Built with -DDYNAREC on top of -DBLOCK_CACHE. Blocks that the run loop
+	finds hot are compiled to native code in an executable code cache, with
+	the guest registers and flag byte pinned in host registers for as long
+	as execution stays in native code. Compiled blocks jump straight to each
+	other through a per address entry table and only return to the run loop
+	when the next block isn't compiled or the cycle budget runs low.
+	Only instructions that never store to guest memory are compiled, so
+	native code can't invalidate itself; anything else, cold code and code
+	on pages that keep being rewritten stays with the interpreter. */
+#if defined(DYNAREC) && (!defined(__x86_64__) || defined(_WIN32))
+#warning "DYNAREC needs an x86-64 POSIX host, building without it"
+#undef DYNAREC
+#endif
+#if defined(DYNAREC) && !defined(BLOCK_CACHE)
+#error "DYNAREC builds on BLOCK_CACHE, add -DBLOCK_CACHE"
+#endif
+#if defined(DYNAREC) && defined(LAZY_FLAGS)
+#error "DYNAREC keeps the flag byte in a host register, build without LAZY_FLAGS"
+#endif
+/* Visits before a block is compiled */
+#define DYNAREC_HOT_BLOCK 16
+/* Native blocks thrown away on one page before it is left to the interpreter */
+#define DYNAREC_SMC_LIMIT 8
+#define DYNAREC_CACHE_SIZE (1 << 20)
+
+typedef struct DynarecStats {
+	uint64_t blocksCompiled;
+	uint64_t blocksRejected; /* held an instruction the compiler doesn't handle */
+	uint64_t smcRejected; /* on a page that keeps being rewritten */
+	uint64_t invalidations;
+	uint64_t flushes; /* times the code cache filled up and was emptied */
+	uint64_t nativeRuns; /* entries into native code from the run loop */
+	uint64_t bails; /* native runs that stopped at a load from a handler page */
+	size_t codeBytes; /* in use right now */
+	size_t cacheSize;
+} DynarecStats;
+
+typedef struct Dynarec Dynarec;
+
+/* Tables are Core.c's flag tables, the native code reads them directly.
+	Returns NULL if no executable memory could be mapped. */
+Dynarec *dynarecCreate(const uint8_t *szpTable, const uint8_t *acAddTable, const uint8_t *acSubTable);
+void dynarecFree(Dynarec *dynarec);
+/* Native code for the block starting at address, or NULL */
+void *dynarecEntry(const Dynarec *dynarec, uint16_t address);
+/* Compiles count instructions starting at start.
+	Returns NULL if any of them can't be compiled. */
+void *dynarecCompile(Dynarec *dynarec, uint16_t start, const DecodedOp *ops, int count);
+/* Drops the native block starting at address, if there is one */
+void dynarecInvalidate(Dynarec *dynarec, uint16_t address);
+/* Runs native code from entry until it reaches a block that isn't
+	compiled or cycleCount reaches stop. The program counter, registers,
+	flags and cycleCount are all up to date on return. Returns true if it
+	stopped at an instruction that loads from a handler page, which the
+	interpreter then has to run. */
+bool dynarecRun(Dynarec *dynarec, CPU *cpu, void *entry, int64_t stop);
+void dynarecGetStats(const Dynarec *dynarec, DynarecStats *stats);
+#endif
@@ -0,0 +1,184 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <errno.h>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+#include "Loader.h"
+#define CPU_DIAG
+#define CPU_DIAG_OFFSET PROGRAM_ADDRESS
+
+long loadProgram(uint8_t *memory, const char *path)
+{
+	FILE *file;
+	long filelen;
+	long offset = 0;
+	file = fopen(path, "rb");
+	if (file == NULL){
+		return -1;
+	}
+	fseek(file, 0, SEEK_END);
+	filelen = ftell(file);
+	rewind(file);
+	#ifdef CPU_DIAG
+	offset = CPU_DIAG_OFFSET;
+	#endif
+	if (filelen > 65536 - offset){
+		fclose(file);
+		errno = EFBIG;
+		return -1;
+	}
+	filelen = fread(&memory[offset], 1, filelen, file);
+	fclose(file);
+	return filelen;
+}
+
+#ifdef _WIN32
+/* No mmap, the image is read into memory of its own instead */
+Image *imageOpen(const char *path, bool writable)
+{
+	Image *image = calloc(1, sizeof(Image));
+	FILE *file;
+	long size;
+	if (image == NULL){
+		return NULL;
+	}
+	file = fopen(path, "rb");
+	if (file == NULL){
+		free(image);
+		return NULL;
+	}
+	fseek(file, 0, SEEK_END);
+	size = ftell(file);
+	rewind(file);
+	image->length = (size + MEMORY_PAGE_SIZE - 1) & ~(long)(MEMORY_PAGE_SIZE - 1);
+	image->data = calloc(1, image->length ? image->length : 1);
+	if (image->data == NULL || fread(image->data, 1, size, file) != (size_t)size){
+		fclose(file);
+		imageClose(image);
+		return NULL;
+	}
+	fclose(file);
+	image->size = size;
+	image->writable = writable;
+	return image;
+}
+
+void imageClose(Image *image)
+{
+	if (image == NULL){
+		return;
+	}
+	free(image->data);
+	free(image);
+}
+#else
+Image *imageOpen(const char *path, bool writable)
+{
+	Image *image;
+	struct stat info;
+	long hostPage = sysconf(_SC_PAGESIZE);
+	int fd = open(path, O_RDONLY);
+	if (fd < 0){
+		return NULL;
+	}
+	image = calloc(1, sizeof(Image));
+	if (image == NULL || fstat(fd, &info) != 0){
+		free(image);
+		close(fd);
+		return NULL;
+	}
+	image->size = info.st_size;
+	image->writable = writable;
+	/* Host pages are whole guest pages, the tail past the file is zero */
+	image->length = (image->size + hostPage - 1) & ~(size_t)(hostPage - 1);
+	if (image->length != 0){
+		image->data = mmap(NULL, image->length, writable ? PROT_READ | PROT_WRITE : PROT_READ,
+			writable ? MAP_PRIVATE : MAP_SHARED, fd, 0);
+		if (image->data == MAP_FAILED){
+			free(image);
+			close(fd);
+			return NULL;
+		}
+	}
+	close(fd);
+	return image;
+}
+
+void imageClose(Image *image)
+{
+	if (image == NULL){
+		return;
+	}
+	if (image->length != 0){
+		munmap(image->data, image->length);
+	}
+	free(image);
+}
+#endif
+
+/* Guest bytes an image covers, whole guest pages */
+static uint32_t imageLength(const Image *image)
+{
+	return (image->size + MEMORY_PAGE_SIZE - 1) & ~(uint32_t)(MEMORY_PAGE_SIZE - 1);
+}
+
+bool imageMap(CPU *cpu, const Image *image, uint16_t address)
+{
+	uint32_t length = imageLength(image);
+	if (address & (MEMORY_PAGE_SIZE - 1)){
+		errno = EINVAL;
+		return false;
+	}
+	if (image->size > 65536 - (uint32_t)address){
+		errno = EFBIG;
+		return false;
+	}
+	if (length == 0){
+		return true;
+	}
+	/* Read-only pages are never stored to, so the mapping can stay PROT_READ */
+	return cpuMapMemory(cpu, address, length, image->data, !image->writable);
+}
+
+bool loadSegments(CPU *cpu, const LoadSegment *segments, int count, Image **images)
+{
+	int i;
+	int saved;
+	for (i = 0; i < count; i++){
+		images[i] = imageOpen(segments[i].path, segments[i].writable);
+		if (images[i] == NULL || !imageMap(cpu, images[i], segments[i].address)){
+			break;
+		}
+	}
+	if (i == count){
+		return true;
+	}
+	saved = errno;
+	imageClose(images[i]);
+	images[i] = NULL;
+	/* The CPU can't keep pointing into images about to be unmapped */
+	while (--i >= 0){
+		cpuMapMemory(cpu, segments[i].address, imageLength(images[i]), cpu->memory + segments[i].address, false);
+		imageClose(images[i]);
+		images[i] = NULL;
+	}
+	errno = saved;
+	return false;
+}
+
+Image *mapProgram(CPU *cpu, const char *path)
+{
+	Image *image = imageOpen(path, true);
+	if (image != NULL && !imageMap(cpu, image, PROGRAM_ADDRESS)){
+		int saved = errno;
+		imageClose(image);
+		errno = saved;
+		return NULL;
+	}
+	return image;
+}
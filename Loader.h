@@ -0,0 +1,45 @@
+#ifndef LOADER_H
+#define LOADER_H
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "Core.h"
+/* Where programs are loaded, CP/M style */
+#define PROGRAM_ADDRESS 0x100
+/* Reads a program image from path into a 64 KiB guest memory.
+	Returns the number of bytes loaded, or -1 with errno set if the file
+	can't be read or doesn't fit. */
+long loadProgram(uint8_t *memory, const char *path);
+
+/* Images mapped straight from their files instead of copied.
+	A read-only image is a shared mapping, so every CPU and process using
+	it reads the same physical pages, and the guest sees it as ROM. A
+	writable image is a private copy-on-write mapping: its pages stay
+	shared with the file until the guest first stores to one, and belong
+	to a single CPU. Functions return NULL or false with errno set. */
+typedef struct Image {
+	uint8_t *data;
+	size_t size; /* bytes in the file */
+	size_t length; /* bytes mapped, size rounded up to whole host pages */
+	bool writable;
+} Image;
+/* One image placed in the address space by loadSegments() */
+typedef struct LoadSegment {
+	const char *path;
+	uint16_t address; /* multiple of MEMORY_PAGE_SIZE */
+	bool writable;
+} LoadSegment;
+
+Image *imageOpen(const char *path, bool writable);
+void imageClose(Image *image);
+/* Maps image at address. Fails with EINVAL for an address that isn't
+	page aligned and EFBIG for an image running past 0xFFFF. The tail of
+	the last page past the end of the file reads as zero. */
+bool imageMap(CPU *cpu, const Image *image, uint16_t address);
+/* Opens and maps every segment in order, later ones mapping over earlier
+	ones. images receives count entries to imageClose() once the CPU is
+	done with them; on failure the ones already opened are closed. */
+bool loadSegments(CPU *cpu, const LoadSegment *segments, int count, Image **images);
+/* The usual program image: writable at PROGRAM_ADDRESS */
+Image *mapProgram(CPU *cpu, const char *path);
+#endif
@@ -0,0 +1,116 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <time.h>
+#ifdef __linux__
+#include <sys/prctl.h>
+#endif
+#include "Pacer.h"
+
+static int64_t now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* Nanoseconds the cycles take at the pacer's clock, in two parts so
+	cycles * 10^9 can't overflow on long runs */
+static int64_t cyclesToNanoseconds(const Pacer *pacer, int64_t cycles)
+{
+	return cycles / pacer->clockHz * 1000000000
+		+ cycles % pacer->clockHz * 1000000000 / pacer->clockHz;
+}
+
+bool pacerInit(Pacer *pacer, int64_t clockHz)
+{
+	if (clockHz < 1){
+		return false;
+	}
+	memset(pacer, 0, sizeof(*pacer));
+	pacer->clockHz = clockHz;
+	pacer->sliceCycles = clockHz * PACE_SLICE_NANOSECONDS / 1000000000;
+	if (pacer->sliceCycles < 1){
+		pacer->sliceCycles = 1;
+	}
+#ifdef __linux__
+	/* Timers wake up to 50us late by default to batch wake-ups */
+	prctl(PR_SET_TIMERSLACK, 1);
+#endif
+	return true;
+}
+
+/* Holds the caller until deadline and returns how late it was let go */
+static int64_t waitUntil(Pacer *pacer, int64_t deadline)
+{
+	int64_t time = now();
+	int64_t sleepUntil = deadline - PACE_SPIN_NANOSECONDS;
+	if (time < sleepUntil){
+		struct timespec ts = { sleepUntil / 1000000000, sleepUntil % 1000000000 };
+		while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR){
+		}
+		pacer->stats.sleptNanoseconds += now() - time;
+		time = now();
+	}
+	if (time < deadline){
+		int64_t spinFrom = time;
+		while ((time = now()) < deadline){
+		}
+		pacer->stats.spunNanoseconds += time - spinFrom;
+	}
+	return time - deadline;
+}
+
+ExitReason pacerRun(Pacer *pacer, CPU *cpu, int64_t cycles)
+{
+	int64_t end = cpu->cycleCount > INT64_MAX - cycles ? INT64_MAX : cpu->cycleCount + cycles;
+	ExitReason reason = EXIT_BUDGET;
+	if (!pacer->started){
+		pacer->started = true;
+		pacer->startCycle = cpu->cycleCount;
+		pacer->startTime = now();
+	}
+	while (cpu->cycleCount < end){
+		int64_t slice = end - cpu->cycleCount < pacer->sliceCycles ? end - cpu->cycleCount : pacer->sliceCycles;
+		int64_t deadline;
+		int64_t lateness;
+		reason = cpuRunCycles(cpu, slice);
+		deadline = pacer->startTime + cyclesToNanoseconds(pacer, cpu->cycleCount - pacer->startCycle);
+		lateness = now() - deadline;
+		pacer->stats.slices++;
+		if (lateness > 0){
+			pacer->stats.overruns++;
+			if (lateness > PACE_MAX_BEHIND_NANOSECONDS){
+				pacer->stats.resyncs++;
+				pacer->startCycle = cpu->cycleCount;
+				pacer->startTime = deadline + lateness;
+			}
+		}
+		else{
+			lateness = waitUntil(pacer, deadline);
+		}
+		pacer->stats.totalLateness += lateness;
+		if (lateness > pacer->stats.maxLateness){
+			pacer->stats.maxLateness = lateness;
+		}
+		if (reason != EXIT_BUDGET){
+			break;
+		}
+	}
+	return reason;
+}
+
+void pacerReport(const Pacer *pacer, const CPU *cpu, FILE *out)
+{
+	const PaceStats *stats = &pacer->stats;
+	double elapsed = pacer->started ? (now() - pacer->startTime) / 1e9 : 0;
+	fprintf(out, "pacing: %" PRId64 " Hz asked, %.0f Hz since the last resync, %" PRIu64 " slices of %" PRId64 " cycles\n",
+		pacer->clockHz, elapsed > 0 ? (cpu->cycleCount - pacer->startCycle) / elapsed : 0.0,
+		stats->slices, pacer->sliceCycles);
+	fprintf(out, "pacing: lateness mean %.1f us, max %.1f us, %" PRIu64 " overran, %" PRIu64 " resynced\n",
+		stats->slices ? stats->totalLateness / 1e3 / stats->slices : 0.0, stats->maxLateness / 1e3,
+		stats->overruns, stats->resyncs);
+	fprintf(out, "pacing: %.3f s asleep, %.3f s spinning\n", stats->sleptNanoseconds / 1e9, stats->spunNanoseconds / 1e9);
+}
@@ -0,0 +1,55 @@
+#ifndef PACER_H
+#define PACER_H
+#include <stdio.h>
+#include <stdint.h>
+#include "Core.h"
+/* Real-time pacing.
+	Runs the CPU in slices of PACE_SLICE_NANOSECONDS worth of cycles at
+	the configured clock, then holds it until the monotonic clock reaches
+	the time the slice ends at in emulated time. Those deadlines are
+	counted from where pacing started, never from the last wake-up, so
+	oversleeping and rounding don't add up to drift. The wait sleeps up to
+	PACE_SPIN_NANOSECONDS short of the deadline, as the kernel wakes a
+	sleeper late by tens of microseconds, and spins on the clock for the
+	rest. A slice that ends more than PACE_MAX_BEHIND_NANOSECONDS past its
+	deadline (the host can't keep up, or was stopped) moves the start
+	along instead of running flat out until emulated time has caught up.
+	A HLT waiting for an interrupt skips to the end of its slice, so it
+	waits out the time in real time too. Without a pacer the CPU runs
+	unthrottled, as batch runs do. */
+#define PACE_SLICE_NANOSECONDS 1000000
+#define PACE_SPIN_NANOSECONDS 100000
+#define PACE_MAX_BEHIND_NANOSECONDS 100000000
+
+/* Lateness is how far past its deadline a slice was let go, in
+	nanoseconds: the wake-up error for a slice that had to wait, how far
+	behind the host was for one that didn't */
+typedef struct PaceStats {
+	uint64_t slices;
+	uint64_t overruns; /* slices that ended past their deadline */
+	uint64_t resyncs; /* overruns that moved the start along */
+	int64_t totalLateness;
+	int64_t maxLateness;
+	int64_t sleptNanoseconds;
+	int64_t spunNanoseconds;
+} PaceStats;
+
+typedef struct Pacer {
+	int64_t clockHz;
+	int64_t sliceCycles;
+	/* Emulated time is zero at startCycle and startTime */
+	int64_t startCycle;
+	int64_t startTime;
+	bool started;
+	PaceStats stats;
+} Pacer;
+
+/* Returns false for a clock under 1 Hz */
+bool pacerInit(Pacer *pacer, int64_t clockHz);
+/* Runs the CPU for cycles cycles like cpuRunCycles(), in step with the
+	wall clock. Time spent outside it, between calls, counts as lateness
+	for the first slice of the next call. */
+ExitReason pacerRun(Pacer *pacer, CPU *cpu, int64_t cycles);
+/* The clock achieved since pacing started, and how late slices were */
+void pacerReport(const Pacer *pacer, const CPU *cpu, FILE *out);
+#endif
@@ -0,0 +1,70 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include "Ports.h"
+
+PortBus *portBusCreate(void)
+{
+	return calloc(1, sizeof(PortBus));
+}
+
+void portBusFree(PortBus *bus)
+{
+	if (bus == NULL){
+		return;
+	}
+	portBusFlush(bus);
+	free(bus);
+}
+
+void portBindRead(PortBus *bus, uint8_t port, PortReadHandler handler, void *context)
+{
+	bus->in[port].handler = handler;
+	bus->in[port].context = context;
+}
+
+void portBindWrite(PortBus *bus, uint8_t port, PortWriteHandler handler, void *context)
+{
+	portBusFlush(bus);
+	bus->out[port].handler = handler;
+	bus->out[port].batch = NULL;
+	bus->out[port].context = context;
+}
+
+void portBindBatchedWrite(PortBus *bus, uint8_t port, PortBatchHandler handler, void *context)
+{
+	/* Queued writes go to whoever was bound when they executed */
+	portBusFlush(bus);
+	bus->out[port].handler = NULL;
+	bus->out[port].batch = handler;
+	bus->out[port].context = context;
+}
+
+void portBusFlush(PortBus *bus)
+{
+	int start = 0;
+	int end;
+	/* Consecutive writes to the same device go over in one call */
+	while (start < bus->queued){
+		const PortWriteSlot *slot = &bus->out[bus->queue[start].port];
+		for (end = start + 1; end < bus->queued; end++){
+			const PortWriteSlot *next = &bus->out[bus->queue[end].port];
+			if (next->batch != slot->batch || next->context != slot->context){
+				break;
+			}
+		}
+		slot->batch(slot->context, &bus->queue[start], end - start);
+		start = end;
+	}
+	bus->queued = 0;
+}
+
+void portQueueWrite(PortBus *bus, uint8_t port, uint8_t value, int64_t cycle)
+{
+	if (bus->queued == PORT_BATCH_SIZE){
+		portBusFlush(bus);
+	}
+	bus->queue[bus->queued].cycle = cycle;
+	bus->queue[bus->queued].port = port;
+	bus->queue[bus->queued].value = value;
+	bus->queued++;
+}
@@ -0,0 +1,57 @@
+#ifndef PORTS_H
+#define PORTS_H
+#include <stdint.h>
+/* Port I/O bus for IN and OUT.
+	Each of the 256 input and 256 output ports has its own slot holding a
+	handler and the context it is called with, so an access is one indexed
+	load and an indirect call. Unbound ports cost a NULL test: OUT is
+	dropped and IN reads 0xFF, like an undriven data bus.
+	A bus is owned by the host and attached through cpu->ports; one bus
+	may be shared by several CPUs running on the same thread. */
+#define PORT_BATCH_SIZE 256
+
+typedef uint8_t (*PortReadHandler)(void *context, uint8_t port);
+typedef void (*PortWriteHandler)(void *context, uint8_t port, uint8_t value);
+/* One queued OUT, cycle is the CPU's cycleCount when it executed */
+typedef struct PortWrite {
+	int64_t cycle;
+	uint8_t port;
+	uint8_t value;
+} PortWrite;
+typedef void (*PortBatchHandler)(void *context, const PortWrite *writes, int count);
+
+typedef struct PortReadSlot {
+	PortReadHandler handler;
+	void *context;
+} PortReadSlot;
+typedef struct PortWriteSlot {
+	PortWriteHandler handler; /* called on every OUT */
+	PortBatchHandler batch; /* or, for batched ports, with queued writes */
+	void *context;
+} PortWriteSlot;
+
+typedef struct PortBus {
+	PortReadSlot in[256];
+	PortWriteSlot out[256];
+	int queued;
+	PortWrite queue[PORT_BATCH_SIZE];
+} PortBus;
+
+/* Returns NULL if out of memory, every port starts unbound */
+PortBus *portBusCreate(void);
+/* Delivers anything still queued, then frees the bus */
+void portBusFree(PortBus *bus);
+/* A NULL handler unbinds the port */
+void portBindRead(PortBus *bus, uint8_t port, PortReadHandler handler, void *context);
+void portBindWrite(PortBus *bus, uint8_t port, PortWriteHandler handler, void *context);
+/* For slow devices: writes to port are queued with their cycle stamp and
+	handed over PORT_BATCH_SIZE at a time, in the order they executed.
+	The queue is also emptied before any bound IN and at the end of every
+	cpuRunCycles(), so a device never answers a read or leaves a run with
+	writes still outstanding. */
+void portBindBatchedWrite(PortBus *bus, uint8_t port, PortBatchHandler handler, void *context);
+/* Hands every queued write to its device now */
+void portBusFlush(PortBus *bus);
+/* Queues a write to a batched port, used by the core's OUT */
+void portQueueWrite(PortBus *bus, uint8_t port, uint8_t value, int64_t cycle);
+#endif
@@ -0,0 +1,282 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "Core.h"
+#include "Profile.h"
+
+/* Without operands, the report gives the opcode as well */
+static const char *const mnemonics[256] = {
+	"NOP", "LXI B", "STAX B", "INX B", "INR B", "DCR B", "MVI B", "RLC",
+	"NOP", "DAD B", "LDAX B", "DCX B", "INR C", "DCR C", "MVI C", "RRC",
+	"NOP", "LXI D", "STAX D", "INX D", "INR D", "DCR D", "MVI D", "RAL",
+	"NOP", "DAD D", "LDAX D", "DCX D", "INR E", "DCR E", "MVI E", "RAR",
+	"NOP", "LXI H", "SHLD", "INX H", "INR H", "DCR H", "MVI H", "DAA",
+	"NOP", "DAD H", "LHLD", "DCX H", "INR L", "DCR L", "MVI L", "CMA",
+	"DUMP", "LXI SP", "STA", "INX SP", "INR M", "DCR M", "MVI M", "STC",
+	"NOP", "DAD SP", "LDA", "DCX SP", "INR A", "DCR A", "MVI A", "CMC",
+	"MOV B,B", "MOV B,C", "MOV B,D", "MOV B,E", "MOV B,H", "MOV B,L", "MOV B,M", "MOV B,A",
+	"MOV C,B", "MOV C,C", "MOV C,D", "MOV C,E", "MOV C,H", "MOV C,L", "MOV C,M", "MOV C,A",
+	"MOV D,B", "MOV D,C", "MOV D,D", "MOV D,E", "MOV D,H", "MOV D,L", "MOV D,M", "MOV D,A",
+	"MOV E,B", "MOV E,C", "MOV E,D", "MOV E,E", "MOV E,H", "MOV E,L", "MOV E,M", "MOV E,A",
+	"MOV H,B", "MOV H,C", "MOV H,D", "MOV H,E", "MOV H,H", "MOV H,L", "MOV H,M", "MOV H,A",
+	"MOV L,B", "MOV L,C", "MOV L,D", "MOV L,E", "MOV L,H", "MOV L,L", "MOV L,M", "MOV L,A",
+	"MOV M,B", "MOV M,C", "MOV M,D", "MOV M,E", "MOV M,H", "MOV M,L", "HLT", "MOV M,A",
+	"MOV A,B", "MOV A,C", "MOV A,D", "MOV A,E", "MOV A,H", "MOV A,L", "MOV A,M", "MOV A,A",
+	"ADD B", "ADD C", "ADD D", "ADD E", "ADD H", "ADD L", "ADD M", "ADD A",
+	"ADC B", "ADC C", "ADC D", "ADC E", "ADC H", "ADC L", "ADC M", "ADC A",
+	"SUB B", "SUB C", "SUB D", "SUB E", "SUB H", "SUB L", "SUB M", "SUB A",
+	"SBB B", "SBB C", "SBB D", "SBB E", "SBB H", "SBB L", "SBB M", "SBB A",
+	"ANA B", "ANA C", "ANA D", "ANA E", "ANA H", "ANA L", "ANA M", "ANA A",
+	"XRA B", "XRA C", "XRA D", "XRA E", "XRA H", "XRA L", "XRA M", "XRA A",
+	"ORA B", "ORA C", "ORA D", "ORA E", "ORA H", "ORA L", "ORA M", "ORA A",
+	"CMP B", "CMP C", "CMP D", "CMP E", "CMP H", "CMP L", "CMP M", "CMP A",
+	"RNZ", "POP B", "JNZ", "JMP", "CNZ", "PUSH B", "ADI", "RST 0",
+	"RZ", "RET", "JZ", "JMP", "CZ", "CALL", "ACI", "RST 1",
+	"RNC", "POP D", "JNC", "OUT", "CNC", "PUSH D", "SUI", "RST 2",
+	"RC", "RET", "JC", "IN", "CC", "CALL", "SBI", "RST 3",
+	"RPO", "POP H", "JPO", "XTHL", "CPO", "PUSH H", "ANI", "RST 4",
+	"RPE", "PCHL", "JPE", "XCHG", "CPE", "CALL", "XRI", "RST 5",
+	"RP", "POP PSW", "JP", "DI", "CP", "PUSH PSW", "ORI", "RST 6",
+	"RM", "SPHL", "JM", "EI", "CM", "CALL", "CPI", "RST 7"
+};
+
+/* CALL and its undocumented copies, Cxx and RST */
+static inline bool isCall(uint8_t opcode)
+{
+	return (opcode & 0xCF) == 0xCD || (opcode & 0xC7) == 0xC4 || (opcode & 0xC7) == 0xC7;
+}
+
+/* RET and its undocumented copy, Rxx */
+static inline bool isReturn(uint8_t opcode)
+{
+	return (opcode & 0xEF) == 0xC9 || (opcode & 0xC7) == 0xC0;
+}
+
+Profile *profileCreate(void)
+{
+	Profile *profile = calloc(1, sizeof(Profile));
+	if (profile == NULL){
+		return NULL;
+	}
+	profile->nodeCapacity = 1024;
+	profile->nodes = calloc(profile->nodeCapacity, sizeof(ProfileNode));
+	if (profile->nodes == NULL){
+		free(profile);
+		return NULL;
+	}
+	profile->nodeCount = 1;
+	return profile;
+}
+
+void profileFree(Profile *profile)
+{
+	if (profile == NULL){
+		return;
+	}
+	free(profile->nodes);
+	free(profile);
+}
+
+/* The node for address called from parent, parent itself if there is no
+	room for another */
+static uint32_t childNode(Profile *profile, uint32_t parent, uint16_t address)
+{
+	ProfileNode *node;
+	uint32_t i;
+	for (i = profile->nodes[parent].child; i != 0; i = profile->nodes[i].sibling){
+		if (profile->nodes[i].address == address){
+			return i;
+		}
+	}
+	if (profile->nodeCount == profile->nodeCapacity){
+		ProfileNode *nodes;
+		if (profile->nodeCapacity == PROFILE_MAX_NODES){
+			return parent;
+		}
+		nodes = realloc(profile->nodes, 2 * profile->nodeCapacity * sizeof(ProfileNode));
+		if (nodes == NULL){
+			return parent;
+		}
+		profile->nodes = nodes;
+		profile->nodeCapacity *= 2;
+	}
+	i = profile->nodeCount++;
+	node = &profile->nodes[i];
+	node->address = address;
+	node->parent = parent;
+	node->child = 0;
+	node->sibling = profile->nodes[parent].child;
+	node->cycles = 0;
+	profile->nodes[parent].child = i;
+	return i;
+}
+
+/* Leaves the frames whose return address stackPointer is above, and
+	with inclusive the one whose return address it points at */
+static void leaveFrames(Profile *profile, uint16_t stackPointer, bool inclusive)
+{
+	while (profile->depth > 0){
+		int16_t above = stackPointer - profile->frames[profile->depth].stackPointer;
+		if (above < 0 || (above == 0 && !inclusive)){
+			break;
+		}
+		profile->depth--;
+	}
+}
+
+static void enterFrame(Profile *profile, uint16_t address, uint16_t stackPointer)
+{
+	uint32_t node;
+	/* frames at or below the new one's return address were left already */
+	leaveFrames(profile, stackPointer, true);
+	if (profile->depth == PROFILE_MAX_DEPTH - 1){
+		return;
+	}
+	node = childNode(profile, profile->frames[profile->depth].node, address);
+	profile->depth++;
+	profile->frames[profile->depth].node = node;
+	profile->frames[profile->depth].stackPointer = stackPointer;
+}
+
+static void charge(Profile *profile, const CPU *cpu)
+{
+	int64_t cycles = cpu->cycleCount - profile->lastCycle;
+	/* a CPU restored to an earlier snapshot went back in time */
+	if (cycles < 0){
+		cycles = 0;
+	}
+	profile->opcodes[profile->lastOpcode].count++;
+	profile->opcodes[profile->lastOpcode].cycles += cycles;
+	if (!profile->interrupt){
+		profile->addresses[profile->lastAddress].count++;
+		profile->addresses[profile->lastAddress].cycles += cycles;
+		profile->opcodesAt[profile->lastAddress] = profile->lastOpcode;
+	}
+	profile->instructions++;
+	profile->cycles += cycles;
+	profile->nodes[profile->frames[profile->depth].node].cycles += cycles;
+	if (isCall(profile->lastOpcode) && cpu->stackPointer == (uint16_t)(profile->lastStackPointer - 2)){
+		profile->calls[cpu->programCounter]++;
+		enterFrame(profile, cpu->programCounter, cpu->stackPointer);
+	}
+	else if (isReturn(profile->lastOpcode) && cpu->stackPointer == (uint16_t)(profile->lastStackPointer + 2)){
+		leaveFrames(profile, cpu->stackPointer, false);
+	}
+}
+
+void profileInstruction(Profile *profile, const CPU *cpu, uint8_t opcode)
+{
+	if (profile->pending){
+		charge(profile, cpu);
+	}
+	else if (profile->instructions == 0){
+		profile->nodes[0].address = cpu->programCounter;
+	}
+	profile->pending = true;
+	profile->interrupt = false;
+	profile->lastOpcode = opcode;
+	profile->lastAddress = cpu->programCounter;
+	profile->lastStackPointer = cpu->stackPointer;
+	profile->lastCycle = cpu->cycleCount;
+}
+
+void profileInterrupt(Profile *profile, const CPU *cpu, uint8_t vector)
+{
+	profileInstruction(profile, cpu, 0xC7 | vector << 3);
+	profile->interrupt = true;
+}
+
+void profileFinish(Profile *profile, const CPU *cpu)
+{
+	if (profile->pending){
+		charge(profile, cpu);
+		profile->pending = false;
+	}
+}
+
+/* Fills top with the indexes of the largest non-zero values, largest
+	first, and returns how many there are. values[i * stride] is entry i. */
+static int topEntries(const uint64_t *values, size_t stride, int count, int *top)
+{
+	int found = 0;
+	int i;
+	int j;
+	for (i = 0; i < count; i++){
+		uint64_t value = values[i * stride];
+		if (value == 0 || (found == PROFILE_TOP && value <= values[top[found - 1] * stride])){
+			continue;
+		}
+		if (found < PROFILE_TOP){
+			found++;
+		}
+		for (j = found - 1; j > 0 && values[top[j - 1] * stride] < value; j--){
+			top[j] = top[j - 1];
+		}
+		top[j] = i;
+	}
+	return found;
+}
+
+static double percent(uint64_t part, uint64_t whole)
+{
+	return whole ? 100.0 * part / whole : 0;
+}
+
+void profileReport(const Profile *profile, FILE *out)
+{
+	const size_t stride = sizeof(ProfileCounter) / sizeof(uint64_t);
+	int top[PROFILE_TOP];
+	uint64_t calls = 0;
+	int found;
+	int i;
+	fprintf(out, "%llu instructions, %llu cycles\n",
+		(unsigned long long)profile->instructions, (unsigned long long)profile->cycles);
+	fprintf(out, "\nOpcodes by cycles\n  opcode              count           cycles       %%\n");
+	found = topEntries(&profile->opcodes[0].cycles, stride, 256, top);
+	for (i = 0; i < found; i++){
+		const ProfileCounter *counter = &profile->opcodes[top[i]];
+		fprintf(out, "  %02x %-10s %12llu %16llu %6.2f%%\n", top[i], mnemonics[top[i]],
+			(unsigned long long)counter->count, (unsigned long long)counter->cycles,
+			percent(counter->cycles, profile->cycles));
+	}
+	fprintf(out, "\nAddresses by cycles\n  address             count           cycles       %%\n");
+	found = topEntries(&profile->addresses[0].cycles, stride, 65536, top);
+	for (i = 0; i < found; i++){
+		const ProfileCounter *counter = &profile->addresses[top[i]];
+		fprintf(out, "  %04x %-8s %12llu %16llu %6.2f%%\n", top[i], mnemonics[profile->opcodesAt[top[i]]],
+			(unsigned long long)counter->count, (unsigned long long)counter->cycles,
+			percent(counter->cycles, profile->cycles));
+	}
+	for (i = 0; i < 65536; i++){
+		calls += profile->calls[i];
+	}
+	fprintf(out, "\nCall targets by calls\n  target               calls       %%\n");
+	found = topEntries(profile->calls, 1, 65536, top);
+	for (i = 0; i < found; i++){
+		fprintf(out, "  %04x %21llu %6.2f%%\n", top[i], (unsigned long long)profile->calls[top[i]],
+			percent(profile->calls[top[i]], calls));
+	}
+}
+
+static void writeStacks(const Profile *profile, uint32_t node, uint16_t *path, int depth, FILE *out)
+{
+	uint32_t i;
+	int j;
+	path[depth] = profile->nodes[node].address;
+	if (profile->nodes[node].cycles != 0){
+		for (j = 0; j <= depth; j++){
+			fprintf(out, "%s%04x", j ? ";" : "", path[j]);
+		}
+		fprintf(out, " %llu\n", (unsigned long long)profile->nodes[node].cycles);
+	}
+	for (i = profile->nodes[node].child; i != 0; i = profile->nodes[i].sibling){
+		writeStacks(profile, i, path, depth + 1, out);
+	}
+}
+
+void profileStacks(const Profile *profile, FILE *out)
+{
+	uint16_t path[PROFILE_MAX_DEPTH];
+	writeStacks(profile, 0, path, 0, out);
+}
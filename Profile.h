@@ -0,0 +1,90 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+/* Execution profile.
+	The hook in the run loop only exists when built with -DPROFILE, and
+	even then costs a single pointer test per instruction while no profile
+	is attached. Attached, it runs -DBLOCK_CACHE builds an instruction at
+	a time like tracing does, so compiled blocks don't hide anything.
+	Each instruction is charged to its opcode and its address when the
+	next one starts, with the cycles that passed in between, so a HLT
+	waiting for an interrupt gets the cycles it waited. An interrupt counts
+	as the RST it runs, against the opcode but not an address. Counters
+	are flat arrays indexed by opcode and address, count and cycles side
+	by side. A CALL, conditional call or RST that pushed its return
+	address also counts towards its target in calls.
+	Cycles are charged to the guest call stack as well. A shadow stack
+	follows calls, RSTs and interrupts down and returns back up, a frame
+	being left once SP is back above the return address it pushed, so
+	code that drops return addresses or reloads SP doesn't leave frames
+	behind. Each distinct stack is a node in a call tree, written out in
+	the folded format flame graph tools read: one line per stack, the
+	functions by address from the outermost, separated by ';', then the
+	cycles spent in the innermost. Code a JMP went to counts as the
+	function it jumped from. */
+/* Rows in each table of the report */
+#define PROFILE_TOP 20
+/* Deeper calls are charged to the deepest frame */
+#define PROFILE_MAX_DEPTH 256
+/* Calls that would need more nodes are charged to their caller */
+#define PROFILE_MAX_NODES (1 << 20)
+
+typedef struct ProfileCounter {
+	uint64_t count;
+	uint64_t cycles;
+} ProfileCounter;
+
+/* A function as called from one stack, nodes[0] is where the run started */
+typedef struct ProfileNode {
+	uint16_t address;
+	uint32_t parent;
+	uint32_t child; /* the first, 0 for none */
+	uint32_t sibling; /* the next child of parent, 0 for none */
+	uint64_t cycles; /* in the function itself, not what it called */
+} ProfileNode;
+
+typedef struct ProfileFrame {
+	uint32_t node;
+	uint16_t stackPointer; /* where the return address went */
+} ProfileFrame;
+
+typedef struct Profile {
+	ProfileCounter opcodes[256];
+	ProfileCounter addresses[65536];
+	uint8_t opcodesAt[65536]; /* the last run at each address, for the report */
+	uint64_t calls[65536];
+	uint64_t instructions;
+	uint64_t cycles;
+	/* The instruction that started last, charged when the next one starts */
+	bool pending;
+	uint8_t lastOpcode;
+	uint16_t lastAddress;
+	uint16_t lastStackPointer;
+	int64_t lastCycle;
+	bool interrupt; /* and it was an interrupt */
+	/* Call tree, and the shadow stack into it */
+	ProfileNode *nodes;
+	uint32_t nodeCount;
+	uint32_t nodeCapacity;
+	ProfileFrame frames[PROFILE_MAX_DEPTH];
+	int depth; /* frames[depth] is the current function, frames[0] the root */
+} Profile;
+
+struct CPU;
+
+/* Returns NULL if out of memory */
+Profile *profileCreate(void);
+void profileFree(Profile *profile);
+void profileInstruction(Profile *profile, const struct CPU *cpu, uint8_t opcode);
+/* The CPU is about to take RST vector for an interrupt */
+void profileInterrupt(Profile *profile, const struct CPU *cpu, uint8_t vector);
+/* Charges the instruction that started last with the cycles up to cpu's
+	cycleCount, so call it once the run is over */
+void profileFinish(Profile *profile, const struct CPU *cpu);
+/* Writes the top opcodes and addresses by cycles and the top call targets */
+void profileReport(const Profile *profile, FILE *out);
+/* Writes the cycles spent in every call stack, folded */
+void profileStacks(const Profile *profile, FILE *out);
+#endif
@@ -0,0 +1,169 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include "Core.h"
+#include "Replay.h"
+
+/* The longest event: a 10 byte varint, the kind, port and value */
+#define MAX_EVENT_SIZE 13
+
+static InputLog *inputLogOpen(InputLogMode mode, FILE *file)
+{
+	InputLog *log = malloc(sizeof(InputLog));
+	if (log == NULL){
+		return NULL;
+	}
+	log->mode = mode;
+	log->file = file;
+	log->lastCycle = 0;
+	log->nextKind = INPUT_EVENT_END;
+	log->nextCycle = 0;
+	log->nextStop = INT64_MAX;
+	log->used = 0;
+	return log;
+}
+
+InputLog *inputLogRecord(FILE *out)
+{
+	InputLog *log = inputLogOpen(INPUT_RECORD, out);
+	if (log == NULL){
+		return NULL;
+	}
+	memcpy(log->buffer, INPUT_LOG_MAGIC, 8);
+	log->used = 8;
+	return log;
+}
+
+static bool readVarint(FILE *in, uint64_t *value)
+{
+	int shift = 0;
+	int byte;
+	*value = 0;
+	do {
+		byte = getc(in);
+		if (byte == EOF || shift > 63){
+			return false;
+		}
+		*value |= (uint64_t)(byte & 0x7F) << shift;
+		shift += 7;
+	} while (byte & 0x80);
+	return true;
+}
+
+/* Reads the next event into log->next*, or marks the end of the log.
+	A truncated last event, from a recording that crashed, ends it too. */
+static void readEvent(InputLog *log)
+{
+	uint64_t delta;
+	int kind;
+	int port = 0;
+	int value = 0;
+	log->nextKind = INPUT_EVENT_END;
+	log->nextStop = INT64_MAX;
+	if (!readVarint(log->file, &delta) || (kind = getc(log->file)) == EOF || kind > INPUT_EVENT_IN){
+		return;
+	}
+	if (kind == INPUT_EVENT_IN && ((port = getc(log->file)) == EOF || (value = getc(log->file)) == EOF)){
+		return;
+	}
+	log->nextKind = kind;
+	log->nextPort = port;
+	log->nextValue = value;
+	log->nextCycle = log->lastCycle + delta;
+	if (log->nextCycle < INT64_MAX){
+		log->nextStop = log->nextCycle;
+	}
+}
+
+static void consumeEvent(InputLog *log)
+{
+	log->lastCycle = log->nextCycle;
+	readEvent(log);
+}
+
+InputLog *inputLogReplay(FILE *in, const CPU *cpu)
+{
+	char magic[8];
+	InputLog *log;
+	if (fread(magic, 1, 8, in) != 8 || memcmp(magic, INPUT_LOG_MAGIC, 8) != 0){
+		errno = EINVAL;
+		return NULL;
+	}
+	log = inputLogOpen(INPUT_REPLAY, in);
+	if (log == NULL){
+		return NULL;
+	}
+	readEvent(log);
+	while (log->nextKind != INPUT_EVENT_END && log->nextCycle < (uint64_t)cpu->cycleCount){
+		consumeEvent(log);
+	}
+	return log;
+}
+
+void inputLogFlush(InputLog *log)
+{
+	if (log->used > 0){
+		fwrite(log->buffer, 1, log->used, log->file);
+		log->used = 0;
+		fflush(log->file);
+	}
+}
+
+void inputLogClose(InputLog *log)
+{
+	if (log == NULL){
+		return;
+	}
+	if (log->mode == INPUT_RECORD){
+		inputLogFlush(log);
+	}
+	free(log);
+}
+
+static void putEvent(InputLog *log, int64_t cycle, uint8_t kind)
+{
+	uint64_t delta = (uint64_t)cycle - log->lastCycle;
+	if (log->used > INPUT_LOG_BUFFER_SIZE - MAX_EVENT_SIZE){
+		inputLogFlush(log);
+	}
+	while (delta >= 0x80){
+		log->buffer[log->used++] = delta | 0x80;
+		delta >>= 7;
+	}
+	log->buffer[log->used++] = delta;
+	log->buffer[log->used++] = kind;
+	log->lastCycle = cycle;
+}
+
+void inputLogIn(InputLog *log, int64_t cycle, uint8_t port, uint8_t value)
+{
+	putEvent(log, cycle, INPUT_EVENT_IN);
+	log->buffer[log->used++] = port;
+	log->buffer[log->used++] = value;
+}
+
+void inputLogInterrupt(InputLog *log, int64_t cycle, uint8_t vector)
+{
+	putEvent(log, cycle, vector);
+}
+
+bool inputLogReplayIn(InputLog *log, int64_t cycle, uint8_t port, uint8_t *value)
+{
+	if (log->nextKind != INPUT_EVENT_IN || log->nextCycle != (uint64_t)cycle || log->nextPort != port){
+		return false;
+	}
+	*value = log->nextValue;
+	consumeEvent(log);
+	return true;
+}
+
+bool inputLogReplayInterrupt(InputLog *log, int64_t cycle, uint8_t vector)
+{
+	if (log->nextKind != vector || log->nextCycle != (uint64_t)cycle){
+		return false;
+	}
+	consumeEvent(log);
+	return true;
+}
@@ -0,0 +1,76 @@
+#ifndef REPLAY_H
+#define REPLAY_H
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+/* Record and replay of external input.
+	A program's run follows from its starting state apart from what comes
+	in from outside: the values IN reads and the interrupts it takes. A
+	log of those, each tagged with the cycleCount it happened at, is
+	enough to run it again bit for bit.
+	A recording CPU appends every IN result and every interrupt it takes
+	to the log. A replaying CPU reads IN values from the log instead of
+	the devices, ignores cpuRaiseInterrupt() and takes each logged
+	interrupt at its cycle. Anything the log doesn't account for, an IN at
+	another cycle or port or an interrupt the program can't take there,
+	stops the run with EXIT_DIVERGED.
+	Replay starts from the state the recording started from, or from a
+	save state taken during it. Loads from handler pages and interrupts
+	raised but never taken are not logged.
+
+	Log layout, a header and then events appended as they happen:
+		"8080RPLY"                 magic
+		varint cycle delta         from the previous event, the first from 0
+		u8 kind                    0-7 interrupt RST n, 8 IN
+		u8 port, u8 value          IN only
+	varints are little-endian base 128, so a typical event is 3-5 bytes.
+	Records are gathered in a buffer written out when full and at the end
+	of every run, so a crash loses at most the run it happened in. */
+#define INPUT_LOG_MAGIC "8080RPLY"
+#define INPUT_LOG_BUFFER_SIZE (1 << 16)
+#define INPUT_EVENT_IN 8
+/* Kind of the next event once the log is used up */
+#define INPUT_EVENT_END 0xFF
+
+typedef enum InputLogMode {
+	INPUT_RECORD,
+	INPUT_REPLAY
+} InputLogMode;
+
+typedef struct InputLog {
+	InputLogMode mode;
+	FILE *file;
+	uint64_t lastCycle; /* of the last event written or read */
+	/* Replay: the next event in the log */
+	uint8_t nextKind;
+	uint8_t nextPort;
+	uint8_t nextValue;
+	uint64_t nextCycle;
+	/* Replay: nextCycle, or INT64_MAX at the end of the log. The core
+		stops there to take an interrupt or to check that the IN is due. */
+	int64_t nextStop;
+	size_t used;
+	uint8_t buffer[INPUT_LOG_BUFFER_SIZE];
+} InputLog;
+
+struct CPU;
+
+/* Starts a log on out and writes its header. Returns NULL if out of memory. */
+InputLog *inputLogRecord(FILE *out);
+/* Replays the log in from where cpu is: events before its cycleCount are
+	skipped. Returns NULL with errno set to EINVAL if in isn't a log. */
+InputLog *inputLogReplay(FILE *in, const struct CPU *cpu);
+/* Writes out anything buffered, called at the end of every run */
+void inputLogFlush(InputLog *log);
+/* Flushes and frees the log, the FILE is left open */
+void inputLogClose(InputLog *log);
+
+/* Used by the core as the events happen */
+void inputLogIn(InputLog *log, int64_t cycle, uint8_t port, uint8_t value);
+void inputLogInterrupt(InputLog *log, int64_t cycle, uint8_t vector);
+/* Replay: consume the next event if it is the given IN or interrupt.
+	Return false, leaving the log as it is, if it isn't. */
+bool inputLogReplayIn(InputLog *log, int64_t cycle, uint8_t port, uint8_t *value);
+bool inputLogReplayInterrupt(InputLog *log, int64_t cycle, uint8_t vector);
+#endif
@@ -0,0 +1,362 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <unistd.h>
+#include "SaveState.h"
+
+#define COUNT_FIELD(name) + 1
+static const int fieldCount = 0 CPU_STATE_FIELDS(COUNT_FIELD);
+#undef COUNT_FIELD
+#define HEADER_SIZE 32
+/* Largest file a version 1 state can be */
+#define MAX_STATE_SIZE (HEADER_SIZE + 8 * 64 + MEMORY_PAGE_COUNT * (4 + MEMORY_PAGE_SIZE) + 4)
+
+struct SaveWriter {
+	pthread_t thread;
+	const Snapshot *snapshot;
+	const Snapshot *base;
+	FILE *file;
+	char *path;
+	char *temporary;
+	bool ok;
+};
+
+/* Output with a running checksum */
+typedef struct StateOut {
+	FILE *file;
+	uint32_t checksum;
+	bool ok;
+} StateOut;
+
+static uint32_t fnv1a(uint32_t hash, const uint8_t *data, size_t length)
+{
+	size_t i;
+	for (i = 0; i < length; i++){
+		hash = (hash ^ data[i]) * 16777619u;
+	}
+	return hash;
+}
+
+static void putBytes(StateOut *out, const void *data, size_t length)
+{
+	out->checksum = fnv1a(out->checksum, data, length);
+	if (out->ok && fwrite(data, 1, length, out->file) != length){
+		out->ok = false;
+	}
+}
+
+static void putLittle(StateOut *out, uint64_t value, int size)
+{
+	uint8_t bytes[8];
+	int i;
+	for (i = 0; i < size; i++){
+		bytes[i] = value >> (8 * i);
+	}
+	putBytes(out, bytes, size);
+}
+
+static uint64_t getLittle(const uint8_t *bytes, int size)
+{
+	uint64_t value = 0;
+	int i;
+	for (i = size - 1; i >= 0; i--){
+		value = value << 8 | bytes[i];
+	}
+	return value;
+}
+
+/* PackBits: a count byte n, then n + 1 literal bytes for n < 128, or
+	one byte repeated 257 - n times for n > 128. Returns the packed size. */
+static int packBits(const uint8_t *in, uint8_t *out)
+{
+	int i = 0;
+	int used = 0;
+	while (i < MEMORY_PAGE_SIZE){
+		int run = 1;
+		int start = i;
+		while (i + run < MEMORY_PAGE_SIZE && run < 128 && in[i + run] == in[i]){
+			run++;
+		}
+		if (run > 1){
+			out[used++] = 257 - run;
+			out[used++] = in[i];
+			i += run;
+			continue;
+		}
+		/* Literals up to the next pair of equal bytes */
+		while (i < MEMORY_PAGE_SIZE && i - start < 128 && (i + 1 == MEMORY_PAGE_SIZE || in[i] != in[i + 1])){
+			i++;
+		}
+		out[used++] = i - start - 1;
+		memcpy(out + used, in + start, i - start);
+		used += i - start;
+	}
+	return used;
+}
+
+static bool unpackBits(const uint8_t *in, int length, uint8_t *out)
+{
+	int i = 0;
+	int used = 0;
+	while (i < length){
+		int n = in[i++];
+		int count;
+		if (n < 128){
+			count = n + 1;
+			if (i + count > length || used + count > MEMORY_PAGE_SIZE){
+				return false;
+			}
+			memcpy(out + used, in + i, count);
+			i += count;
+		}
+		else if (n > 128){
+			count = 257 - n;
+			if (i == length || used + count > MEMORY_PAGE_SIZE){
+				return false;
+			}
+			memset(out + used, in[i++], count);
+		}
+		else{
+			count = 0;
+		}
+		used += count;
+	}
+	return used == MEMORY_PAGE_SIZE;
+}
+
+static pthread_once_t saltOnce = PTHREAD_ONCE_INIT;
+static uint64_t salt;
+
+static void makeSalt(void)
+{
+	salt = (uint64_t)time(NULL) << 32 ^ (uint64_t)getpid() << 16;
+}
+
+uint64_t saveStateId(const Snapshot *snapshot)
+{
+	pthread_once(&saltOnce, makeSalt);
+	return salt ^ snapshot->serial;
+}
+
+/* A delta leaves out pages that still hold what they did in base */
+static bool pageChanged(const Snapshot *snapshot, const Snapshot *base, int page)
+{
+	const uint8_t *host = snapshot->pages[page].host;
+	if (base == NULL || base->pages[page].host == NULL){
+		return true;
+	}
+	return host != base->pages[page].host && memcmp(host, base->pages[page].host, MEMORY_PAGE_SIZE) != 0;
+}
+
+bool saveStateWrite(FILE *file, const Snapshot *snapshot, const Snapshot *base)
+{
+	StateOut out = { .file = file, .checksum = 2166136261u, .ok = true };
+	uint8_t packed[2 * MEMORY_PAGE_SIZE];
+	bool saved[MEMORY_PAGE_COUNT];
+	uint32_t pages = 0;
+	int i;
+	for (i = 0; i < MEMORY_PAGE_COUNT; i++){
+		saved[i] = snapshot->pages[i].host != NULL && pageChanged(snapshot, base, i);
+		pages += saved[i];
+	}
+	putBytes(&out, SAVE_STATE_MAGIC, 8);
+	putLittle(&out, SAVE_STATE_VERSION, 2);
+	putLittle(&out, fieldCount, 2);
+	putLittle(&out, pages, 4);
+	putLittle(&out, saveStateId(snapshot), 8);
+	putLittle(&out, base != NULL ? saveStateId(base) : 0, 8);
+#define WRITE_FIELD(name) putLittle(&out, (uint64_t)(int64_t)snapshot->state.name, 8);
+	CPU_STATE_FIELDS(WRITE_FIELD)
+#undef WRITE_FIELD
+	for (i = 0; i < MEMORY_PAGE_COUNT; i++){
+		const uint8_t *host = snapshot->pages[i].host;
+		int length;
+		if (!saved[i]){
+			continue;
+		}
+		length = packBits(host, packed);
+		putLittle(&out, i, 1);
+		if (length < MEMORY_PAGE_SIZE){
+			putLittle(&out, 1, 1);
+			putLittle(&out, length, 2);
+			putBytes(&out, packed, length);
+		}
+		else{
+			putLittle(&out, 0, 1);
+			putLittle(&out, MEMORY_PAGE_SIZE, 2);
+			putBytes(&out, host, MEMORY_PAGE_SIZE);
+		}
+	}
+	putLittle(&out, out.checksum, 4);
+	return out.ok;
+}
+
+static void *writeThread(void *arg)
+{
+	SaveWriter *writer = arg;
+	writer->ok = saveStateWrite(writer->file, writer->snapshot, writer->base);
+	writer->ok &= fflush(writer->file) == 0 && fsync(fileno(writer->file)) == 0;
+	writer->ok &= fclose(writer->file) == 0;
+	return NULL;
+}
+
+SaveWriter *saveStateBegin(const Snapshot *snapshot, const Snapshot *base, const char *path)
+{
+	SaveWriter *writer = calloc(1, sizeof(SaveWriter));
+	if (writer == NULL){
+		return NULL;
+	}
+	writer->snapshot = snapshot;
+	writer->base = base;
+	writer->path = strdup(path);
+	writer->temporary = malloc(strlen(path) + 5);
+	if (writer->path == NULL || writer->temporary == NULL){
+		goto failed;
+	}
+	sprintf(writer->temporary, "%s.tmp", path);
+	writer->file = fopen(writer->temporary, "wb");
+	if (writer->file == NULL){
+		goto failed;
+	}
+	if (pthread_create(&writer->thread, NULL, writeThread, writer) != 0){
+		fclose(writer->file);
+		remove(writer->temporary);
+		goto failed;
+	}
+	return writer;
+failed:
+	free(writer->path);
+	free(writer->temporary);
+	free(writer);
+	return NULL;
+}
+
+bool saveStateFinish(SaveWriter *writer)
+{
+	bool ok;
+	pthread_join(writer->thread, NULL);
+	ok = writer->ok && rename(writer->temporary, writer->path) == 0;
+	if (!ok){
+		remove(writer->temporary);
+	}
+	free(writer->path);
+	free(writer->temporary);
+	free(writer);
+	return ok;
+}
+
+/* Reads all of path, up to MAX_STATE_SIZE bytes */
+static uint8_t *readState(const char *path, long *size)
+{
+	FILE *file = fopen(path, "rb");
+	uint8_t *data;
+	if (file == NULL){
+		return NULL;
+	}
+	data = malloc(MAX_STATE_SIZE + 1);
+	if (data == NULL){
+		fclose(file);
+		return NULL;
+	}
+	*size = fread(data, 1, MAX_STATE_SIZE + 1, file);
+	fclose(file);
+	if (*size > MAX_STATE_SIZE){
+		free(data);
+		errno = EINVAL;
+		return NULL;
+	}
+	return data;
+}
+
+bool saveStateLoad(CPU *cpu, const char *path, uint64_t *id)
+{
+	long size;
+	uint8_t *data = readState(path, &size);
+	uint8_t (*pages)[MEMORY_PAGE_SIZE];
+	bool present[MEMORY_PAGE_COUNT] = { false };
+	const uint8_t *at;
+	uint32_t count;
+	uint32_t i;
+	int error = EIO;
+	if (data == NULL){
+		return false;
+	}
+	pages = malloc(MEMORY_PAGE_COUNT * MEMORY_PAGE_SIZE);
+	if (pages == NULL){
+		free(data);
+		return false;
+	}
+	if (size < HEADER_SIZE + 8 * fieldCount + 4 || memcmp(data, SAVE_STATE_MAGIC, 8) != 0
+		|| getLittle(data + 8, 2) != SAVE_STATE_VERSION || getLittle(data + 10, 2) != (uint64_t)fieldCount){
+		error = EINVAL;
+		goto failed;
+	}
+	if (fnv1a(2166136261u, data, size - 4) != getLittle(data + size - 4, 4)){
+		goto failed;
+	}
+	if (getLittle(data + 24, 8) != 0 && getLittle(data + 24, 8) != *id){
+		error = ESTALE;
+		goto failed;
+	}
+	/* Everything is checked before the CPU is touched */
+	count = getLittle(data + 12, 4);
+	at = data + HEADER_SIZE + 8 * fieldCount;
+	for (i = 0; i < count; i++){
+		int page;
+		int length;
+		if (at + 4 > data + size - 4){
+			goto failed;
+		}
+		page = at[0];
+		length = getLittle(at + 2, 2);
+		if (at + 4 + length > data + size - 4 || present[page]){
+			goto failed;
+		}
+		if (at[1] == 0 && length == MEMORY_PAGE_SIZE){
+			memcpy(pages[page], at + 4, MEMORY_PAGE_SIZE);
+		}
+		else if (at[1] != 1 || !unpackBits(at + 4, length, pages[page])){
+			goto failed;
+		}
+		present[page] = true;
+		at += 4 + length;
+	}
+	if (at != data + size - 4){
+		goto failed;
+	}
+	for (i = 0; i < MEMORY_PAGE_COUNT * MEMORY_PAGE_SIZE; i++){
+		if (present[i >> MEMORY_PAGE_SHIFT]){
+			cpuWriteByte(cpu, i, pages[i >> MEMORY_PAGE_SHIFT][i & (MEMORY_PAGE_SIZE - 1)]);
+		}
+	}
+	at = data + HEADER_SIZE;
+#define READ_FIELD(name) cpu->name = (__typeof__(cpu->name))(int64_t)getLittle(at, 8); at += 8;
+	CPU_STATE_FIELDS(READ_FIELD)
+#undef READ_FIELD
+	*id = getLittle(data + 16, 8);
+	free(pages);
+	free(data);
+	return true;
+failed:
+	free(pages);
+	free(data);
+	errno = error;
+	return false;
+}
+
+bool isSaveState(const char *path)
+{
+	char magic[8];
+	FILE *file = fopen(path, "rb");
+	bool match;
+	if (file == NULL){
+		return false;
+	}
+	match = fread(magic, 1, 8, file) == 8 && memcmp(magic, SAVE_STATE_MAGIC, 8) == 0;
+	fclose(file);
+	return match;
+}
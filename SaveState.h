@@ -0,0 +1,54 @@
+#ifndef SAVESTATE_H
+#define SAVESTATE_H
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include "Core.h"
+/* Save states.
+	A save state is written from a Snapshot, so the CPU only stops for
+	the cpuSnapshot() call; the file is written by a thread of its own
+	while the CPU runs on. Files are written under a temporary name and
+	renamed into place, so a crash mid-write leaves the previous state.
+
+	File layout, little-endian:
+		"8080SAVE"                 magic
+		u16 version                SAVE_STATE_VERSION
+		u16 fields                 number of state fields that follow
+		u32 pages                  number of page records that follow
+		u64 id                     this state
+		u64 baseId                 state a delta applies to, 0 for a full state
+		i64 x fields               CPU_STATE_FIELDS in order
+		page records:
+			u8 page, u8 encoding, u16 length, length bytes
+		u32 checksum               FNV-1a of everything before it
+	Encoding 0 is the page's 256 bytes as they are, 1 is PackBits run
+	length coding, used when it comes out shorter. A full state holds
+	every page backed by host memory, a delta only the pages that differ
+	from its base. Handler pages are never saved. Changing
+	CPU_STATE_FIELDS needs a new version. */
+#define SAVE_STATE_VERSION 1
+#define SAVE_STATE_MAGIC "8080SAVE"
+
+typedef struct SaveWriter SaveWriter;
+
+/* The id a state written from snapshot gets, for keeping track of bases */
+uint64_t saveStateId(const Snapshot *snapshot);
+/* Writes snapshot to file as a full state, or as a delta against base
+	when base isn't NULL. Returns false on a write error. */
+bool saveStateWrite(FILE *file, const Snapshot *snapshot, const Snapshot *base);
+/* Starts writing snapshot to path on a thread of its own. Both snapshots
+	have to stay alive until saveStateFinish(). Returns NULL if the
+	thread or the temporary file couldn't be created. */
+SaveWriter *saveStateBegin(const Snapshot *snapshot, const Snapshot *base, const char *path);
+/* Waits for the write, then frees writer. Returns true if the state
+	is now in place at path. */
+bool saveStateFinish(SaveWriter *writer);
+/* Loads the state at path into cpu. A delta only applies on top of its
+	base: *id holds the id of the state the CPU holds now (0 for none) and
+	is replaced by the loaded state's id. Returns false with errno set, and
+	cpu untouched, for a file that isn't a save state of this version
+	(EINVAL), is damaged (EIO) or is a delta for another base (ESTALE). */
+bool saveStateLoad(CPU *cpu, const char *path, uint64_t *id);
+/* True if the file at path starts with SAVE_STATE_MAGIC */
+bool isSaveState(const char *path);
+#endif
@@ -0,0 +1,302 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include "TimeTravel.h"
+#include "Replay.h"
+
+typedef struct Checkpoint {
+	Snapshot *snapshot;
+	int64_t cycle;
+	/* Input from here to the next checkpoint, filled in through stream
+		while this is the newest checkpoint */
+	FILE *stream;
+	char *log;
+	size_t logSize;
+} Checkpoint;
+
+struct TimeTravel {
+	CPU *cpu;
+	int interval;
+	int64_t nextCheckpoint; /* cycle the live CPU takes its next one at */
+	int count;
+	int first; /* ring of count checkpoints, oldest at first */
+	int used;
+	Checkpoint *checkpoints;
+	/* The view replays its own copy of one checkpoint's log */
+	CPU view;
+	bool viewing;
+	bool viewMade;
+	int64_t viewEnd; /* cycle of the checkpoint after the one replayed */
+	FILE *viewStream;
+	char *viewLog;
+};
+
+static Checkpoint *checkpointAt(const TimeTravel *travel, int i)
+{
+	return &travel->checkpoints[(travel->first + i) % travel->count];
+}
+
+static void dropCheckpoint(Checkpoint *checkpoint)
+{
+	snapshotFree(checkpoint->snapshot);
+	if (checkpoint->stream != NULL){
+		fclose(checkpoint->stream);
+	}
+	free(checkpoint->log);
+	memset(checkpoint, 0, sizeof(Checkpoint));
+}
+
+/* Starts a new checkpoint at the live CPU's cycle, dropping the oldest
+	if the ring is full */
+static bool checkpoint(TimeTravel *travel)
+{
+	CPU *cpu = travel->cpu;
+	Snapshot *snapshot = cpuSnapshot(cpu);
+	Checkpoint *newest;
+	if (snapshot == NULL){
+		return false;
+	}
+	/* the previous checkpoint's log is complete */
+	if (cpu->inputLog != NULL){
+		inputLogClose(cpu->inputLog);
+		cpu->inputLog = NULL;
+		newest = checkpointAt(travel, travel->used - 1);
+		fclose(newest->stream);
+		newest->stream = NULL;
+	}
+	if (travel->used == travel->count){
+		dropCheckpoint(checkpointAt(travel, 0));
+		travel->first = (travel->first + 1) % travel->count;
+		travel->used--;
+	}
+	newest = checkpointAt(travel, travel->used);
+	newest->snapshot = snapshot;
+	newest->cycle = cpu->cycleCount;
+	newest->stream = open_memstream(&newest->log, &newest->logSize);
+	if (newest->stream != NULL){
+		cpu->inputLog = inputLogRecord(newest->stream);
+	}
+	if (cpu->inputLog == NULL){
+		dropCheckpoint(newest);
+		return false;
+	}
+	/* the header, so the log can be replayed before the CPU runs */
+	inputLogFlush(cpu->inputLog);
+	travel->used++;
+	travel->nextCheckpoint = cpu->cycleCount > INT64_MAX - travel->interval ? INT64_MAX : cpu->cycleCount + travel->interval;
+	return true;
+}
+
+TimeTravel *timeTravelCreate(CPU *cpu, int interval, int count)
+{
+	TimeTravel *travel;
+	if (cpu->inputLog != NULL || interval <= 0 || count <= 0){
+		return NULL;
+	}
+	travel = calloc(1, sizeof(TimeTravel));
+	if (travel == NULL){
+		return NULL;
+	}
+	travel->checkpoints = calloc(count, sizeof(Checkpoint));
+	travel->cpu = cpu;
+	travel->interval = interval;
+	travel->count = count;
+	if (travel->checkpoints == NULL || !checkpoint(travel)){
+		timeTravelFree(travel);
+		return NULL;
+	}
+	return travel;
+}
+
+static void closeViewLog(TimeTravel *travel)
+{
+	inputLogClose(travel->view.inputLog);
+	travel->view.inputLog = NULL;
+	if (travel->viewStream != NULL){
+		fclose(travel->viewStream);
+		travel->viewStream = NULL;
+	}
+	free(travel->viewLog);
+	travel->viewLog = NULL;
+}
+
+void timeTravelFree(TimeTravel *travel)
+{
+	int i;
+	if (travel == NULL){
+		return;
+	}
+	if (travel->viewMade){
+		closeViewLog(travel);
+		cpuFree(&travel->view);
+	}
+	inputLogClose(travel->cpu->inputLog);
+	travel->cpu->inputLog = NULL;
+	for (i = 0; i < travel->used; i++){
+		dropCheckpoint(checkpointAt(travel, i));
+	}
+	free(travel->checkpoints);
+	free(travel);
+}
+
+ExitReason timeTravelRun(TimeTravel *travel, int64_t cycles)
+{
+	CPU *cpu = travel->cpu;
+	int64_t end = cpu->cycleCount > INT64_MAX - cycles ? INT64_MAX : cpu->cycleCount + cycles;
+	ExitReason reason;
+	do {
+		int64_t stop = travel->nextCheckpoint < end ? travel->nextCheckpoint : end;
+		reason = cpuRunCycles(cpu, stop - cpu->cycleCount);
+		/* without a checkpoint the history only gets longer to replay */
+		if (cpu->cycleCount >= travel->nextCheckpoint && !checkpoint(travel)){
+			travel->nextCheckpoint = cpu->cycleCount > INT64_MAX - travel->interval ? INT64_MAX : cpu->cycleCount + travel->interval;
+		}
+	} while (reason == EXIT_BUDGET && cpu->cycleCount < end);
+	return reason;
+}
+
+int64_t timeTravelOldest(const TimeTravel *travel)
+{
+	return checkpointAt(travel, 0)->cycle;
+}
+
+/* Index of the newest checkpoint taken before cycle (or at it, with
+	atOrBefore), -1 for none */
+static int checkpointBefore(const TimeTravel *travel, int64_t cycle, bool atOrBefore)
+{
+	int i;
+	for (i = travel->used - 1; i >= 0; i--){
+		int64_t at = checkpointAt(travel, i)->cycle;
+		if (at < cycle || (atOrBefore && at == cycle)){
+			return i;
+		}
+	}
+	return -1;
+}
+
+/* Handler pages reach the live CPU's devices, so the view gets pages
+	that read 0xFF and drop writes in their place */
+static void muteHandlers(CPU *view)
+{
+	uint32_t i;
+	for (i = 0; i < MEMORY_PAGE_COUNT; i++){
+		const MemoryPage *page = &view->pages[i];
+		if (page->host == NULL && (page->read != NULL || page->write != NULL)){
+			cpuMapHandlers(view, i << MEMORY_PAGE_SHIFT, MEMORY_PAGE_SIZE, NULL, NULL, NULL);
+		}
+	}
+}
+
+/* Puts the view at checkpoint i, replaying its log from there */
+static bool replayFrom(TimeTravel *travel, int i)
+{
+	Checkpoint *checkpoint = checkpointAt(travel, i);
+	CPU *view = &travel->view;
+	if (!travel->viewMade){
+		cpuFork(view, checkpoint->snapshot);
+		travel->viewMade = true;
+	}
+	else{
+		cpuRestore(view, checkpoint->snapshot);
+	}
+	muteHandlers(view);
+	closeViewLog(travel);
+	/* the live CPU's log keeps growing, so the view replays a copy */
+	travel->viewLog = malloc(checkpoint->logSize);
+	if (travel->viewLog == NULL){
+		return false;
+	}
+	memcpy(travel->viewLog, checkpoint->log, checkpoint->logSize);
+	travel->viewStream = fmemopen(travel->viewLog, checkpoint->logSize, "rb");
+	if (travel->viewStream == NULL){
+		return false;
+	}
+	view->inputLog = inputLogReplay(travel->viewStream, view);
+	travel->viewEnd = i + 1 < travel->used ? checkpointAt(travel, i + 1)->cycle : INT64_MAX;
+	travel->viewing = view->inputLog != NULL;
+	return travel->viewing;
+}
+
+CPU *timeTravelSeek(TimeTravel *travel, int64_t cycle)
+{
+	int i = checkpointBefore(travel, cycle, true);
+	CPU *view = &travel->view;
+	if (i < 0 || cycle > travel->cpu->cycleCount || !replayFrom(travel, i)){
+		return NULL;
+	}
+	if (cycle > view->cycleCount){
+		cpuRunCycles(view, cycle - view->cycleCount);
+	}
+	return view;
+}
+
+CPU *timeTravelStepBack(TimeTravel *travel)
+{
+	return timeTravelReverseContinue(travel, NULL, NULL);
+}
+
+CPU *timeTravelStep(TimeTravel *travel)
+{
+	CPU *view = &travel->view;
+	if (!travel->viewing || view->cycleCount >= travel->cpu->cycleCount){
+		return NULL;
+	}
+	if (cpuRunCycles(view, 1) != EXIT_BUDGET){
+		return view;
+	}
+	/* on into the next checkpoint's log */
+	if (view->cycleCount >= travel->viewEnd){
+		return timeTravelSeek(travel, view->cycleCount);
+	}
+	return view;
+}
+
+CPU *timeTravelReverseContinue(TimeTravel *travel, TimeTravelCondition condition, void *context)
+{
+	CPU *view = &travel->view;
+	bool wasViewing = travel->viewing;
+	int64_t start = wasViewing ? view->cycleCount : travel->cpu->cycleCount;
+	int64_t before = start;
+	int i;
+	/* Each checkpoint's stretch is replayed one instruction at a time,
+		newest first, remembering the last boundary the condition held at */
+	for (i = checkpointBefore(travel, before, false); i >= 0; i--){
+		bool found = false;
+		int64_t target = 0;
+		if (!replayFrom(travel, i)){
+			return NULL;
+		}
+		while (view->cycleCount < before){
+			if (condition == NULL || condition(view, context)){
+				found = true;
+				target = view->cycleCount;
+			}
+			if (cpuRunCycles(view, 1) != EXIT_BUDGET){
+				break;
+			}
+		}
+		if (found){
+			return timeTravelSeek(travel, target);
+		}
+		before = checkpointAt(travel, i)->cycle;
+	}
+	/* nothing found, the view goes back to where it was */
+	if (wasViewing){
+		timeTravelSeek(travel, start);
+	}
+	else{
+		travel->viewing = false;
+	}
+	return NULL;
+}
+
+CPU *timeTravelView(TimeTravel *travel)
+{
+	return travel->viewing ? &travel->view : NULL;
+}
+
+void timeTravelLeave(TimeTravel *travel)
+{
+	travel->viewing = false;
+}
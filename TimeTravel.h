@@ -0,0 +1,49 @@
+#ifndef TIMETRAVEL_H
+#define TIMETRAVEL_H
+#include <stdbool.h>
+#include "Core.h"
+/* Reverse execution.
+	The live CPU runs as usual, but takes a checkpoint every interval
+	cycles: a snapshot and an input log of its own (see Replay.h). A run
+	follows from its start state and its input, so any earlier instruction
+	boundary is reached by restoring the checkpoint before it and replaying
+	forward, at most interval cycles. Snapshots share pages copy-on-write,
+	so a checkpoint costs one 256-byte copy per page stored to afterwards,
+	and nothing is added to the instructions themselves.
+	The past is looked at through a view, a CPU of the time traveller's
+	own, so the live CPU is never disturbed and carries on from the
+	present. The view has no ports; OUTs it replays go nowhere. Nor does
+	it reach memory-mapped devices: handler pages read 0xFF and drop
+	writes in the view, and as the input log only holds IN and interrupts,
+	history that reads device registers isn't reproduced from there on. Only the
+	last count checkpoints are kept, which bounds how far back it reaches.
+	While attached, the live CPU's inputLog belongs to the time traveller. */
+typedef bool (*TimeTravelCondition)(const CPU *cpu, void *context);
+typedef struct TimeTravel TimeTravel;
+
+/* Starts keeping cpu's history, with its first checkpoint now. Returns
+	NULL if out of memory or cpu already has an input log. */
+TimeTravel *timeTravelCreate(CPU *cpu, int interval, int count);
+/* Detaches from the CPU and frees the history and the view */
+void timeTravelFree(TimeTravel *travel);
+/* cpuRunCycles() for the live CPU, taking checkpoints on the way */
+ExitReason timeTravelRun(TimeTravel *travel, int64_t cycles);
+/* Cycle of the oldest checkpoint, as far back as the view can go */
+int64_t timeTravelOldest(const TimeTravel *travel);
+
+/* The functions below move the view and return it, or return NULL
+	if the history doesn't reach that far. */
+/* To the first instruction boundary at or after cycle */
+CPU *timeTravelSeek(TimeTravel *travel, int64_t cycle);
+/* One instruction back from the view, or from the present without one */
+CPU *timeTravelStepBack(TimeTravel *travel);
+/* One instruction forward, up to the present */
+CPU *timeTravelStep(TimeTravel *travel);
+/* Back to the last boundary before the view (or the present) where
+	condition holds, like a debugger's reverse-continue */
+CPU *timeTravelReverseContinue(TimeTravel *travel, TimeTravelCondition condition, void *context);
+/* The view, NULL when looking at the present */
+CPU *timeTravelView(TimeTravel *travel);
+/* Back to the present */
+void timeTravelLeave(TimeTravel *travel);
+#endif
@@ -0,0 +1,88 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include "Timing.h"
+#include "Core.h"
+#include "Loader.h"
+
+/* Flags that make every condition false, then every one true. Conditions
+	go NZ, Z, NC, C, PO, PE, P, M, so the odd ones hold with every flag set. */
+static const uint8_t conditionFlags[2] = { 0, FLAG_MASK };
+
+/* The published figures, typed in apart from opcodeCycles so the check
+	can catch a wrong entry there: { not taken, taken } for each opcode,
+	the same twice for all but the conditional calls and returns. The
+	undocumented opcodes are given what the instruction they copy takes
+	(0x30 and HLT aren't run). */
+static const uint8_t datasheetCycles[256][2] = {
+	/* 00 */ { 4, 4 }, { 10, 10 }, { 7, 7 }, { 5, 5 }, { 5, 5 }, { 5, 5 }, { 7, 7 }, { 4, 4 },
+	/* 08 */ { 4, 4 }, { 10, 10 }, { 7, 7 }, { 5, 5 }, { 5, 5 }, { 5, 5 }, { 7, 7 }, { 4, 4 },
+	/* 10 */ { 4, 4 }, { 10, 10 }, { 7, 7 }, { 5, 5 }, { 5, 5 }, { 5, 5 }, { 7, 7 }, { 4, 4 },
+	/* 18 */ { 4, 4 }, { 10, 10 }, { 7, 7 }, { 5, 5 }, { 5, 5 }, { 5, 5 }, { 7, 7 }, { 4, 4 },
+	/* 20 */ { 4, 4 }, { 10, 10 }, { 16, 16 }, { 5, 5 }, { 5, 5 }, { 5, 5 }, { 7, 7 }, { 4, 4 },
+	/* 28 */ { 4, 4 }, { 10, 10 }, { 16, 16 }, { 5, 5 }, { 5, 5 }, { 5, 5 }, { 7, 7 }, { 4, 4 },
+	/* 30 */ { 4, 4 }, { 10, 10 }, { 13, 13 }, { 5, 5 }, { 10, 10 }, { 10, 10 }, { 10, 10 }, { 4, 4 },
+	/* 38 */ { 4, 4 }, { 10, 10 }, { 13, 13 }, { 5, 5 }, { 5, 5 }, { 5, 5 }, { 7, 7 }, { 4, 4 },
+	/* 40 */ { 5, 5 }, { 5, 5 }, { 5, 5 }, { 5, 5 }, { 5, 5 }, { 5, 5 }, { 7, 7 }, { 5, 5 },
+	/* 48 */ { 5, 5 }, { 5, 5 }, { 5, 5 }, { 5, 5 }, { 5, 5 }, { 5, 5 }, { 7, 7 }, { 5, 5 },
+	/* 50 */ { 5, 5 }, { 5, 5 }, { 5, 5 }, { 5, 5 }, { 5, 5 }, { 5, 5 }, { 7, 7 }, { 5, 5 },
+	/* 58 */ { 5, 5 }, { 5, 5 }, { 5, 5 }, { 5, 5 }, { 5, 5 }, { 5, 5 }, { 7, 7 }, { 5, 5 },
+	/* 60 */ { 5, 5 }, { 5, 5 }, { 5, 5 }, { 5, 5 }, { 5, 5 }, { 5, 5 }, { 7, 7 }, { 5, 5 },
+	/* 68 */ { 5, 5 }, { 5, 5 }, { 5, 5 }, { 5, 5 }, { 5, 5 }, { 5, 5 }, { 7, 7 }, { 5, 5 },
+	/* 70 */ { 7, 7 }, { 7, 7 }, { 7, 7 }, { 7, 7 }, { 7, 7 }, { 7, 7 }, { 7, 7 }, { 7, 7 },
+	/* 78 */ { 5, 5 }, { 5, 5 }, { 5, 5 }, { 5, 5 }, { 5, 5 }, { 5, 5 }, { 7, 7 }, { 5, 5 },
+	/* 80 */ { 4, 4 }, { 4, 4 }, { 4, 4 }, { 4, 4 }, { 4, 4 }, { 4, 4 }, { 7, 7 }, { 4, 4 },
+	/* 88 */ { 4, 4 }, { 4, 4 }, { 4, 4 }, { 4, 4 }, { 4, 4 }, { 4, 4 }, { 7, 7 }, { 4, 4 },
+	/* 90 */ { 4, 4 }, { 4, 4 }, { 4, 4 }, { 4, 4 }, { 4, 4 }, { 4, 4 }, { 7, 7 }, { 4, 4 },
+	/* 98 */ { 4, 4 }, { 4, 4 }, { 4, 4 }, { 4, 4 }, { 4, 4 }, { 4, 4 }, { 7, 7 }, { 4, 4 },
+	/* A0 */ { 4, 4 }, { 4, 4 }, { 4, 4 }, { 4, 4 }, { 4, 4 }, { 4, 4 }, { 7, 7 }, { 4, 4 },
+	/* A8 */ { 4, 4 }, { 4, 4 }, { 4, 4 }, { 4, 4 }, { 4, 4 }, { 4, 4 }, { 7, 7 }, { 4, 4 },
+	/* B0 */ { 4, 4 }, { 4, 4 }, { 4, 4 }, { 4, 4 }, { 4, 4 }, { 4, 4 }, { 7, 7 }, { 4, 4 },
+	/* B8 */ { 4, 4 }, { 4, 4 }, { 4, 4 }, { 4, 4 }, { 4, 4 }, { 4, 4 }, { 7, 7 }, { 4, 4 },
+	/* C0 */ { 5, 11 }, { 10, 10 }, { 10, 10 }, { 10, 10 }, { 11, 17 }, { 11, 11 }, { 7, 7 }, { 11, 11 },
+	/* C8 */ { 5, 11 }, { 10, 10 }, { 10, 10 }, { 10, 10 }, { 11, 17 }, { 17, 17 }, { 7, 7 }, { 11, 11 },
+	/* D0 */ { 5, 11 }, { 10, 10 }, { 10, 10 }, { 10, 10 }, { 11, 17 }, { 11, 11 }, { 7, 7 }, { 11, 11 },
+	/* D8 */ { 5, 11 }, { 10, 10 }, { 10, 10 }, { 10, 10 }, { 11, 17 }, { 17, 17 }, { 7, 7 }, { 11, 11 },
+	/* E0 */ { 5, 11 }, { 10, 10 }, { 10, 10 }, { 18, 18 }, { 11, 17 }, { 11, 11 }, { 7, 7 }, { 11, 11 },
+	/* E8 */ { 5, 11 }, { 5, 5 }, { 10, 10 }, { 4, 4 }, { 11, 17 }, { 17, 17 }, { 7, 7 }, { 11, 11 },
+	/* F0 */ { 5, 11 }, { 10, 10 }, { 10, 10 }, { 4, 4 }, { 11, 17 }, { 11, 11 }, { 7, 7 }, { 11, 11 },
+	/* F8 */ { 5, 11 }, { 5, 5 }, { 10, 10 }, { 4, 4 }, { 11, 17 }, { 17, 17 }, { 7, 7 }, { 11, 11 }
+};
+
+int timingCheck(FILE *out)
+{
+	static uint8_t memory[65536];
+	int mismatches = 0;
+	int opcode;
+	int i;
+	for (opcode = 0; opcode < 256; opcode++){
+		/* unimplemented, the dump opcode, and HLT which waits */
+		if (opcode == 0x08 || opcode == 0x18 || opcode == 0x30 || opcode == 0x76){
+			continue;
+		}
+		for (i = 0; i < 2; i++){
+			CPU cpu;
+			int64_t cycles;
+			int expected;
+			memset(memory, 0, sizeof(memory));
+			memory[PROGRAM_ADDRESS] = opcode;
+			memory[PROGRAM_ADDRESS + 1] = 0x00;
+			memory[PROGRAM_ADDRESS + 2] = 0x02;
+			cpuInit(&cpu, memory);
+			cpu.programCounter = PROGRAM_ADDRESS;
+			cpu.stackPointer = 0x8000;
+			cpu.flags = conditionFlags[i] | FLAG_ALWAYS_ONE;
+			cpu.H = 0x40;
+			cpuRunCycles(&cpu, 1);
+			cycles = cpu.cycleCount;
+			cpuFree(&cpu);
+			expected = datasheetCycles[opcode][((opcode >> 3) & 1) == i];
+			if (cycles != expected){
+				fprintf(out, "%02x with flags %02x: %d cycles, the datasheet says %d\n", opcode, conditionFlags[i],
+					(int)cycles, expected);
+				mismatches++;
+			}
+		}
+	}
+	return mismatches;
+}
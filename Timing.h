@@ -0,0 +1,39 @@
+#ifndef TIMING_H
+#define TIMING_H
+#include <stdio.h>
+#include <stdint.h>
+/* Instruction timings in clock cycles (states), as the Intel 8080
+	datasheet gives them. Every engine charges these: the interpreter's
+	instruction bodies and the native code the dynarec emits. Conditional
+	calls and returns cost the table's figure when they fall through and
+	that plus the extra below when taken; conditional jumps cost the same
+	either way. The undocumented opcodes cost what the instruction they
+	copy does, 0x30 (the dump opcode) what a NOP does. An interrupt costs
+	what its RST does. */
+#define CALL_TAKEN_CYCLES 6
+#define RETURN_TAKEN_CYCLES 6
+
+static const uint8_t opcodeCycles[256] = {
+	/* 0_ */ 4, 10, 7, 5, 5, 5, 7, 4, 4, 10, 7, 5, 5, 5, 7, 4,
+	/* 1_ */ 4, 10, 7, 5, 5, 5, 7, 4, 4, 10, 7, 5, 5, 5, 7, 4,
+	/* 2_ */ 4, 10, 16, 5, 5, 5, 7, 4, 4, 10, 16, 5, 5, 5, 7, 4,
+	/* 3_ */ 4, 10, 13, 5, 10, 10, 10, 4, 4, 10, 13, 5, 5, 5, 7, 4,
+	/* 4_ */ 5, 5, 5, 5, 5, 5, 7, 5, 5, 5, 5, 5, 5, 5, 7, 5,
+	/* 5_ */ 5, 5, 5, 5, 5, 5, 7, 5, 5, 5, 5, 5, 5, 5, 7, 5,
+	/* 6_ */ 5, 5, 5, 5, 5, 5, 7, 5, 5, 5, 5, 5, 5, 5, 7, 5,
+	/* 7_ */ 7, 7, 7, 7, 7, 7, 7, 7, 5, 5, 5, 5, 5, 5, 7, 5,
+	/* 8_ */ 4, 4, 4, 4, 4, 4, 7, 4, 4, 4, 4, 4, 4, 4, 7, 4,
+	/* 9_ */ 4, 4, 4, 4, 4, 4, 7, 4, 4, 4, 4, 4, 4, 4, 7, 4,
+	/* A_ */ 4, 4, 4, 4, 4, 4, 7, 4, 4, 4, 4, 4, 4, 4, 7, 4,
+	/* B_ */ 4, 4, 4, 4, 4, 4, 7, 4, 4, 4, 4, 4, 4, 4, 7, 4,
+	/* C_ */ 5, 10, 10, 10, 11, 11, 7, 11, 5, 10, 10, 10, 11, 17, 7, 11,
+	/* D_ */ 5, 10, 10, 10, 11, 11, 7, 11, 5, 10, 10, 10, 11, 17, 7, 11,
+	/* E_ */ 5, 10, 10, 18, 11, 11, 7, 11, 5, 5, 10, 4, 11, 17, 7, 11,
+	/* F_ */ 5, 10, 10, 4, 11, 11, 7, 11, 5, 5, 10, 4, 11, 17, 7, 11
+};
+
+/* Runs every implemented opcode but HLT and 0x30 once in a scratch CPU,
+	with the condition false and then true, and writes each one whose
+	cycles don't match the datasheet to out. Returns how many didn't. */
+int timingCheck(FILE *out);
+#endif
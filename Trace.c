@@ -0,0 +1,109 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include "Core.h"
+#include "Trace.h"
+
+static const char hexDigits[] = "0123456789abcdef";
+
+TraceSink *traceOpen(TraceMode mode, FILE *out)
+{
+	TraceSink *sink;
+	if (mode == TRACE_OFF || out == NULL){
+		return NULL;
+	}
+	sink = malloc(sizeof(TraceSink));
+	if (sink == NULL){
+		return NULL;
+	}
+	sink->mode = mode;
+	sink->out = out;
+	sink->used = 0;
+	return sink;
+}
+
+void traceFlush(TraceSink *sink)
+{
+	if (sink->used > 0){
+		fwrite(sink->buffer, 1, sink->used, sink->out);
+		sink->used = 0;
+	}
+	fflush(sink->out);
+}
+
+void traceClose(TraceSink *sink)
+{
+	if (sink == NULL){
+		return;
+	}
+	traceFlush(sink);
+	free(sink);
+}
+
+int traceModeFromName(const char *name)
+{
+	if (strcmp(name, "off") == 0){
+		return TRACE_OFF;
+	}
+	if (strcmp(name, "binary") == 0){
+		return TRACE_BINARY;
+	}
+	if (strcmp(name, "text") == 0){
+		return TRACE_TEXT;
+	}
+	return -1;
+}
+
+/* Writes value as lower case hex without leading zeros, like printf("%x") */
+static uint8_t *putHex(uint8_t *out, unsigned value)
+{
+	uint8_t digits[8];
+	int count = 0;
+	do {
+		digits[count++] = hexDigits[value & 0xF];
+		value >>= 4;
+	} while (value);
+	while (count){
+		*out++ = digits[--count];
+	}
+	return out;
+}
+
+void traceInstruction(TraceSink *sink, const CPU *cpu, uint8_t opcode)
+{
+	uint8_t *out;
+	/* Worst case is a text record, well under 64 bytes */
+	if (sink->used > TRACE_BUFFER_SIZE - 64){
+		fwrite(sink->buffer, 1, sink->used, sink->out);
+		sink->used = 0;
+	}
+	out = &sink->buffer[sink->used];
+	if (sink->mode == TRACE_BINARY){
+		out[0] = cpu->programCounter & 0xFF;
+		out[1] = cpu->programCounter >> 8;
+		out[2] = cpu->stackPointer & 0xFF;
+		out[3] = cpu->stackPointer >> 8;
+		out[4] = opcode;
+		out[5] = cpuFlags(cpu);
+		out[6] = cpu->A;
+		out[7] = cpu->B;
+		out[8] = cpu->C;
+		out[9] = cpu->D;
+		out[10] = cpu->E;
+		out[11] = cpu->H;
+		out[12] = cpu->L;
+		out[13] = 0;
+		out[14] = cpu->cycleCount & 0xFF;
+		out[15] = (cpu->cycleCount >> 8) & 0xFF;
+		sink->used += TRACE_RECORD_SIZE;
+		return;
+	}
+	/* Same text the core has always printed, so old logs still diff */
+	memcpy(out, "OPCODE:", 7);
+	out = putHex(out + 7, opcode);
+	memcpy(out, "\nProgram Counter:", 17);
+	out = putHex(out + 17, cpu->programCounter);
+	*out++ = '\n';
+	sink->used = out - sink->buffer;
+}
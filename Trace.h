@@ -0,0 +1,41 @@
+#ifndef TRACE_H
+#define TRACE_H
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+/* Per-instruction tracing.
+	The hook in tick() only exists when built with -DTRACE, and even then
+	costs a single pointer test per instruction while no sink is attached.
+	Records are gathered in a large buffer and written with one fwrite
+	per TRACE_BUFFER_SIZE bytes. */
+#define TRACE_BUFFER_SIZE (1 << 20)
+/* Binary records are fixed size, little endian:
+	PC(2) SP(2) opcode flags(PSW layout) A B C D E H L pad cycles(2)
+	where cycles is the low 16 bits of cycleCount, enough to recover the
+	per-instruction deltas. */
+#define TRACE_RECORD_SIZE 16
+
+typedef enum TraceMode {
+	TRACE_OFF,
+	TRACE_BINARY,
+	TRACE_TEXT
+} TraceMode;
+
+typedef struct TraceSink {
+	TraceMode mode;
+	FILE *out;
+	size_t used;
+	uint8_t buffer[TRACE_BUFFER_SIZE];
+} TraceSink;
+
+struct CPU;
+
+/* Returns NULL for TRACE_OFF or if the sink can't be allocated */
+TraceSink *traceOpen(TraceMode mode, FILE *out);
+void traceInstruction(TraceSink *sink, const struct CPU *cpu, uint8_t opcode);
+void traceFlush(TraceSink *sink);
+/* Flushes and frees the sink, the FILE is left open */
+void traceClose(TraceSink *sink);
+/* Parses "off", "binary" or "text", returns -1 for anything else */
+int traceModeFromName(const char *name);
+#endif
@@ -1,25 +1,342 @@
 #include <stdio.h>
+#include <stdlib.h>
 #include <stdint.h>
+#include <string.h>
 #include <inttypes.h>
-#define CPU_DIAG
-#define CPU_DIAG_OFFSET 0x100
-FILE *file;
-extern uint8_t memory[65536];
+#include "Core.h"
+#include "Loader.h"
+#include "Batch.h"
+#include "Trace.h"
+#include "Profile.h"
+#include "Dynarec.h"
+#include "SaveState.h"
+#include "Replay.h"
+#include "Debugger.h"
+#include "Timing.h"
+#include "Pacer.h"
+#include "Banks.h"
+#define MAX_SEGMENTS 16
+#define CHECKPOINT_CYCLES 100000000
+uint8_t memory[65536];
+CPU cpu;
+static void usage(const char *name)
+{
+	fprintf(stderr, "usage: %s <program>\n", name);
+	fprintf(stderr, "       %s [--trace off|binary|text] [--trace-file path] [--cycles N] [--stats]\n", name);
+	fprintf(stderr, "           [--rom path@address] [--load path@address] [--checkpoint path [--checkpoint-every N]]\n");
+	fprintf(stderr, "           [--record log | --replay log] [--profile report] [--stacks path] [--clock Hz] [--debug] [program | state [--delta state]...]\n");
+	fprintf(stderr, "       %s --batch <manifest|directory> [--cycles N] [--jobs N]\n", name);
+	fprintf(stderr, "       %s --check-timing | --check-banks\n", name);
+	fprintf(stderr, "--rom maps an image read-only, --load copy-on-write, at a page aligned address\n");
+	fprintf(stderr, "A save state written by --checkpoint can be given in place of the program\n");
+	fprintf(stderr, "--record logs every IN and interrupt, --replay feeds a log back from the same start\n");
+	fprintf(stderr, "--debug reads debugger commands from stdin, including steps backwards\n");
+	fprintf(stderr, "--profile writes the hottest opcodes, addresses and call targets to report at the end\n");
+	fprintf(stderr, "--stacks writes the cycles spent in each guest call stack, folded for flame graph tools\n");
+	fprintf(stderr, "--clock runs in step with the wall clock at Hz (2e6 for 2 MHz), flat out without it\n");
+	fprintf(stderr, "--check-timing runs every opcode and compares its cycles with the datasheet's\n");
+	fprintf(stderr, "--check-banks switches banks around a snapshot and checks neither loses a store\n");
+}
+/* path@address, address in C notation */
+static bool parseSegment(LoadSegment *segment, char *spec, bool writable)
+{
+	char *at = strrchr(spec, '@');
+	char *end;
+	long address;
+	if (at == NULL){
+		return false;
+	}
+	address = strtol(at + 1, &end, 0);
+	if (at[1] == '\0' || *end != '\0' || address < 0 || address > 0xFFFF){
+		return false;
+	}
+	*at = '\0';
+	segment->path = spec;
+	segment->address = address;
+	segment->writable = writable;
+	return true;
+}
+/* Runs like tick(), stopping every `every` cycles to write a save state
+	to path. The CPU only waits for the snapshot, each file is written
+	while the next slice runs. Paced when pacer isn't NULL. */
+static void runWithCheckpoints(CPU *cpu, Pacer *pacer, const char *path, int every)
+{
+	Snapshot *snapshot = NULL;
+	SaveWriter *writer = NULL;
+	int64_t budget;
+	for (;;){
+		budget = every;
+		if (cpu->cycleLimit != 0 && cpu->cycleLimit - cpu->cycleCount < budget){
+			budget = cpu->cycleLimit - cpu->cycleCount;
+		}
+		if ((pacer != NULL ? pacerRun(pacer, cpu, budget) : cpuRunCycles(cpu, budget)) != EXIT_BUDGET || (cpu->cycleLimit != 0 && cpu->cycleCount >= cpu->cycleLimit)){
+			break;
+		}
+		if (writer != NULL && !saveStateFinish(writer)){
+			perror(path);
+		}
+		snapshotFree(snapshot);
+		snapshot = cpuSnapshot(cpu);
+		writer = snapshot != NULL ? saveStateBegin(snapshot, NULL, path) : NULL;
+		if (writer == NULL){
+			perror(path);
+		}
+	}
+	if (writer != NULL && !saveStateFinish(writer)){
+		perror(path);
+	}
+	snapshotFree(snapshot);
+}
+static void writeProfile(const Profile *profile, void (*write)(const Profile *, FILE *), const char *path)
+{
+	FILE *out = fopen(path, "w");
+	if (out == NULL){
+		perror(path);
+		return;
+	}
+	write(profile, out);
+	fclose(out);
+}
 int main(int argc, char **argv) { 
-	file = fopen(argv[1], "rb");
-	if (file == NULL){
-		perror("Failed: ");
+	const char *batchSource = NULL;
+	const char *program = NULL;
+	int64_t cycleLimit = 0;
+	int jobs = 0;
+	int traceMode = TRACE_OFF;
+	const char *traceFile = NULL;
+	FILE *traceOut = stdout;
+	bool showStats = false;
+	bool debug = false;
+	DynarecStats stats;
+	LoadSegment segments[MAX_SEGMENTS];
+	Image *images[MAX_SEGMENTS];
+	int segmentCount = 0;
+	const char *deltas[MAX_SEGMENTS];
+	int deltaCount = 0;
+	const char *checkpointPath = NULL;
+	int checkpointCycles = CHECKPOINT_CYCLES;
+	bool programIsState;
+	uint64_t stateId = 0;
+	const char *recordPath = NULL;
+	const char *replayPath = NULL;
+	FILE *inputFile = NULL;
+	const char *profilePath = NULL;
+	const char *stacksPath = NULL;
+	int64_t clockHz = 0;
+	Pacer pacer;
+	int i;
+	for (i = 1; i < argc; i++){
+		if (strcmp(argv[i], "--check-timing") == 0){
+			return timingCheck(stdout) == 0 ? 0 : 1;
+		}
+		else if (strcmp(argv[i], "--check-banks") == 0){
+			return bankCheck(stdout) == 0 ? 0 : 1;
+		}
+		else if (strcmp(argv[i], "--batch") == 0 && i + 1 < argc){
+			batchSource = argv[++i];
+		}
+		else if (strcmp(argv[i], "--cycles") == 0 && i + 1 < argc){
+			cycleLimit = strtoll(argv[++i], NULL, 0);
+		}
+		else if (strcmp(argv[i], "--jobs") == 0 && i + 1 < argc){
+			jobs = atoi(argv[++i]);
+		}
+		else if (strcmp(argv[i], "--trace") == 0 && i + 1 < argc){
+			traceMode = traceModeFromName(argv[++i]);
+			if (traceMode < 0){
+				usage(argv[0]);
+				return -1;
+			}
+		}
+		else if (strcmp(argv[i], "--trace-file") == 0 && i + 1 < argc){
+			traceFile = argv[++i];
+		}
+		else if (strcmp(argv[i], "--stats") == 0){
+			showStats = true;
+		}
+		else if (strcmp(argv[i], "--debug") == 0){
+			debug = true;
+		}
+		else if ((strcmp(argv[i], "--rom") == 0 || strcmp(argv[i], "--load") == 0) && i + 1 < argc
+			&& segmentCount < MAX_SEGMENTS){
+			if (!parseSegment(&segments[segmentCount++], argv[i + 1], strcmp(argv[i], "--load") == 0)){
+				usage(argv[0]);
+				return -1;
+			}
+			i++;
+		}
+		else if (strcmp(argv[i], "--delta") == 0 && i + 1 < argc && deltaCount < MAX_SEGMENTS){
+			deltas[deltaCount++] = argv[++i];
+		}
+		else if (strcmp(argv[i], "--record") == 0 && i + 1 < argc && replayPath == NULL){
+			recordPath = argv[++i];
+		}
+		else if (strcmp(argv[i], "--replay") == 0 && i + 1 < argc && recordPath == NULL){
+			replayPath = argv[++i];
+		}
+		else if (strcmp(argv[i], "--profile") == 0 && i + 1 < argc){
+			profilePath = argv[++i];
+		}
+		else if (strcmp(argv[i], "--stacks") == 0 && i + 1 < argc){
+			stacksPath = argv[++i];
+		}
+		else if (strcmp(argv[i], "--clock") == 0 && i + 1 < argc){
+			clockHz = strtod(argv[++i], NULL);
+			if (!pacerInit(&pacer, clockHz)){
+				usage(argv[0]);
+				return -1;
+			}
+		}
+		else if (strcmp(argv[i], "--checkpoint") == 0 && i + 1 < argc){
+			checkpointPath = argv[++i];
+		}
+		else if (strcmp(argv[i], "--checkpoint-every") == 0 && i + 1 < argc){
+			checkpointCycles = atoi(argv[++i]);
+			if (checkpointCycles <= 0){
+				usage(argv[0]);
+				return -1;
+			}
+		}
+		else if (argv[i][0] != '-' && program == NULL){
+			program = argv[i];
+		}
+		else{
+			usage(argv[0]);
+			return -1;
+		}
+	}
+	if (batchSource != NULL){
+		return runBatch(batchSource, cycleLimit, jobs) == 0 ? 0 : 1;
+	}
+	if (program == NULL && segmentCount == 0){
+		usage(argv[0]);
+		return -1;
+	}
+	programIsState = program != NULL && isSaveState(program);
+	if (deltaCount != 0 && !programIsState){
+		usage(argv[0]);
+		return -1;
+	}
+	cpuInit(&cpu, memory);
+	if (program != NULL && !programIsState && mapProgram(&cpu, program) == NULL){
+		perror(program);
+		return -1;
+	}
+	if (!loadSegments(&cpu, segments, segmentCount, images)){
+		perror("Failed to map segment");
+		return -1;
+	}
+	/* After the segments, so the state's pages land on top of them */
+	if (programIsState && !saveStateLoad(&cpu, program, &stateId)){
+		perror(program);
+		return -1;
+	}
+	for (i = 0; i < deltaCount; i++){
+		if (!saveStateLoad(&cpu, deltas[i], &stateId)){
+			perror(deltas[i]);
+			return -1;
+		}
+	}
+	cpu.cycleLimit = cycleLimit;
+	if (traceMode != TRACE_OFF){
+#ifndef TRACE
+		fprintf(stderr, "Tracing needs a build with -DTRACE\n");
+		return -1;
+#endif
+		if (traceFile != NULL){
+			traceOut = fopen(traceFile, "wb");
+			if (traceOut == NULL){
+				perror(traceFile);
+				return -1;
+			}
+		}
+		cpu.trace = traceOpen(traceMode, traceOut);
+	}
+	if (profilePath != NULL || stacksPath != NULL){
+#ifndef PROFILE
+		fprintf(stderr, "Profiling needs a build with -DPROFILE\n");
 		return -1;
+#endif
+		cpu.profile = profileCreate();
+		if (cpu.profile == NULL){
+			perror("Failed to allocate the profile");
+			return -1;
+		}
+	}
+	if (recordPath != NULL){
+		inputFile = fopen(recordPath, "wb");
+		cpu.inputLog = inputFile != NULL ? inputLogRecord(inputFile) : NULL;
+		if (cpu.inputLog == NULL){
+			perror(recordPath);
+			return -1;
+		}
+	}
+	else if (replayPath != NULL){
+		/* After any state is loaded, the log is replayed from its cycle */
+		inputFile = fopen(replayPath, "rb");
+		cpu.inputLog = inputFile != NULL ? inputLogReplay(inputFile, &cpu) : NULL;
+		if (cpu.inputLog == NULL){
+			perror(replayPath);
+			return -1;
+		}
+	}
+	if (debug){
+		if (clockHz != 0){
+			fprintf(stderr, "The debugger runs unpaced, --clock can't be used with --debug\n");
+			return -1;
+		}
+		if (!debugRun(&cpu, stdin, stderr)){
+			fprintf(stderr, "The debugger can't be used with --record or --replay\n");
+			return -1;
+		}
+	}
+	else if (checkpointPath != NULL){
+		runWithCheckpoints(&cpu, clockHz != 0 ? &pacer : NULL, checkpointPath, checkpointCycles);
+	}
+	else if (clockHz != 0){
+		pacerRun(&pacer, &cpu, cpu.cycleLimit ? cpu.cycleLimit - cpu.cycleCount : INT64_MAX);
+	}
+	else{
+		tick(&cpu);
+	}
+	if (cpu.exitReason == EXIT_NO_MEMORY){
+		fprintf(stderr, "Out of memory at cycle %" PRId64 ", PC %04x\n", cpu.cycleCount, cpu.programCounter);
+	}
+	else if (cpu.exitReason == EXIT_DIVERGED){
+		fprintf(stderr, "Replay diverged from %s at cycle %" PRId64 ", PC %04x\n", replayPath, cpu.cycleCount, cpu.programCounter);
+	}
+	if (showStats){
+		if (cpuDynarecStats(&cpu, &stats)){
+			fprintf(stderr, "dynarec: %" PRIu64 " compiled, %" PRIu64 " rejected, %" PRIu64 " rejected as self-modifying, %" PRIu64 " invalidated\n",
+				stats.blocksCompiled, stats.blocksRejected, stats.smcRejected, stats.invalidations);
+			fprintf(stderr, "dynarec: %" PRIu64 " native runs, %" PRIu64 " bailed to the interpreter, %zu of %zu code cache bytes used, %" PRIu64 " flushes\n",
+				stats.nativeRuns, stats.bails, stats.codeBytes, stats.cacheSize, stats.flushes);
+		}
+		else{
+			fprintf(stderr, "Translation stats need a build with -DBLOCK_CACHE -DDYNAREC\n");
+		}
+		if (clockHz != 0){
+			pacerReport(&pacer, &cpu, stderr);
+		}
+	}
+	if (cpu.profile != NULL){
+		profileFinish(cpu.profile, &cpu);
+		if (profilePath != NULL){
+			writeProfile(cpu.profile, profileReport, profilePath);
+		}
+		if (stacksPath != NULL){
+			writeProfile(cpu.profile, profileStacks, stacksPath);
+		}
+		profileFree(cpu.profile);
+	}
+	cpuFree(&cpu);
+	traceClose(cpu.trace);
+	if (traceOut != stdout){
+		fclose(traceOut);
+	}
+	inputLogClose(cpu.inputLog);
+	if (inputFile != NULL){
+		fclose(inputFile);
 	}
-	fseek(file, 0, SEEK_END);
-	long filelen = ftell(file);
-	rewind(file);
-	#ifdef CPU_DIAG
-	fread(&memory[CPU_DIAG_OFFSET], 1, filelen, file);
-	#else
-	fread(&memory, 1, filelen, file);
-	#endif
-	fclose(file);
-	tick();
 	return 1;
 }
\ No newline at end of file